@@ -14,76 +14,23 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
-#include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <linux/if_bridge.h>
 #include <netinet/if_ether.h>
 #include "defs.h"
 #include "queue.h"
 
 #define SYSFS_PATH_ "/sys/class/net/"
 
-struct port_name {
-	TAILQ_ENTRY(port_name) link;
-	char ifname[IFNAMSIZ];
-};
-TAILQ_HEAD(port_name_list, port_name); 
-struct port_name_list pnl = TAILQ_HEAD_INITIALIZER(pnl);
-
-struct mdb {
-	TAILQ_ENTRY(mdb) link;
-
-	char br[16];
-	char group[64];		/* XXX: audit for ipv6 */
-	char port[128];		/* XXX: too small prob */
-	int  vid;
-};
-
-
-TAILQ_HEAD(, mdb) mdb_list = TAILQ_HEAD_INITIALIZER(mdb_list);
 static char *br   = "br0";
 static int compat = 0;
 extern int detail;
-
-
-static struct mdb *find(char *group, int vid)
-{
-	struct mdb *e;
-
-	TAILQ_FOREACH(e, &mdb_list, link) {
-		if (!strcmp(group, e->group) && vid == e->vid)
-			return e;
-	}
-
-	return NULL;
-}
-
-static struct mdb *alloc(void)
-{
-	struct mdb *e;
-
-	e = calloc(1, sizeof(struct mdb));
-	if (!e)
-		return NULL;
-
-	TAILQ_INSERT_TAIL(&mdb_list, e, link);
-
-	return e;
-}
-
-static void drop(void)
-{
-	struct mdb *e, *tmp;
-
-	TAILQ_FOREACH_SAFE(e, &mdb_list, link, tmp) {
-		TAILQ_REMOVE(&mdb_list, e, link);
-		free(e);
-	}
-}
+extern int json;
 
 static char *bridge_path(char *setting)
 {
@@ -94,66 +41,6 @@ static char *bridge_path(char *setting)
 	return path;
 }
 
-static int populate(void)
-{
-	struct mdb *e;
-	FILE *fp;
-	char buf[80];
-	int num = 0;
-
-	fp = popen("bridge mdb show", "r");
-	if (!fp)
-		return -1;
-
-	while (fgets(buf, sizeof(buf), fp)) {
-		char br[5], port[16], group[64];
-		char *tok, *dst;
-		int vid = 0;
-
-		for (tok = strtok(buf, " \t"); tok; tok = strtok(NULL, " \t")) {
-			if (!strcmp(tok, "dev")) {
-				dst = br;
-			} else if (!strcmp(tok, "port")) {
-				dst = port;
-			} else if (!strcmp(tok, "grp")) {
-				dst = group;
-			} else if (!strcmp(tok, "vid")) {
-				tok = strtok(NULL, " \t");
-				vid = strtol(tok, NULL, 10);
-				continue;
-			} else {
-				continue;
-			}
-
-			tok = strtok(NULL, " \t");
-			strcpy(dst, tok);
-		}
-
-		/* XXX: Filter out IPv6 and MAC for now ... */
-		if (strchr(group, ':'))
-			continue;
-
-		e = find(group, vid);
-		if (!e) {
-			e = alloc();
-			if (!e) {
-				logit(LOG_ERR, errno, "Failed allocating mdb entry");
-				break;
-			}
-		}
-
-		if (e->port[0])
-			strcat(e->port, ", ");
-		strcat(e->port, port);
-		strncpy(e->br, br, sizeof(e->br));
-		strncpy(e->group, group, sizeof(e->group));
-		e->vid = vid;
-		num++;
-	}
-
-	return pclose(fp);
-}
-
 static int value(char *path)
 {
 	FILE *fp;
@@ -169,57 +56,7 @@ static int value(char *path)
 	return val;
 }
 
-static int has(char *path, char *setting)
-{
-	char  file[512];
-
-	if (snprintf(file, sizeof(file), "%s/%s", path, setting) >= (int)sizeof(file)) {
-		logit(LOG_WARNING, 0, "Internal buffer overflow, cannot read value of %s/%s", path, setting);
-		return 0;
-	}
-	logit(LOG_DEBUG, 0, "Has %s", file);
-
-	return value(file);
-}
-
-static char *got(char *prop, int setval, int first)
-{
-	struct dirent *d;
-	static char path[256];
-	static DIR *dir = NULL;
-
-	logit(LOG_DEBUG, 0, "Checking %s for property %s ...", br, prop);
-	if (first) {
-		if (dir)
-			closedir(dir);
-
-		snprintf(path, sizeof(path), SYSFS_PATH_"%s/brif", br);
-		logit(LOG_DEBUG, 0, "Opening %s to figure out %s ports ...", path, br);
-		dir = opendir(path);
-		if (!dir) {
-			logit(LOG_WARNING, errno, "Failed listing %s ports", br);
-			return NULL;
-		}
-	}
-
-	while ((d = readdir(dir))) {
-		char ifpath[512];
-
-		if (DT_LNK != d->d_type)
-			continue;
-
-		snprintf(ifpath, sizeof(ifpath), "%s/%s", path, d->d_name);
-		if (has(ifpath, prop) == setval)
-			return d->d_name;
-	}
-
-	closedir(dir);
-	dir = NULL;
-
-	return NULL;
-}
-
- static int cmpstringp(const void *p1, const void *p2)
+static int cmpstringp(const void *p1, const void *p2)
 {
 
 	const char *str1 = *(const char **)p1;
@@ -257,154 +94,194 @@ static char *got(char *prop, int setval, int first)
 
 }
 
-void bridge_prop(FILE *fp, char *prop, int setval)
+struct prop_match {
+	int          prop;
+	int          setval;
+	int          num;
+	int          max;
+	const char **names;
+};
+
+static int prop_match(struct mdb_iface *mi, void *arg)
 {
-	char *ifname;
-	char **array = NULL;
-	int num = 0;
-	int x = 0;
-	struct port_name *name = NULL, *next = NULL;		
+	struct prop_match *pm = (struct prop_match *)arg;
 
-	while ((ifname = got(prop, setval, !num))) {
+	if (mi->mi_prop[pm->prop] != pm->setval)
+		return 0;
 
-		name = malloc(sizeof(struct port_name));
-		if (!name)
-			goto out;
-		strncpy(name->ifname, ifname, IFNAMSIZ);
-		logit(LOG_DEBUG, 0, "Loop, name %s", name->ifname);
+	if (pm->num == pm->max) {
+		const char **names;
+		int max = pm->max ? pm->max * 2 : 16;
 
-		TAILQ_INSERT_TAIL(&pnl, name, link);	
-		num++;
-		name = NULL;
+		names = realloc(pm->names, max * sizeof(char *));
+		if (!names)
+			return -1;
+		pm->names = names;
+		pm->max   = max;
 	}
+	pm->names[pm->num++] = mi->mi_ifname;
 
-	array = malloc(num * sizeof(char*));
-	if (!array)
-		goto out;
+	return 0;
+}
 
-	for(int j=0; j<num; j++) {
-		array[j] = malloc(IFNAMSIZ * sizeof(char));
-		if (!array[j])
-			goto out;
-	}
-	
-	TAILQ_FOREACH(name, &pnl, link) {
-		logit(LOG_DEBUG, 0, "Foreach, port name: %s", name->ifname);
-		strncpy(array[x], name->ifname, IFNAMSIZ);
-		x++;
-	}
+/*
+ * Ports of bridge with multicast port attribute set to setval, from the
+ * port table kept by netlink, sorted.  Caller frees pm->names.
+ */
+static void prop_names(struct prop_match *pm, int prop, int setval)
+{
+	int brindex;
 
-	qsort(array, num, sizeof(char *), cmpstringp);
+	memset(pm, 0, sizeof(*pm));
+	pm->prop   = prop;
+	pm->setval = setval;
 
-	for (int i=0; i<num; i++) {
-		logit(LOG_DEBUG, 0, "Array val: %s, index: %d", array[i], i);
-		fprintf(fp, "%s%s", i ? ", " : "", array[i]);
-	}
+	brindex = mdb_ifindex(br);
+	if (brindex && mdb_brport_foreach(brindex, prop_match, pm))
+		logit(LOG_WARNING, errno, "Failed listing %s ports", br);
 
-out:
-	/* Cleaning up */
-	if (array) {
-		for (int j=0; j<num; j++)
-		{
-			if (array[j]) 
-				free(array[j]);
-		}
+	qsort(pm->names, pm->num, sizeof(char *), cmpstringp);
+}
 
-		free(array);
-	}
+/*
+ * List ports of bridge with multicast port attribute set to setval
+ */
+void bridge_prop(FILE *fp, int prop, int setval)
+{
+	struct prop_match pm;
 
-	for (name = TAILQ_FIRST(&pnl); name; name = next) {
-	    next = TAILQ_NEXT(name, link);
-        TAILQ_REMOVE(&pnl, name, link);
-		free(name);
-	}
+	prop_names(&pm, prop, setval);
+	for (int i = 0; i < pm.num; i++)
+		fprintf(fp, "%s%s", i ? ", " : "", pm.names[i]);
+	free(pm.names);
 
-	if (!num && compat)
+	if (!pm.num && compat)
 		fprintf(fp, "---");
 	fprintf(fp, "\n");
 }
 
+void bridge_prop_json(struct json *j, const char *key, int prop, int setval)
+{
+	struct prop_match pm;
+
+	prop_names(&pm, prop, setval);
+	json_arr(j, key);
+	for (int i = 0; i < pm.num; i++)
+		json_str(j, NULL, pm.names[i]);
+	json_close(j);
+	free(pm.names);
+}
+
+/* Discovered router port, one per port even if on several VLANs */
+struct rtr_port {
+	char		 name[IFNAMSIZ];
+	int		 ifindex;
+	int		 expires;	/* sec left, -1 if unknown */
+};
+
+static int cmpname(const void *p1, const void *p2)
+{
+	return strcmp(((const struct rtr_port *)p1)->name, ((const struct rtr_port *)p2)->name);
+}
+
 /*
- * Parse output from bridge -s -json vlan global:
- * > bridge -s -json vlan global show br0 | jq
- * [
- *   {
- *     "ifname": "br0",
- *     "vlans": [
- *       {
- *         "vlan": 1,
- *         ...
- *         "router_ports": [
- *           {
- *             "port": "eth0",
- *             "timer": "  29.01",
- *             "type": "temp"
- *           }
- *         ]
- *       },
- *       {
- *         "vlan": 2,
- *         ...
- *         "router_ports": [
- *           {
- *             "port": "eth1",
- *             "timer": "  19.04",
- *             "type": "temp"
- *           }
- *         ]
- *       }
- *     ]
- *   }
- * ]
+ * Discovered (dynamic) router ports, on any VLAN, from the router port
+ * mirror kept by netlink, sorted by name.  Static router ports are shown
+ * by the caller using bridge_prop() MDB_PORT_MCAST_ROUTER 2.  Returns
+ * the number of ports in *list, which the caller must free, or -1.
  */
-void bridge_router_ports(FILE *fp)
+static int router_ports(struct rtr_port **list)
 {
-	static const char *bridge_args = "-json -s vlan global show dev";
-	static const char *jq_filter = ".[].vlans[] | " \
-				       "if has(\"router_ports\") == true then .router_ports[].port + \" \" + " \
-					   ".router_ports[].timer + \" \" + .router_ports[].type else \"false\" end";
-	char prev_ifname[20] = { 0 };
-	char cmd[300], buf[80];
-	int num = 0;
-	FILE *rfp;
-	int ret;
-
-	ret = snprintf(cmd, sizeof(cmd), "bridge %s %s | jq -r '%s' | sort",
-		       bridge_args, br, jq_filter);
-
-	if (ret < 0 || ret >= (int)sizeof(cmd))
-		goto fail;
-	
-	rfp = popen(cmd, "r");
+	struct rtr_port *ports;
+	struct mdb_rtr *r;
+	uint64_t now;
+	int i, num = 0;
 
-	if (!rfp)
-		goto fail;
+	for (r = mdb_router_iter(1); r; r = mdb_router_iter(0))
+		num++;
 
-	while (fgets(buf, sizeof(buf), rfp)) {
-		char ifname[20];
-		int seen = 0;
-		float timer;
+	*list = ports = calloc(num ? num : 1, sizeof(*ports));
+	if (!ports)
+		return -1;
 
-		if (sscanf(buf, "%19s %2f temp", ifname, &timer) != 2)
+	now = pev_now();
+	num = 0;
+	for (r = mdb_router_iter(1); r; r = mdb_router_iter(0)) {
+		struct mdb_iface *mi;
+		int expires = -1;
+
+		/* Notifications have no type, check port attribute */
+		mi = mdb_iface_find(r->mr_port);
+		if (r->mr_type == MDB_RTR_TYPE_PERM ||
+		    (mi && mi->mi_prop[MDB_PORT_MCAST_ROUTER] == MDB_RTR_TYPE_PERM))
 			continue;
 
-		seen = prev_ifname[0] && !strncmp(ifname, prev_ifname, sizeof(ifname));
+		if (r->mr_expires)
+			expires = r->mr_expires > now ? (r->mr_expires - now) / PEV_NSEC_PER_SEC : 0;
 
-		logit(LOG_DEBUG, 0, "Found router port %s with %.2f s timeout\n", ifname, timer);
-		if (timer > 0.0 && !seen) {
-			fprintf(fp, "%s%s", num ? ", " : "", ifname);
-			num++;
-			memcpy(prev_ifname, ifname, sizeof(prev_ifname));
+		for (i = 0; i < num; i++) {
+			if (ports[i].ifindex == r->mr_port)
+				break;
+		}
+		if (i < num) {
+			/* Same port on another VLAN, show the longest timer */
+			if (expires > ports[i].expires)
+				ports[i].expires = expires;
+			continue;
 		}
+
+		strlcpy(ports[num].name, mdb_ifname(r->mr_port), sizeof(ports[num].name));
+		ports[num].ifindex = r->mr_port;
+		ports[num].expires = expires;
+		num++;
 	}
-	pclose(rfp);
 
-fail:
-	if (!num && compat)
+	qsort(ports, num, sizeof(*ports), cmpname);
+
+	return num;
+}
+
+void bridge_router_ports(FILE *fp)
+{
+	struct rtr_port *ports;
+	int num;
+
+	num = router_ports(&ports);
+	for (int i = 0; i < num; i++) {
+		fprintf(fp, "%s%s", i ? ", " : "", ports[i].name);
+		if (ports[i].expires >= 0)
+			fprintf(fp, " (%d sec)", ports[i].expires);
+	}
+	free(ports);
+
+	if (num <= 0 && compat)
 		fprintf(fp, "---");
 	fprintf(fp, "\n");
 }
 
+/* Names in array key, remaining time per port in object key-timers */
+void bridge_router_ports_json(struct json *j, const char *key)
+{
+	struct rtr_port *ports;
+	char timers[64];
+	int num;
+
+	num = router_ports(&ports);
+	json_arr(j, key);
+	for (int i = 0; i < num; i++)
+		json_str(j, NULL, ports[i].name);
+	json_close(j);
+
+	snprintf(timers, sizeof(timers), "%s-timers", key);
+	json_obj(j, timers);
+	for (int i = 0; i < num; i++) {
+		if (ports[i].expires >= 0)
+			json_int(j, ports[i].name, ports[i].expires);
+	}
+	json_close(j);
+	free(ports);
+}
+
 static int enabled(void)
 {
 	return value(bridge_path("multicast_snooping"));
@@ -412,72 +289,29 @@ static int enabled(void)
 
 /*
  * Dumpster diving in the ARP cache and the bridge's FDB to figure out
- * the MAC address of a given IP, and which port we learned it on.
+ * the MAC address of a given IP, and which port we learned it on.  Both
+ * caches are kept up to date by netlink.
  */
-static void dumpster(char *addr, char *mac, size_t mlen, char *port, size_t plen)
+static void dumpster(uint32_t addr, char *mac, size_t mlen, char *port, size_t plen)
 {
-	char lladdr[20] = { 0 };
-	int found = 0;
-	char buf[256];
-	char *ptr;
-	FILE *pp;
+	uint8_t lladdr[ETH_ALEN];
+	int ifindex;
 
 	if (mac)
 		strlcpy(mac, "00:c0:ff:ee:00:01", mlen);
 	if (port)
 		strlcpy(port, "N/A", plen);
 
-	pp = popen("ip neigh", "r");
-	if (pp) {
-		while (fgets(buf, sizeof(buf), pp)) {
-			logit(LOG_DEBUG, 0, "line: %s", buf);
-			ptr = strpbrk(buf, " \t\n");
-			if (!ptr)
-				continue;
-
-			*ptr++ = 0;
-			logit(LOG_DEBUG, 0, "line ip '%s' vs addr '%s'", buf, addr);
-			if (strcmp(buf, addr))
-				continue;
-
-			logit(LOG_DEBUG, 0, "Searching line %s for lladdr", ptr);
-			ptr = strstr(ptr, "lladdr");
-			if (!ptr)
-				continue;
-
-			strlcpy(lladdr, &ptr[7], sizeof(lladdr));
-			ptr = strpbrk(lladdr, " \t\n");
-			if (ptr)
-				*ptr = 0;
-			if (mac)
-				strlcpy(mac, lladdr, mlen);
-			found = 1;
-			break;
-		}
-		pclose(pp);
-	}
-
-	if (!found)
+	if (neigh_lookup(addr, lladdr))
 		return;
 
-	pp = popen("bridge fdb", "r");
-	if (pp) {
-		while (fgets(buf, sizeof(buf), pp)) {
-			logit(LOG_DEBUG, 0, "line: %s", buf);
-			if (strncmp(buf, lladdr, 17))
-				continue;
-
-			ptr = strstr(buf, "dev");
-			if (ptr && port) {
-				strlcpy(port, &ptr[4], plen);
-				ptr = strpbrk(port, " \t\n");
-				if (ptr)
-					*ptr = 0;
-			}
-			break;
-		}
-		pclose(pp);
-	}
+	if (mac)
+		snprintf(mac, mlen, "%02x:%02x:%02x:%02x:%02x:%02x", lladdr[0],
+			 lladdr[1], lladdr[2], lladdr[3], lladdr[4], lladdr[5]);
+
+	ifindex = neigh_fdb_lookup(lladdr);
+	if (ifindex && port)
+		strlcpy(port, mdb_ifname(ifindex), plen);
 }
 
 static int is_frnt_vlan(int vid)
@@ -501,6 +335,137 @@ static int is_frnt_vlan(int vid)
 	return 0;
 }
 
+/* VLAN id of interface, from its name, e.g. vlan1 or br0.1 */
+int bridge_vid(struct ifi *ifi)
+{
+	char dev[10];
+	char *ptr;
+	int len;
+
+	len = snprintf(dev, sizeof(dev), "%s.", br);
+	if (!strncmp(ifi->ifi_name, "vlan", 4))
+		ptr = &ifi->ifi_name[4];
+	else if (!strncmp(ifi->ifi_name, dev, len))
+		ptr = &ifi->ifi_name[len];
+	else
+		ptr = ifi->ifi_name;
+
+	return atoi(ptr);
+}
+
+static void group_json(struct json *j, struct mdb_entry *e)
+{
+	uint8_t mac[ETH_ALEN];
+	struct mdb_port *p;
+	struct in_addr ina;
+	char buf[20];
+
+	ina.s_addr = e->me_group;
+	ETHER_MAP_IP_MULTICAST(&ina, mac);
+	snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+		 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	json_obj(j, NULL);
+	json_int(j, "vid", e->me_vid);
+	json_str(j, "group", inet_ntoa(ina));
+	json_str(j, "mac", buf);
+	json_arr(j, "ports");
+	TAILQ_FOREACH(p, &e->me_ports, mp_link)
+		json_str(j, NULL, mdb_ifname(p->mp_ifindex));
+	json_close(j);
+	json_close(j);
+}
+
+static int group_entry_json(struct mdb_entry *e, void *arg)
+{
+	group_json((struct json *)arg, e);
+	return 0;
+}
+
+/*
+ * All groups in the MDB mirror, as the array "groups"
+ */
+int bridge_groups_json(struct json *j)
+{
+	int rc;
+
+	json_arr(j, "groups");
+	rc = mdb_foreach(group_entry_json, j);
+	json_close(j);
+	if (rc)
+		logit(LOG_WARNING, errno, "Failed reading MDB");
+
+	return rc;
+}
+
+static int show_compat_json(FILE *fp)
+{
+	struct json j;
+	struct ifi *ifi;
+	int vnum = 0;
+
+	json_init(&j, fp);
+	json_obj(&j, NULL);
+	json_bool(&j, "snooping", enabled());
+	bridge_prop_json(&j, "fast-leave-ports", MDB_PORT_FAST_LEAVE, 1);
+	bridge_prop_json(&j, "static-router-ports", MDB_PORT_MCAST_ROUTER, 2);
+	bridge_router_ports_json(&j, "router-ports");
+	bridge_prop_json(&j, "flood-ports", MDB_PORT_MCAST_FLOOD, 1);
+
+	json_arr(&j, "queriers");
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		char mac[20], port[20];
+		int vid;
+
+		vid = bridge_vid(ifi);
+		if (is_frnt_vlan(vid))
+			continue;
+
+		vnum++;
+		json_obj(&j, NULL);
+		json_int(&j, "vid", vid);
+		if (!ifi->ifi_querier) {
+			json_str(&j, "address", inet_fmt(ifi->ifi_curr_addr, s1, sizeof(s1)));
+			json_bool(&j, "local", 1);
+		} else {
+			dumpster(ifi->ifi_querier->al_addr, mac, sizeof(mac), port, sizeof(port));
+			json_str(&j, "address", inet_fmt(ifi->ifi_querier->al_addr, s1, sizeof(s1)));
+			json_bool(&j, "local", 0);
+			json_str(&j, "mac", mac);
+			json_str(&j, "port", port);
+			json_int(&j, "interval", igmp_query_interval);
+			json_int(&j, "timeout", querier_timeout(ifi));
+		}
+		json_close(&j);
+	}
+	json_close(&j);
+
+	bridge_groups_json(&j);
+	json_int(&j, "total", mdb_count());
+	json_int(&j, "max", 2048);
+	json_int(&j, "vlans", vnum);
+
+	return json_end(&j);
+}
+
+static int show_compat_entry(struct mdb_entry *e, void *arg)
+{
+	FILE *fp = (FILE *)arg;
+	uint8_t mac[ETH_ALEN];
+	struct in_addr ina;
+
+	ina.s_addr = e->me_group;
+	ETHER_MAP_IP_MULTICAST(&ina, mac);
+
+	fprintf(fp, "%4d  %-15s  %02X:%02X:%02X:%02X:%02X:%02X  ",
+		e->me_vid, inet_ntoa(ina), mac[0], mac[1], mac[2],
+		mac[3], mac[4], mac[5]);
+	mdb_ports(fp, e);
+	fprintf(fp, "\n");
+
+	return 0;
+}
+
 /*
  * For compatibility with output from WeOS 5 igmp tool, which in turn
  * was made to emulate the output of the WeOS 4 igmpd.
@@ -508,9 +473,11 @@ static int is_frnt_vlan(int vid)
 int show_bridge_compat(FILE *fp)
 {
 	struct ifi *ifi;
-	struct mdb *e;
 	int num, vnum;
 
+	if (json)
+		return show_compat_json(fp);
+
 	if (!enabled()) {
 		fprintf(fp, "IGMP/MLD snooping is disabled.\n");
 		return 0;
@@ -526,14 +493,14 @@ int show_bridge_compat(FILE *fp)
 	 * multicast flooded on    => multicast_flood
 	 */
 	fprintf(fp, " Static Multicast ports=\n");
-	fprintf(fp, " %-26s : ", "IGMP Fast Leave ports");      bridge_prop(fp, "multicast_fast_leave", 1);
-	fprintf(fp, " %-26s : ", "Static router ports");        bridge_prop(fp, "multicast_router", 2);
+	fprintf(fp, " %-26s : ", "IGMP Fast Leave ports");      bridge_prop(fp, MDB_PORT_FAST_LEAVE, 1);
+	fprintf(fp, " %-26s : ", "Static router ports");        bridge_prop(fp, MDB_PORT_MCAST_ROUTER, 2);
 	fprintf(fp, " %-26s : ", "Discovered router ports");    bridge_router_ports(fp);
 	if (detail) {
 		fprintf(fp, " %-26s : ---\n", "Dual Homing/Coupling ports");
 		fprintf(fp, " %-26s : ---\n", "FRNT ring ports");
 	}
-	fprintf(fp, " %-26s : ", "Multicast flooded on ports"); bridge_prop(fp, "multicast_flood", 1);
+	fprintf(fp, " %-26s : ", "Multicast flooded on ports"); bridge_prop(fp, MDB_PORT_MCAST_FLOOD, 1);
 
 	/*
 	 *  VID  Querier IP       Querier MAC        Port     Interval  Timeout
@@ -549,20 +516,10 @@ int show_bridge_compat(FILE *fp)
 
 	vnum = 0;
 	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
-		char mac[20], port[20], dev[10];
-		int len, vid, timeout;
-		time_t now;
-		char *ptr;
-
-		len = snprintf(dev, sizeof(dev), "%s.", br);
-		if (!strncmp(ifi->ifi_name, "vlan", 4))
-			ptr = &ifi->ifi_name[4];
-		else if (!strncmp(ifi->ifi_name, dev, len))
-			ptr = &ifi->ifi_name[len];
-		else
-			ptr = ifi->ifi_name;
-		vid = atoi(ptr);
+		char mac[20], port[20];
+		int vid, timeout;
 
+		vid = bridge_vid(ifi);
 		if (is_frnt_vlan(vid))
 			continue;
 
@@ -574,9 +531,8 @@ int show_bridge_compat(FILE *fp)
 		}
 
 		inet_fmt(ifi->ifi_querier->al_addr, s1, sizeof(s1));
-		now = time(NULL);
-		timeout = router_timeout - (now - ifi->ifi_querier->al_ctime);
-		dumpster(s1, mac, sizeof(mac), port, sizeof(port));
+		timeout = querier_timeout(ifi);
+		dumpster(ifi->ifi_querier->al_addr, mac, sizeof(mac), port, sizeof(port));
 
 		if (detail)
 			fprintf(fp, "%4d  %-15s  %-17s  %-16s  %4d sec  %d sec\n", vid, s1, mac, port, igmp_query_interval, timeout);
@@ -589,28 +545,14 @@ int show_bridge_compat(FILE *fp)
 	 * -------------------------------------------------------------------------------
 	 *    1  224.0.0.251      01:00:5E:00:00:FB  Eth 5
 	 */
-	if (populate()) {
-		logit(LOG_ERR, 0, "Failed reading MDB");
-		compat = 0;
-		return 1;
-	}
-
 	fprintf(fp, "\n");
 	fprintf(fp, " VID  Multicast Group  Filtered MAC Addr  Active ports=\n");
 
-	num = 0;
-	TAILQ_FOREACH(e, &mdb_list, link) {
-		uint8_t mac[ETH_ALEN];
-		struct in_addr ina;
-
-		inet_aton(e->group, &ina);
-		ETHER_MAP_IP_MULTICAST(&ina, mac);
-
-		fprintf(fp, "%4d  %-15s  %02X:%02X:%02X:%02X:%02X:%02X  %s\n",
-		       e->vid, e->group, mac[0], mac[1], mac[2],
-		       mac[3], mac[4], mac[5], e->port);
-
-		num++;
+	num = mdb_count();
+	if (mdb_foreach(show_compat_entry, fp)) {
+		logit(LOG_WARNING, errno, "Failed reading MDB");
+		compat = 0;
+		return 1;
 	}
 
 	/*
@@ -620,37 +562,51 @@ int show_bridge_compat(FILE *fp)
 	if (detail)
 		fprintf(fp, "\n=\nTotal: %d filters, max 2048, in %d VLANs.\n", num, vnum);
 
-	drop();
 	compat = 0;
 
 	return 0;
 }
 
 
-int show_bridge_groups(FILE *fp)
+static int show_group_entry(struct mdb_entry *e, void *arg)
 {
-	struct mdb *e;
+	FILE *fp = (FILE *)arg;
+	uint8_t mac[ETH_ALEN];
+	struct in_addr ina;
 
-	if (populate()) {
-		logit(LOG_ERR, 0, "Failed reading MDB");
-		return 1;
-	}
+	ina.s_addr = e->me_group;
+	ETHER_MAP_IP_MULTICAST(&ina, mac);
 
-	fprintf(fp, " VID  Multicast MAC         Multicast Group       Ports=\n");
+	fprintf(fp, "%4d  %02X:%02X:%02X:%02X:%02X:%02X     %-20s  ",
+		e->me_vid, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+		inet_ntoa(ina));
+	mdb_ports(fp, e);
+	fprintf(fp, "\n");
+
+	return 0;
+}
 
-	TAILQ_FOREACH(e, &mdb_list, link) {
-		uint8_t mac[ETH_ALEN];
-		struct in_addr ina;
+/*
+ * Bridge MDB, from the in-memory mirror kept in sync by netlink
+ */
+int show_bridge_groups(FILE *fp)
+{
+	if (json) {
+		struct json j;
+		int rc;
 
-		inet_aton(e->group, &ina);
-		ETHER_MAP_IP_MULTICAST(&ina, mac);
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		rc = bridge_groups_json(&j);
 
-		fprintf(fp, "%4d  %02X:%02X:%02X:%02X:%02X:%02X     %-20s  %s\n",
-			e->vid,mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-			e->group, e->port);
+		return json_end(&j) || rc;
 	}
 
-	drop();
+	fprintf(fp, " VID  Multicast MAC         Multicast Group       Ports=\n");
+	if (mdb_foreach(show_group_entry, fp)) {
+		logit(LOG_WARNING, errno, "Failed reading MDB");
+		return 1;
+	}
 
 	return 0;
 }
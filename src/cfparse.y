@@ -40,7 +40,8 @@ static struct ifi scrap;
 };
 
 %token QUERY_INTERVAL QUERY_LAST_MEMBER_INTERVAL QUERY_RESPONSE_INTERVAL
-%token IGMP_ROBUSTNESS ROUTER_TIMEOUT ROUTER_ALERT
+%token IGMP_ROBUSTNESS ROUTER_TIMEOUT ROUTER_ALERT NETLINK_RCVBUF LINK_HOLDDOWN
+%token IPC_BACKLOG IPC_CLIENTS IPC_TIMEOUT METRICS_PORT SHM_GROUPS PEV_PROFILE
 %token NO PHYINT
 %token DISABLE ENABLE IGMPV1 IGMPV2 IGMPV3 STATIC_GROUP PROXY_QUERIES
 %token <num> BOOLEAN
@@ -109,6 +110,57 @@ stmt	: error
 		fatal("Invalid multicast robustness value [2,10]: %d", $2);
 	    igmp_robustness = $2;
 	}
+	| NETLINK_RCVBUF NUMBER
+	{
+	    if ($2 < 64 || $2 > 65536)
+		fatal("Invalid netlink receive buffer size [64,65536] KiB: %d", $2);
+	    netlink_set_rcvbuf($2);
+	}
+	| LINK_HOLDDOWN NUMBER
+	{
+	    if ($2 > 60000)
+		fatal("Invalid link hold-down [0,60000] msec: %d", $2);
+	    link_holddown = $2;
+	}
+	| IPC_BACKLOG NUMBER
+	{
+	    if ($2 < 1 || $2 > 1024)
+		fatal("Invalid IPC backlog [1,1024]: %d", $2);
+	    ipc_backlog = $2;
+	}
+	| IPC_CLIENTS NUMBER
+	{
+	    if ($2 < 1 || $2 > 1024)
+		fatal("Invalid IPC max clients [1,1024]: %d", $2);
+	    ipc_max_clients = $2;
+	}
+	| IPC_TIMEOUT NUMBER
+	{
+	    if ($2 < 1 || $2 > 3600)
+		fatal("Invalid IPC idle timeout [1,3600] sec: %d", $2);
+	    ipc_timeout = $2;
+	}
+	/*
+	 * Exports and profiling are off unless set.  They are reset when
+	 * reloading, see restart(), so removing one of these settings from
+	 * the .conf file and sending SIGHUP disables it.
+	 */
+	| METRICS_PORT NUMBER
+	{
+	    if ($2 < 1 || $2 > 65535)
+		fatal("Invalid metrics port [1,65535]: %d", $2);
+	    metrics_port = $2;
+	}
+	| SHM_GROUPS NUMBER
+	{
+	    if ($2 < 1 || $2 > 1048576)
+		fatal("Invalid shared memory groups [1,1048576]: %d", $2);
+	    shm_groups = $2;
+	}
+	| PEV_PROFILE BOOLEAN
+	{
+	    pev_profile($2);
+	}
 	;
 
 ifmods	: /* empty */
@@ -134,7 +186,7 @@ ifmod	: DISABLE		{ ifi->ifi_flags |= IFIF_DISABLED; }
 	    a->al_addr  = $2;
 	    a->al_pv    = 2;	/* IGMPv2 only, no SSM */
 	    a->al_flags = NBRF_STATIC_GROUP;
-	    time(&a->al_ctime);
+	    a->al_ctime = pev_now();
 
 	    TAILQ_INSERT_TAIL(&ifi->ifi_static, a, al_link);
 	}
@@ -223,6 +275,14 @@ static struct keyword {
 	{ "query-last-member-interval", QUERY_LAST_MEMBER_INTERVAL, 0 },
 	{ "robustness",         IGMP_ROBUSTNESS, 0 },
 	{ "router-timeout",     ROUTER_TIMEOUT, 0 },
+	{ "netlink-rcvbuf",     NETLINK_RCVBUF, 0 },
+	{ "link-holddown",      LINK_HOLDDOWN, 0 },
+	{ "ipc-backlog",        IPC_BACKLOG, 0 },
+	{ "ipc-clients",        IPC_CLIENTS, 0 },
+	{ "ipc-timeout",        IPC_TIMEOUT, 0 },
+	{ "metrics-port",       METRICS_PORT, 0 },
+	{ "shm-groups",         SHM_GROUPS, 0 },
+	{ "pev-profile",        PEV_PROFILE, 0 },
 	{ "no",                 NO, 0 },
 	{ "phyint",		PHYINT, 0 },
 	{ "iface",		PHYINT, 0 },
@@ -3,7 +3,9 @@
  * by the license in the accompanying file named "LICENSE".
  */
 
-#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_bridge.h>
 #include "defs.h"
 
 /*
@@ -11,6 +13,15 @@
  */
 struct ifaces ifaces = TAILQ_HEAD_INITIALIZER(ifaces);
 
+/*
+ * Interfaces known to the kernel, hashed on ifindex, for the lookup
+ * done for every IGMP packet sent and received.
+ */
+#define IFI_BUCKETS	64		/* Must be a power of two */
+
+static TAILQ_HEAD(, ifi) ifi_hash[IFI_BUCKETS];
+static int ifi_hash_init;
+
 void config_set_ifflag(uint32_t flag)
 {
     struct ifi *ifi;
@@ -68,7 +79,10 @@ struct ifi *config_find_iface(int ifindex)
 {
     struct ifi *ifi;
 
-    TAILQ_FOREACH(ifi, &ifaces, ifi_link) {
+    if (!ifindex || !ifi_hash_init)
+	return NULL;
+
+    TAILQ_FOREACH(ifi, &ifi_hash[ifindex & (IFI_BUCKETS - 1)], ifi_hlink) {
 	if (ifindex == ifi->ifi_ifindex)
             return ifi;
     }
@@ -76,29 +90,25 @@ struct ifi *config_find_iface(int ifindex)
     return NULL;
 }
 
-static int getmac(const char *ifname, uint8_t *mac, size_t size)
+/*
+ * Set, or clear with zero, kernel ifindex of interface
+ */
+void config_iface_index(struct ifi *ifi, int ifindex)
 {
-    struct ifreq ifr;
-    int rc = 0;
-    int sock;
-
-    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-        return 1;
-
-    ifr.ifr_addr.sa_family = AF_INET;
-    strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
-
-    if (ioctl(sock, SIOCGIFHWADDR, &ifr) == -1) {
-        rc = 1;
-        goto done;
+    if (!ifi_hash_init) {
+	for (size_t i = 0; i < NELEMS(ifi_hash); i++)
+	    TAILQ_INIT(&ifi_hash[i]);
+	ifi_hash_init = 1;
     }
 
-    memcpy(mac, ifr.ifr_hwaddr.sa_data, size);
+    if (ifi->ifi_ifindex == ifindex)
+	return;
 
-done:
-    close(sock);
-
-    return rc;
+    if (ifi->ifi_ifindex)
+	TAILQ_REMOVE(&ifi_hash[ifi->ifi_ifindex & (IFI_BUCKETS - 1)], ifi, ifi_hlink);
+    ifi->ifi_ifindex = ifindex;
+    if (ifindex)
+	TAILQ_INSERT_TAIL(&ifi_hash[ifindex & (IFI_BUCKETS - 1)], ifi, ifi_hlink);
 }
 
 /*
@@ -107,7 +117,6 @@ done:
 struct ifi *config_iface_add(char *ifname)
 {
     struct ifi *ifi;
-    int ifindex;
 
     ifi = config_find_ifname(ifname);
     if (ifi)
@@ -123,22 +132,38 @@ struct ifi *config_iface_add(char *ifname)
     strlcpy(ifi->ifi_name, ifname, sizeof(ifi->ifi_name));
 
     /*
-     * May not exist yet, prepare for netlink event later
+     * Kernel state, ifindex, flags and MAC, is filled in later from
+     * the netlink dump or netlink events, see config_iface_link()
      */
-    ifindex = if_nametoindex(ifname);
-    if (ifindex)
-	ifi->ifi_ifindex = ifindex;
-    else
-	ifi->ifi_flags |= IFIF_DOWN;
-
-    if (getmac(ifname, ifi->ifi_hwaddr, sizeof(ifi->ifi_hwaddr)))
-	logit(LOG_WARNING, errno, "failed finding hw address for iface %s", ifname);
+    ifi->ifi_flags |= IFIF_DOWN;
 
     TAILQ_INSERT_TAIL(&ifaces, ifi, ifi_link);
 
     return ifi;
 }
 
+/*
+ * Called by netlink backend when a link is found, connects the kernel
+ * interface to the .conf entry by name.
+ */
+struct ifi *config_iface_link(int ifindex, const char *ifname, const uint8_t *mac)
+{
+    struct ifi *ifi;
+
+    TAILQ_FOREACH(ifi, &ifaces, ifi_link) {
+	if (!strcmp(ifi->ifi_name, ifname))
+	    break;
+    }
+    if (!ifi)
+	return NULL;
+
+    config_iface_index(ifi, ifindex);
+    if (mac)
+	memcpy(ifi->ifi_hwaddr, mac, sizeof(ifi->ifi_hwaddr));
+
+    return ifi;
+}
+
 static struct ifi *addr_add(int ifindex, struct sockaddr *sa, unsigned int flags)
 {
     struct sockaddr_in *sin = (struct sockaddr_in *)sa;
@@ -176,6 +201,7 @@ static struct ifi *addr_add(int ifindex, struct sockaddr *sa, unsigned int flags
 
     pa->pa_addr  = sin->sin_addr.s_addr;
     TAILQ_INSERT_TAIL(&ifi->ifi_addrs, pa, pa_link);
+    state_gen++;
 
     if (!(flags & IFF_UP))
 	ifi->ifi_flags |= IFIF_DOWN;
@@ -210,6 +236,7 @@ static struct ifi *addr_del(int ifindex, struct sockaddr *sa)
 	logit(LOG_DEBUG, 0, "Drop address %s for %s", inet_fmt(pa->pa_addr, s1, sizeof(s1)),
 	      ifi->ifi_name);
 	free(pa);
+	state_gen++;
 	return ifi;
     }
 
@@ -235,6 +262,15 @@ void config_iface_addr_add(int ifindex, struct sockaddr *sa, unsigned int flags)
     }
 }
 
+/*
+ * Record address without starting querier election, used for initial
+ * netlink dump before interfaces are started.
+ */
+void config_iface_addr_set(int ifindex, struct sockaddr *sa, unsigned int flags)
+{
+    addr_add(ifindex, sa, flags);
+}
+
 void config_iface_addr_del(int ifindex, struct sockaddr *sa)
 {
     struct ifi *ifi;
@@ -255,26 +291,89 @@ void config_iface_addr_del(int ifindex, struct sockaddr *sa)
 }
 
 /*
- * Query the kernel to find network interfaces that are multicast-capable
+ * Query the kernel for all interfaces and their addresses, one netlink
+ * dump each, instead of getifaddrs() and ioctl()s per interface.
  */
 void config_iface_from_kernel(void)
 {
-    struct ifaddrs *ifa, *ifap;
+    if (netlink_dump(RTM_GETLINK, AF_UNSPEC, 1))
+	logit(LOG_WARNING, 0, "Failed querying kernel for interfaces");
+    if (netlink_dump(RTM_GETADDR, AF_UNSPEC, 1))
+	logit(LOG_WARNING, 0, "Failed querying kernel for interface addresses");
+    if (netlink_dump(RTM_GETLINK, AF_BRIDGE, 1))
+	logit(LOG_WARNING, 0, "Failed querying kernel for bridge ports");
+    if (netlink_dump(RTM_GETNEIGH, AF_INET, 1) || netlink_dump(RTM_GETNEIGH, AF_BRIDGE, 1))
+	logit(LOG_WARNING, 0, "Failed querying kernel for neighbors and bridge FDB");
+    if (netlink_dump(RTM_GETMDB, AF_BRIDGE, 1))
+	logit(LOG_WARNING, 0, "Failed querying kernel for bridge MDB");
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+    /* Per-VLAN router ports, not supported by older kernels */
+    netlink_dump(RTM_GETVLAN, AF_BRIDGE, 1);
+#endif
+}
 
-    if (getifaddrs(&ifap) < 0)
-	logit(LOG_ERR, errno, "getifaddrs");
+/*
+ * Netlink resync, mark all interfaces and addresses as unseen, then
+ * mark what is still in the kernel, and finally sweep the rest.
+ */
+void config_iface_mark(void)
+{
+    struct phaddr *pa;
+    struct ifi *ifi;
+
+    TAILQ_FOREACH(ifi, &ifaces, ifi_link) {
+	ifi->ifi_flags &= ~IFIF_SEEN;
+	TAILQ_FOREACH(pa, &ifi->ifi_addrs, pa_link)
+	    pa->pa_seen = 0;
+    }
+}
 
-    for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
-	int ifindex;
+void config_iface_seen(int ifindex, in_addr_t addr)
+{
+    struct phaddr *pa;
+    struct ifi *ifi;
 
-	ifindex = if_nametoindex(ifa->ifa_name);
-	if (!ifindex)
-	    continue;
+    ifi = config_find_iface(ifindex);
+    if (!ifi)
+	return;
 
-	addr_add(ifindex, ifa->ifa_addr, ifa->ifa_flags);
+    if (!addr) {
+	ifi->ifi_flags |= IFIF_SEEN;
+	return;
     }
 
-    freeifaddrs(ifap);
+    TAILQ_FOREACH(pa, &ifi->ifi_addrs, pa_link) {
+	if (pa->pa_addr == addr)
+	    pa->pa_seen = 1;
+    }
+}
+
+void config_iface_sweep(void)
+{
+    struct phaddr *pa, *tmp;
+    struct ifi *ifi;
+
+    TAILQ_FOREACH(ifi, &ifaces, ifi_link) {
+	if (!ifi->ifi_ifindex)
+	    continue;
+
+	if (!(ifi->ifi_flags & IFIF_SEEN)) {
+	    logit(LOG_INFO, 0, "Missed removal of %s, dropping", ifi->ifi_name);
+	    iface_del(ifi->ifi_ifindex, 0);
+	    continue;
+	}
+
+	TAILQ_FOREACH_SAFE(pa, &ifi->ifi_addrs, pa_link, tmp) {
+	    struct sockaddr_in sin = { 0 };
+
+	    if (pa->pa_seen)
+		continue;
+
+	    sin.sin_family = AF_INET;
+	    sin.sin_addr.s_addr = pa->pa_addr;
+	    config_iface_addr_del(ifi->ifi_ifindex, (struct sockaddr *)&sin);
+	}
+    }
 }
 
 /**
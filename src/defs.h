@@ -46,10 +46,14 @@ typedef void (*cfunc_t) (void*);
 typedef void (*ihfunc_t) (int);
 
 #include "iface.h"
+#include "json.h"
 #include "igmpv2.h"
 #include "igmpv3.h"
 #include "pathnames.h"
+#include "mdb.h"
 #include "pev.h"
+#include "trace.h"
+#include "shm.h"
 
 #define NELEMS(a)	(sizeof((a)) / sizeof((a)[0]))
 
@@ -72,6 +76,11 @@ extern uint32_t		igmp_query_interval;
 extern uint32_t		igmp_last_member_interval;
 extern uint32_t		igmp_robustness;
 
+#define NETLINK_RCVBUF_DEFAULT	1024	/* KiB, netlink socket receive buffer */
+#define LINK_HOLDDOWN_DEFAULT	500	/* msec, coalesce link up/down events */
+extern uint32_t		link_holddown;
+extern uint32_t		state_gen;
+
 extern int		loglevel;
 extern int		use_syslog;
 extern int		running;
@@ -139,9 +148,11 @@ extern int		cache_lifetime;
 extern int		prune_lifetime;
 extern int		mrt_table_id;
 extern void             restart(void);
+extern void             quit(int);
 
 /* log.c */
 extern void             log_init(char *);
+extern void             log_exit(void);
 extern int		log_str2lvl(char *);
 extern const char *	log_lvl2str(int);
 extern int		log_list(char *, size_t);
@@ -154,39 +165,52 @@ extern void		igmp_exit(void);
 extern void		accept_igmp(int, size_t);
 extern size_t		build_igmp(uint8_t *, uint32_t, uint32_t, int, int, uint32_t, int);
 extern void		send_igmp(int, uint32_t, uint32_t, int, int, uint32_t, int);
-extern void		send_igmp_proxy(const struct ifi *);
+extern void		send_igmp_proxy(struct ifi *);
 extern char *		igmp_packet_kind(uint32_t, uint32_t);
 extern int		igmp_debug_kind(uint32_t, uint32_t);
 
 /* iface.c */
 extern void		iface_init(void);
 extern void		iface_zero(struct ifi *);
-extern void             iface_add(int, int);
+extern void             iface_add(int, const char *, int, const uint8_t *);
 extern void             iface_del(int, int);
 extern void             iface_check_election(struct ifi *);
 extern void             iface_check(int, unsigned int);
-extern void		iface_check_state(void);
+extern void             iface_link(int, unsigned int);
+extern void		iface_check_state(int);
 extern void		iface_exit(void);
 extern void		accept_group_report(int, uint32_t, uint32_t, uint32_t, int);
 extern void		accept_leave_message(int, uint32_t, uint32_t, uint32_t);
 extern void		accept_membership_query(int, uint32_t, uint32_t, uint32_t, int, int);
 extern void             accept_membership_report(int, uint32_t, uint32_t, struct igmpv3_report *, ssize_t);
+extern struct listaddr *group_find(struct ifi *, uint32_t);
+extern int              querier_timeout(struct ifi *);
+extern int              group_expires(struct listaddr *);
 
 /* netlink.c */
 extern void             netlink_init(void);
+extern int              netlink_dump(int, int, int);
+extern void             netlink_set_rcvbuf(int);
+extern void             netlink_resync_later(void);
 extern void             netlink_exit(void);
 
 /* config.c */
 extern void		config_set_ifflag(uint32_t);
 extern struct ifi      *config_iface_iter(int);
 extern struct ifi      *config_iface_add(char *);
+extern struct ifi      *config_iface_link(int, const char *, const uint8_t *);
+extern void             config_iface_addr_set(int, struct sockaddr *, unsigned int);
 extern void             config_iface_addr_del(int, struct sockaddr *);
 extern struct ifi      *config_find_ifname(char *);
 extern struct ifi      *config_find_ifaddr(in_addr_t);
 extern struct ifi      *config_find_iface(int);
+extern void             config_iface_index(struct ifi *, int);
 extern struct ifi      *config_init_tunnel(in_addr_t, in_addr_t, uint32_t);
 extern void             config_iface_addr_add(int, struct sockaddr *, unsigned int);
 extern void		config_iface_from_kernel(void);
+extern void		config_iface_mark(void);
+extern void		config_iface_seen(int, in_addr_t);
+extern void		config_iface_sweep(void);
 
 /* cfparse.y */
 extern void		config_iface_from_file(void);
@@ -202,9 +226,69 @@ extern char            *inet_fmts(uint32_t, uint32_t, char *, size_t);
 extern uint32_t		inet_parse(char *, int);
 extern int		inet_cksum(uint16_t *, uint32_t);
 
+/* mdb.c */
+extern int              mdb_add(int, uint16_t, uint32_t, int, int);
+extern void             mdb_del(int, uint16_t, uint32_t, int);
+extern void             mdb_flush(void);
+extern int              mdb_router_add(int, uint16_t, int, int, int);
+extern void             mdb_router_del(int, uint16_t, int);
+extern void             mdb_router_flush(int, uint16_t);
+extern int64_t          mdb_router_due(void);
+extern struct mdb_rtr  *mdb_router_iter(int);
+extern int              mdb_foreach(int (*)(struct mdb_entry *, void *), void *);
+extern void             mdb_ports(FILE *, struct mdb_entry *);
+extern size_t           mdb_count(void);
+extern void             mdb_link(int, const char *);
+extern void             mdb_brport(int, int, const uint8_t *);
+extern int              mdb_brport_foreach(int, int (*)(struct mdb_iface *, void *), void *);
+extern int              mdb_ifindex(const char *);
+extern struct mdb_iface *mdb_iface_find(int);
+extern const char      *mdb_ifname(int);
+extern void             mdb_exit(void);
+
+/* neigh.c */
+extern void             neigh_update(uint32_t, int, const uint8_t *);
+extern void             neigh_fdb_update(const uint8_t *, uint16_t, int, int, int);
+extern int              neigh_lookup(uint32_t, uint8_t *);
+extern int              neigh_fdb_lookup(const uint8_t *);
+extern void             neigh_flush(void);
+
+/* trace.c */
+extern void		trace(int, int, int, int, uint32_t, uint32_t, int);
+extern int		trace_dump(int);
+extern int		trace_write(FILE *);
+extern void		trace_json(struct json *);
+extern void		trace_save(void);
+
 /* ipc.c */
+#define IPC_BACKLOG_DEFAULT	16	/* Pending connections on IPC socket */
+#define IPC_CLIENTS_DEFAULT	16	/* Concurrent IPC clients */
+#define IPC_TIMEOUT_DEFAULT	10	/* sec, idle IPC clients are closed */
+extern int		ipc_backlog;
+extern int		ipc_max_clients;
+extern int		ipc_timeout;
 extern void             ipc_init(char *);
 extern void             ipc_exit(void);
+extern void             ipc_event(const char *, struct ifi *, uint32_t, uint32_t);
+extern int              ipc_print(FILE *, const char *);
+
+/* sim.c */
+extern int              sim_run(const char *);
+extern void             sim_print(const char *);
+
+/* replay.c */
+extern int              replay_run(char *);
+
+/* metrics.c */
+extern int		metrics_port;
+extern int		metrics_write(FILE *);
+extern void		metrics_init(void);
+extern void		metrics_exit(void);
+
+/* shm.c */
+extern int		shm_groups;
+extern void		shm_init(void);
+extern void		shm_exit(void);
 
 /* kern.c */
 extern int              curttl;
@@ -3,6 +3,7 @@
  * by the license in the accompanying file named "LICENSE".
  */
 
+#include <linux/rtnetlink.h>
 #include "defs.h"
 
 /*
@@ -17,6 +18,22 @@ typedef struct {
 
 extern struct ifaces ifaces;
 
+/*
+ * All group memberships, on all interfaces, hashed on interface and
+ * group.  Each group is also on its interface's ifi_groups list.
+ */
+#define GROUP_BUCKETS	4096		/* Must be a power of two */
+#define GROUP_MASK	(GROUP_BUCKETS - 1)
+
+static TAILQ_HEAD(, listaddr) groups[GROUP_BUCKETS];
+static int groups_init;
+
+/*
+ * Exported variables.
+ */
+uint32_t link_holddown;		/* msec, link event hold-down */
+uint32_t state_gen;		/* Bumped on changes visible in show commands */
+
 /*
  * Forward declarations.
  */
@@ -37,12 +54,67 @@ static int  send_query_timer   (int ifindex, struct listaddr *g, int delay, int
 static void group_version_cb   (int timeout, void *arg);
 static int  group_version_timer(int ifindex, struct listaddr *g);
 
+static unsigned int group_hash(int ifindex, uint32_t group)
+{
+    return ((ntohl(group) * 2654435761u) ^ (unsigned int)ifindex) & GROUP_MASK;
+}
+
+/*
+ * Find group membership on interface, O(1) also with many groups.
+ */
+struct listaddr *group_find(struct ifi *ifi, uint32_t group)
+{
+    struct listaddr *g;
+
+    if (!groups_init)
+	return NULL;
+
+    TAILQ_FOREACH(g, &groups[group_hash(ifi->ifi_ifindex, group)], al_hlink) {
+	if (g->al_addr == group && g->al_ifindex == ifi->ifi_ifindex)
+	    return g;
+    }
+
+    return NULL;
+}
+
+static void group_link(struct ifi *ifi, struct listaddr *g)
+{
+    if (!groups_init) {
+	for (size_t i = 0; i < NELEMS(groups); i++)
+	    TAILQ_INIT(&groups[i]);
+	groups_init = 1;
+    }
+
+    g->al_ifindex = ifi->ifi_ifindex;
+    TAILQ_INSERT_TAIL(&groups[group_hash(g->al_ifindex, g->al_addr)], g, al_hlink);
+    TAILQ_INSERT_TAIL(&ifi->ifi_groups, g, al_link);
+}
+
+/*
+ * Drop group membership, with its timers, from interface and hash.
+ */
+static void group_free(struct ifi *ifi, struct listaddr *g)
+{
+    if (g->al_timerid > 0)
+	pev_timer_del(g->al_timerid);
+    if (g->al_query > 0)
+	pev_timer_del(g->al_query);
+    if (g->al_pv_timerid > 0)
+	pev_timer_del(g->al_pv_timerid);
+
+    TAILQ_REMOVE(&groups[group_hash(g->al_ifindex, g->al_addr)], g, al_hlink);
+    TAILQ_REMOVE(&ifi->ifi_groups, g, al_link);
+    free(g);
+}
+
 void iface_init(void)
 {
     struct ifi *ifi;
 
+    link_holddown = LINK_HOLDDOWN_DEFAULT;
     config_iface_from_file();
     config_iface_from_kernel();
+    state_gen++;
 
     for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
 	if (ifi->ifi_flags & IFIF_DOWN) {
@@ -87,7 +159,7 @@ void iface_zero(struct ifi *ifi)
     TAILQ_INIT(&ifi->ifi_addrs);
     ifi->ifi_querier	= NULL;
     ifi->ifi_timerid	= 0;
-    ifi->ifi_igmpv1_warn = 0;
+    ifi->ifi_link_timerid = 0;
 }
 
 static int iface_is_proxy(const struct ifi *ifi)
@@ -139,6 +211,7 @@ void iface_check_election(struct ifi *ifi)
 	logit(LOG_INFO, 0, "Using %s address %s", ifi->ifi_name, inet_fmt(curr, s1, sizeof(s1)));
 	ifi->ifi_prev_addr = ifi->ifi_curr_addr;
 	ifi->ifi_curr_addr = curr;
+	state_gen++;
     }
 
     if (curr && ifi->ifi_querier) {
@@ -167,30 +240,33 @@ void iface_check_election(struct ifi *ifi)
      * the first query.
      */
     ifi->ifi_flags |= IFIF_QUERIER;
+    state_gen++;
     logit(LOG_DEBUG, 0, "Assuming %squerier duties on interface %s",
           iface_is_proxy(ifi) ? "proxy " : "", ifi->ifi_name);
+    trace(TRACE_ELECT, 1, 0, ifi->ifi_ifindex, 0, ifi->ifi_curr_addr, ifi->ifi_timerid);
+    ifi->ifi_stats.elect_won++;
+    ipc_event("querier", ifi, 0, ifi->ifi_curr_addr);
     send_query(ifi, allhosts_group, igmp_response_interval * IGMP_TIMER_SCALE, 0);
 }
 
 /*
  * Called by netlink backend
  */
-void iface_add(int ifindex, int flags)
+void iface_add(int ifindex, const char *ifname, int flags, const uint8_t *mac)
 {
-    char ifname[IFNAMSIZ];
     struct ifi *ifi;
 
-    if (!if_indextoname(ifindex, ifname))
-	return; /* should not happen, but lost (again?) */
+    /* Interface recreated while we missed the RTM_DELLINK, e.g. overrun */
+    ifi = config_find_ifname((char *)ifname);
+    if (ifi && ifi->ifi_ifindex && ifi->ifi_ifindex != ifindex)
+	iface_del(ifi->ifi_ifindex, 0);
 
     /* Check if this is something we're interested in */
-    ifi = config_find_ifname(ifname);
+    ifi = config_iface_link(ifindex, ifname, mac);
     if (!ifi)
 	return;
 
     logit(LOG_DEBUG, 0, "Marking %s as now available in system", ifi->ifi_name);
-    ifi->ifi_ifindex = ifindex;
-
     iface_check(ifindex, flags);
 }
 
@@ -210,15 +286,17 @@ void iface_del(int ifindex, int flags)
     logit(LOG_DEBUG, 0, "Marking %s as removed from system", ifi->ifi_name);
     stop_iface(ifi);
 
+    if (ifi->ifi_link_timerid > 0)
+	pev_timer_del(ifi->ifi_link_timerid);
+    ifi->ifi_link_timerid = 0;
+
     if (ifi->ifi_querier) {
 	free(ifi->ifi_querier);
 	ifi->ifi_querier = NULL;
     }
 
-    TAILQ_FOREACH_SAFE(al, &ifi->ifi_groups, al_link, tmp) {
-	TAILQ_REMOVE(&ifi->ifi_groups, al, al_link);
-	free(al);
-    }
+    TAILQ_FOREACH_SAFE(al, &ifi->ifi_groups, al_link, tmp)
+	group_free(ifi, al);
 
     TAILQ_FOREACH_SAFE(pa, &ifi->ifi_addrs, pa_link, pat) {
 	TAILQ_REMOVE(&ifi->ifi_addrs, pa, pa_link);
@@ -227,8 +305,9 @@ void iface_del(int ifindex, int flags)
 
     ifi->ifi_prev_addr = 0;
     ifi->ifi_curr_addr = 0;
-    ifi->ifi_ifindex = 0;
+    config_iface_index(ifi, 0);
     ifi->ifi_flags |= IFIF_DOWN;
+    state_gen++;
 }
 
 void iface_check(int ifindex, unsigned int flags)
@@ -255,40 +334,62 @@ void iface_check(int ifindex, unsigned int flags)
     }
 }
 
+static void link_holddown_cb(int timeout, void *arg)
+{
+    struct ifi *ifi = (struct ifi *)arg;
+
+    logit(LOG_DEBUG, 0, "Link hold-down expired on %s, flags 0x%x", ifi->ifi_name,
+	  ifi->ifi_link_flags);
+    iface_check(ifi->ifi_ifindex, ifi->ifi_link_flags);
+}
+
 /*
- * See if any interfaces have changed from up state to down, or vice versa,
- * including any non-multicast-capable interfaces that are in use as local
- * tunnel end-points.  Ignore interfaces that have been administratively
- * disabled.
+ * Called by netlink backend for link events on known interfaces.  Any
+ * up/down events during the hold-down window are coalesced, only the
+ * last state is applied when the window closes.  So a flapping port
+ * does not trigger a stop/start, with a flush of all groups and a new
+ * general query, for each flap.
  */
-void iface_check_state(void)
+void iface_link(int ifindex, unsigned int flags)
 {
-    static int checking_iface = 0;
-    struct ifreq ifr;
     struct ifi *ifi;
 
-    if (checking_iface)
+    ifi = config_find_iface(ifindex);
+    if (!ifi)
 	return;
 
-    checking_iface = 1;
-    for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
-	if (ifi->ifi_flags & IFIF_DISABLED)
-	    continue;
+    ifi->ifi_link_flags = flags;
+    if (!link_holddown) {
+	iface_check(ifindex, flags);
+	return;
+    }
 
-	memset(&ifr, 0, sizeof(ifr));
-	memcpy(ifr.ifr_name, ifi->ifi_name, sizeof(ifr.ifr_name));
-	if (ioctl(igmp_socket, SIOCGIFFLAGS, &ifr) < 0) {
-	    if (errno == ENODEV) {
-		ifi->ifi_flags  |= IFIF_DISABLED;
-		continue;
-	    }
-	    logit(LOG_WARNING, errno, "Failed ioctl SIOCGIFFLAGS for %s", ifr.ifr_name);
-	}
+    if (ifi->ifi_link_timerid > 0) {
+	if (pev_timer_get(ifi->ifi_link_timerid) > 0)
+	    return;	/* already pending, coalesce */
+	pev_timer_set(ifi->ifi_link_timerid, link_holddown * 1000);
+	return;
+    }
 
-	iface_check(ifi->ifi_ifindex, ifr.ifr_flags);
+    ifi->ifi_link_timerid = pev_timer_add(link_holddown * 1000, 0, link_holddown_cb, ifi);
+    if (ifi->ifi_link_timerid < 0) {
+	logit(LOG_WARNING, errno, "Failed starting link hold-down timer for %s", ifi->ifi_name);
+	ifi->ifi_link_timerid = 0;
+	iface_check(ifindex, flags);
     }
+}
 
-    checking_iface = 0;
+/*
+ * Sending on an interface failed with ENETDOWN, or ENODEV, before we got
+ * the netlink event.  Stop it right away, as if the link went down, and
+ * schedule a resync to learn the actual state.  A removed interface is
+ * then dropped by the sweep, and picked up again if it comes back.  No
+ * dump from here, we may be in the middle of parsing netlink events.
+ */
+void iface_check_state(int ifindex)
+{
+    iface_check(ifindex, 0);
+    netlink_resync_later();
 }
 
 static void send_query(struct ifi *ifi, uint32_t dst, int code, uint32_t group)
@@ -347,7 +448,10 @@ static void start_iface(struct ifi *ifi)
     if (!(ifi->ifi_flags & IFIF_DISABLED))
         iface_check_election(ifi);
 
+    state_gen++;
     logit(LOG_INFO, 0, "Interface %s now in service", ifi->ifi_name);
+    trace(TRACE_IFACE_UP, 0, 0, ifi->ifi_ifindex, 0, ifi->ifi_curr_addr, ifi->ifi_timerid);
+    ipc_event("up", ifi, 0, ifi->ifi_curr_addr);
 }
 
 static void stop_iface(struct ifi *ifi)
@@ -365,10 +469,8 @@ static void stop_iface(struct ifi *ifi)
      * Discard all group addresses.  (No need to tell kernel;
      * the k_del_iface() call, below, will clean up kernel state.)
      */
-    TAILQ_FOREACH_SAFE(a, &ifi->ifi_groups, al_link, tmp) {
-	TAILQ_REMOVE(&ifi->ifi_groups, a, al_link);
-	free(a);
-    }
+    TAILQ_FOREACH_SAFE(a, &ifi->ifi_groups, al_link, tmp)
+	group_free(ifi, a);
     /*
      * Depart from the ALL-ROUTERS multicast group on the interface.
      */
@@ -382,7 +484,10 @@ static void stop_iface(struct ifi *ifi)
     logit(LOG_DEBUG, 0, "Releasing querier duties on interface %s", ifi->ifi_name);
     ifi->ifi_flags &= ~IFIF_QUERIER;
 
+    state_gen++;
     logit(LOG_INFO, 0, "Interface %s out of service", ifi->ifi_name);
+    trace(TRACE_IFACE_DOWN, 0, 0, ifi->ifi_ifindex, 0, ifi->ifi_curr_addr, 0);
+    ipc_event("down", ifi, 0, ifi->ifi_curr_addr);
 }
 
 /*
@@ -419,22 +524,11 @@ void accept_membership_query(int ifindex, uint32_t src, uint32_t dst, uint32_t g
     if (!ifi)
 	return;
 
+    /* Warning is rate limited with exponential back-off by logit() */
     if ((ver == 3 && (ifi->ifi_flags & IFIF_IGMPV2)) ||
-	(ver == 2 && (ifi->ifi_flags & IFIF_IGMPV1))) {
-	int i;
-
-	/*
-	 * Exponentially back-off warning rate
-	 */
-	i = ++ifi->ifi_igmpv1_warn;
-	while (i && !(i & 1))
-	    i >>= 1;
-
-	if (i == 1) {
-	    logit(LOG_WARNING, 0, "Received IGMPv%d report from %s on %s, configured for IGMPv%d",
-		  ver, inet_fmt(src, s1, sizeof(s1)), ifi->ifi_name, ifi->ifi_flags & IFIF_IGMPV1 ? 1 : 2);
-	}
-    }
+	(ver == 2 && (ifi->ifi_flags & IFIF_IGMPV1)))
+	logit(LOG_WARNING, 0, "Received IGMPv%d report from %s on %s, configured for IGMPv%d",
+	      ver, inet_fmt(src, s1, sizeof(s1)), ifi->ifi_name, ifi->ifi_flags & IFIF_IGMPV1 ? 1 : 2);
 
     if (ifi->ifi_querier == NULL || ifi->ifi_querier->al_addr != src) {
 	uint32_t cur = ifi->ifi_querier ? ifi->ifi_querier->al_addr : ifi->ifi_curr_addr;
@@ -466,13 +560,18 @@ void accept_membership_query(int ifindex, uint32_t src, uint32_t dst, uint32_t g
 		    return;
 		}
 
-		ifi->ifi_querier->al_timerid = pev_timer_add(router_timeout * 1000000, 0, router_timeout_cb, ifi);
+		ifi->ifi_querier->al_timerid = pev_timer_add_ns(router_timeout * PEV_NSEC_PER_SEC, 0,
+								router_timeout_cb, ifi);
 		ifi->ifi_flags &= ~IFIF_QUERIER;
 	    }
 
-	    time(&ifi->ifi_querier->al_ctime);
+	    ifi->ifi_querier->al_ctime = pev_now();
 	    ifi->ifi_querier->al_addr = src;
 	    notnew = 0;
+	    state_gen++;
+	    trace(TRACE_ELECT, 0, 0, ifindex, 0, src, ifi->ifi_querier->al_timerid);
+	    ifi->ifi_stats.elect_lost++;
+	    ipc_event("querier", ifi, 0, src);
 	} else {
 	    if (!ifi->ifi_querier) {
 		/*
@@ -497,8 +596,9 @@ void accept_membership_query(int ifindex, uint32_t src, uint32_t dst, uint32_t g
      */
     if (notnew && ifi->ifi_querier && src == ifi->ifi_querier->al_addr) {
 	logit(LOG_DEBUG, 0, "Resetting query timeout %d sec", router_timeout);
-	pev_timer_set(ifi->ifi_querier->al_timerid, router_timeout * 1000000);
-	time(&ifi->ifi_querier->al_ctime);
+	pev_timer_set_ns(ifi->ifi_querier->al_timerid, router_timeout * PEV_NSEC_PER_SEC);
+	ifi->ifi_querier->al_ctime = pev_now();
+	state_gen++;
     }
 
     /*
@@ -514,22 +614,17 @@ void accept_membership_query(int ifindex, uint32_t src, uint32_t dst, uint32_t g
 	      inet_fmt(group, s2, sizeof(s2)),
 	      inet_fmt(src, s1, sizeof(s1)), ifi->ifi_name, tmo);
 
-	TAILQ_FOREACH(g, &ifi->ifi_groups, al_link) {
-	    if (group == g->al_addr && g->al_query == 0) {
-		if (g->al_timerid > 0)
-		    g->al_timerid = pev_timer_del(g->al_timerid);
-
-		if (g->al_query > 0)
-		    g->al_query = pev_timer_del(g->al_query);
+	g = group_find(ifi, group);
+	if (g && g->al_query == 0) {
+	    if (g->al_timerid > 0)
+		g->al_timerid = pev_timer_del(g->al_timerid);
 
-		/* setup a timeout to remove the group membership */
-		g->al_timerid = delete_group_timer(ifi->ifi_ifindex, g, IGMP_LAST_MEMBER_QUERY_COUNT
-						   * tmo / IGMP_TIMER_SCALE);
+	    /* setup a timeout to remove the group membership */
+	    g->al_timerid = delete_group_timer(ifi->ifi_ifindex, g, IGMP_LAST_MEMBER_QUERY_COUNT
+					       * tmo / IGMP_TIMER_SCALE);
 
-		logit(LOG_DEBUG, 0, "Timer for grp %s on %s set to %d",
-		      inet_fmt(group, s2, sizeof(s2)), ifi->ifi_name, pev_timer_get(g->al_timerid) / 1000);
-		break;
-	    }
+	    logit(LOG_DEBUG, 0, "Timer for grp %s on %s set to %d",
+		  inet_fmt(group, s2, sizeof(s2)), ifi->ifi_name, pev_timer_get(g->al_timerid) / 1000);
 	}
     }
 }
@@ -567,58 +662,57 @@ void accept_group_report(int ifindex, uint32_t src, uint32_t dst, uint32_t group
     /*
      * Look for the group in our group list; if found, reset its timer.
      */
-    TAILQ_FOREACH(g, &ifi->ifi_groups, al_link) {
+    g = group_find(ifi, group);
+    if (g) {
 	int old_report = 0;
 
-	if (group == g->al_addr) {
-	    if (g->al_flags & NBRF_STATIC_GROUP) {
-		logit(LOG_DEBUG, 0, "Ignoring IGMP JOIN for static group %s on %s.", s3, s1);
-		return;
-	    }
-
-	    switch (r_type) {
-	    case IGMP_V1_MEMBERSHIP_REPORT:
-		old_report = 1;
-		if (g->al_pv > 1) {
-		    g->al_pv = 1;
-		    group_debug(g, s3, 1);
-		}
-		break;
+	if (g->al_flags & NBRF_STATIC_GROUP) {
+	    logit(LOG_DEBUG, 0, "Ignoring IGMP JOIN for static group %s on %s.", s3, s1);
+	    return;
+	}
 
-	    case IGMP_V2_MEMBERSHIP_REPORT:
-		old_report = 1;
-		if (g->al_pv > 2) {
-		    g->al_pv = 2;
-		    group_debug(g, s3, 1);
-		}
-		break;
+	switch (r_type) {
+	case IGMP_V1_MEMBERSHIP_REPORT:
+	    old_report = 1;
+	    if (g->al_pv > 1) {
+		g->al_pv = 1;
+		group_debug(g, s3, 1);
+	    }
+	    break;
 
-	    default:
-		break;
+	case IGMP_V2_MEMBERSHIP_REPORT:
+	    old_report = 1;
+	    if (g->al_pv > 2) {
+		g->al_pv = 2;
+		group_debug(g, s3, 1);
 	    }
+	    break;
 
-	    g->al_reporter = src;
+	default:
+	    break;
+	}
 
-	    /** delete old timers, set a timer for expiration **/
-	    if (g->al_query > 0)
-		g->al_query = pev_timer_del(g->al_query);
+	g->al_reporter = src;
 
-	    if (g->al_timerid > 0)
-		g->al_timerid = pev_timer_del(g->al_timerid);
+	/** delete old timers, set a timer for expiration **/
+	if (g->al_query > 0)
+	    g->al_query = pev_timer_del(g->al_query);
 
-	    g->al_timerid = delete_group_timer(ifi->ifi_ifindex, g, IGMP_GROUP_MEMBERSHIP_INTERVAL);
+	if (g->al_timerid > 0)
+	    g->al_timerid = pev_timer_del(g->al_timerid);
 
-	    /*
-	     * Reset timer for switching version back every time an older
-	     * version report is received
-	     */
-	    if (g->al_pv < 3 && old_report) {
-		if (g->al_pv_timerid)
-		    g->al_pv_timerid = pev_timer_del(g->al_pv_timerid);
+	g->al_timerid = delete_group_timer(ifi->ifi_ifindex, g, IGMP_GROUP_MEMBERSHIP_INTERVAL);
+	ipc_event("refresh", ifi, group, src);
 
-		g->al_pv_timerid = group_version_timer(ifi->ifi_ifindex, g);
-	    }
-	    break;
+	/*
+	 * Reset timer for switching version back every time an older
+	 * version report is received
+	 */
+	if (g->al_pv < 3 && old_report) {
+	    if (g->al_pv_timerid)
+		g->al_pv_timerid = pev_timer_del(g->al_pv_timerid);
+
+	    g->al_pv_timerid = group_version_timer(ifi->ifi_ifindex, g);
 	}
     }
 
@@ -662,8 +756,12 @@ void accept_group_report(int ifindex, uint32_t src, uint32_t dst, uint32_t group
 	if (g->al_pv < 3)
 	    g->al_pv_timerid = group_version_timer(ifi->ifi_ifindex, g);
 
-	TAILQ_INSERT_TAIL(&ifi->ifi_groups, g, al_link);
-	time(&g->al_ctime);
+	group_link(ifi, g);
+	g->al_ctime = pev_now();
+	state_gen++;
+	trace(TRACE_GROUP_ADD, g->al_pv, 0, ifindex, group, src, g->al_timerid);
+	ifi->ifi_stats.group_add++;
+	ipc_event("join", ifi, group, src);
     }
 }
 
@@ -694,10 +792,8 @@ void accept_leave_message(int ifindex, uint32_t src, uint32_t dst, uint32_t grou
      * Look for the group in our group list in order to set up a short-timeout
      * query.
      */
-    TAILQ_FOREACH(g, &ifi->ifi_groups, al_link) {
-	if (group != g->al_addr)
-	    continue;
-
+    g = group_find(ifi, group);
+    if (g) {
 	if (g->al_flags & NBRF_STATIC_GROUP) {
 	    logit(LOG_DEBUG, 0, "Ignoring IGMP LEAVE for static group %s on %s.", s3, s1);
 	    return;
@@ -732,6 +828,9 @@ void accept_leave_message(int ifindex, uint32_t src, uint32_t dst, uint32_t grou
 					   * (IGMP_LAST_MEMBER_QUERY_COUNT + 1));
 
 	logit(LOG_DEBUG, 0, "Accepted group leave for %s on %s", s3, s1);
+	trace(TRACE_GROUP_LEAVE, g->al_pv, 0, ifindex, group, src, g->al_query);
+	ifi->ifi_stats.group_leave++;
+	ipc_event("leave", ifi, group, src);
 	return;
     }
 
@@ -899,11 +998,16 @@ static void router_timeout_cb(int timeout, void *arg)
     struct ifi *ifi = (struct ifi *)arg;
 
     logit(LOG_DEBUG, 0, "Querier %s timed out", inet_fmt(ifi->ifi_querier->al_addr, s1, sizeof(s1)));
+    trace(TRACE_QUERIER_TIMEOUT, 0, 0, ifi->ifi_ifindex, 0, ifi->ifi_querier->al_addr, ifi->ifi_querier->al_timerid);
+    ifi->ifi_stats.querier_timeout++;
+    ipc_event("querier-timeout", ifi, 0, ifi->ifi_querier->al_addr);
     pev_timer_del(ifi->ifi_querier->al_timerid);
     free(ifi->ifi_querier);
     ifi->ifi_querier = NULL;
 
     ifi->ifi_flags |= IFIF_QUERIER;
+    state_gen++;
+    ipc_event("querier", ifi, 0, ifi->ifi_curr_addr);
     send_query(ifi, allhosts_group, igmp_response_interval * IGMP_TIMER_SCALE, 0);
 }
 
@@ -921,12 +1025,13 @@ static void group_version_cb(int timeout, void *arg)
 
     if (cbk->g->al_pv < 3)
 	cbk->g->al_pv++;
+    state_gen++;
 
     logit(LOG_INFO, 0, "Switching IGMP compatibility mode from v%d to v%d for group %s on %s",
 	  cbk->g->al_pv - 1, cbk->g->al_pv, inet_fmt(cbk->g->al_addr, s1, sizeof(s1)), ifi->ifi_name);
 
     if (cbk->g->al_pv < 3)
-	pev_timer_set(cbk->g->al_pv_timerid, IGMP_GROUP_MEMBERSHIP_INTERVAL * 1000000);
+	pev_timer_set_ns(cbk->g->al_pv_timerid, IGMP_GROUP_MEMBERSHIP_INTERVAL * PEV_NSEC_PER_SEC);
     else {
 	pev_timer_del(cbk->g->al_pv_timerid);
 	free(cbk);
@@ -949,7 +1054,7 @@ static int group_version_timer(int ifindex, struct listaddr *g)
     cbk->ifindex = ifindex;
     cbk->g       = g;
 
-    return pev_timer_add(IGMP_GROUP_MEMBERSHIP_INTERVAL * 1000000, 0, group_version_cb, cbk);
+    return pev_timer_add_ns(IGMP_GROUP_MEMBERSHIP_INTERVAL * PEV_NSEC_PER_SEC, 0, group_version_cb, cbk);
 }
 
 /*
@@ -967,17 +1072,12 @@ static void delete_group_cb(int timeout, void *arg)
 
     logit(LOG_DEBUG, 0, "Group membership timeout for %s on %s",
 	  inet_fmt(cbk->g->al_addr, s1, sizeof(s1)), ifi->ifi_name);
+    trace(TRACE_GROUP_EXPIRE, g->al_pv, 0, ifi->ifi_ifindex, g->al_addr, g->al_reporter, g->al_timerid);
+    ifi->ifi_stats.group_expire++;
+    ipc_event("expire", ifi, g->al_addr, g->al_reporter);
 
-    pev_timer_del(g->al_timerid);
-
-    if (g->al_query > 0)
-	g->al_query = pev_timer_del(g->al_query);
-
-    if (g->al_pv_timerid > 0)
-	g->al_pv_timerid = pev_timer_del(g->al_pv_timerid);
-
-    TAILQ_REMOVE(&ifi->ifi_groups, g, al_link);
-    free(g);
+    group_free(ifi, g);
+    state_gen++;
 }
 
 /*
@@ -998,10 +1098,10 @@ static int delete_group_timer(int ifindex, struct listaddr *g, int tmo)
     cbk->ifindex = ifindex;
     cbk->g       = g;
 
-    /* Record mtime for IPC "show igmp" */
-//    g->al_mtime = virtual_time;
+    /* Record expiry for IPC "show groups" */
+    g->al_mtime = pev_now() + tmo * PEV_NSEC_PER_SEC;
 
-    tid = pev_timer_add(tmo * 1000000, 0, delete_group_cb, cbk);
+    tid = pev_timer_add_ns(tmo * PEV_NSEC_PER_SEC, 0, delete_group_cb, cbk);
     pev_timer_set_cb_del(tid, free);
 
     return tid;
@@ -1021,7 +1121,7 @@ static void send_query_cb(int timeout, void *arg)
 
     send_query(ifi, cbk->g->al_addr, cbk->delay * IGMP_TIMER_SCALE, cbk->g->al_addr);
     if (--cbk->num > 0) {
-	pev_timer_set(cbk->g->al_query, cbk->delay * 1000000);
+	pev_timer_set_ns(cbk->g->al_query, cbk->delay * PEV_NSEC_PER_SEC);
 	return;
     }
 
@@ -1049,7 +1149,35 @@ static int send_query_timer(int ifindex, struct listaddr *g, int delay, int num)
     cbk->delay   = delay;
     cbk->num     = num;
 
-    return pev_timer_add(delay * 1000000, 0, send_query_cb, cbk);
+    return pev_timer_add_ns(delay * PEV_NSEC_PER_SEC, 0, send_query_cb, cbk);
+}
+
+/*
+ * Seconds left before the other querier is considered gone, and before
+ * a group membership expires, for IPC and the shared memory export.
+ */
+int querier_timeout(struct ifi *ifi)
+{
+    uint64_t age;
+
+    if (!ifi->ifi_querier)
+	return 0;
+
+    age = (pev_now() - ifi->ifi_querier->al_ctime) / PEV_NSEC_PER_SEC;
+    if (age >= router_timeout)
+	return 0;
+
+    return router_timeout - (int)age;
+}
+
+int group_expires(struct listaddr *g)
+{
+    uint64_t now = pev_now();
+
+    if (g->al_mtime <= now)
+	return 0;
+
+    return (int)((g->al_mtime - now) / PEV_NSEC_PER_SEC);
 }
 
 /**
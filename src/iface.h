@@ -9,8 +9,32 @@
 #include <stdint.h>
 #include "queue.h"
 
+/*
+ * Protocol counters, plain increments from the packet and protocol
+ * code, kept together so a packet touches one or two cache lines.
+ * Cleared by "show counters reset".
+ */
+struct ifi_stats {
+    uint64_t	     rx_query[3];	 /* IGMPv1..v3 queries received      */
+    uint64_t	     rx_report[3];	 /* IGMPv1..v3 reports received      */
+    uint64_t	     rx_leave;		 /* IGMPv2 leaves received           */
+    uint64_t	     rx_errors;		 /* Malformed or truncated packets   */
+    uint64_t	     tx_query;		 /* General queries sent             */
+    uint64_t	     tx_group_query;	 /* Group-specific queries sent      */
+    uint64_t	     tx_proxy_query;	 /* Proxy queries sent               */
+    uint64_t	     tx_errors;		 /* Send failures                    */
+    uint64_t	     tx_dropped;	 /* Send queue full                  */
+    uint64_t	     elect_won;		 /* Took over as querier             */
+    uint64_t	     elect_lost;	 /* Other querier took over          */
+    uint64_t	     querier_timeout;	 /* Other querier timed out          */
+    uint64_t	     group_add;
+    uint64_t	     group_leave;
+    uint64_t	     group_expire;
+};
+
 struct ifi {
     TAILQ_ENTRY(ifi) ifi_link;		 /* link to next/prev interface       */
+    TAILQ_ENTRY(ifi) ifi_hlink;		 /* ifindex hash, config_find_iface() */
     TAILQ_HEAD(,listaddr) ifi_static;    /* list of static groups (phyints)   */
     TAILQ_HEAD(,listaddr) ifi_groups;    /* list of local groups  (phyints)   */
     TAILQ_HEAD(,phaddr) ifi_addrs;	 /* Secondary addresses               */
@@ -21,8 +45,10 @@ struct ifi {
     uint32_t	     ifi_prev_addr;      /* Previous address of this interace */
     struct listaddr *ifi_querier;        /* IGMP querier (one or none)        */
     int		     ifi_timerid;	 /* IGMP query timer           	      */
-    int		     ifi_igmpv1_warn;    /* To rate-limit IGMPv1 warnings     */
     uint8_t	     ifi_hwaddr[6];	 /* MAC address of this interface     */
+    int		     ifi_link_timerid;	 /* Link event hold-down timer        */
+    unsigned int     ifi_link_flags;	 /* Latest link flags from kernel     */
+    struct ifi_stats ifi_stats;		 /* Protocol counters                 */
 };
 
 #define IFIF_DOWN		0x000100 /* kernel state of interface */
@@ -31,17 +57,21 @@ struct ifi {
 #define IFIF_IGMPV1		0x000800 /* Act as an IGMPv1 Router   */
 #define IFIF_IGMPV2		0x001000 /* Act as an IGMPv2 Router   */
 #define IFIF_PROXY_QUERIES	0x002000 /* Enable proxy queries      */
+#define IFIF_SEEN		0x004000 /* Seen in netlink resync    */
 
 struct phaddr {
     TAILQ_ENTRY(phaddr) pa_link;
     uint32_t	        pa_addr;
+    int			pa_seen;	/* Seen in netlink resync */
 };
 
 struct listaddr {
     TAILQ_ENTRY(listaddr) al_link;	/* link to next/prev addr           */
+    TAILQ_ENTRY(listaddr) al_hlink;	/* group hash, see group_find()     */
+    int		     al_ifindex;	/* interface of group, hash key     */
     uint32_t	     al_addr;		/* local group or neighbor address  */
-    uint32_t	     al_mtime;		/* mtime from virtual_time, for IPC */
-    time_t	     al_ctime;		/* entry creation time		    */
+    uint64_t	     al_mtime;		/* expiry of group, pev_now() nsec  */
+    uint64_t	     al_ctime;		/* creation or refresh, pev_now()   */
     uint32_t	     al_reporter;	/* a host which reported membership */
     int		     al_timerid;	/* timer for group membership	    */
     int		     al_query;		/* timer for repeated leave query   */
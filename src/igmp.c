@@ -18,6 +18,8 @@
 #define PIM_GRAFT           6
 #define PIM_GRAFT_ACK       7
 
+#define TXQ_MAX             128	/* Max packets held while socket is full */
+
 /*
  * Exported variables.
  */
@@ -39,6 +41,23 @@ uint32_t	allreports_group;	     /* IGMPv3 member reports       */
  * Private variables.
  */
 static int	igmp_sockid;
+static size_t	txq_len;
+static uint32_t	txq_dropped;
+
+/*
+ * Packets waiting for the IGMP socket to become writable.
+ */
+struct txpkt {
+    TAILQ_ENTRY(txpkt) link;
+    int		ifindex;
+    int		type;
+    uint32_t	src;
+    uint32_t	dst;
+    uint32_t	group;
+    size_t	len;
+    uint8_t	buf[];
+};
+static TAILQ_HEAD(, txpkt) txq = TAILQ_HEAD_INITIALIZER(txq);
 static uint8_t	proxy_send_buf[IGMP_PROXY_QUERY_MAXLEN];
 static size_t	proxy_send_len;
 
@@ -46,6 +65,8 @@ static size_t	proxy_send_len;
  * Local function definitions.
  */
 static void	igmp_read(int sd, void *arg);
+static void	igmp_write(int sd, void *arg);
+static struct ifi_stats *igmp_stats(int ifindex);
 static void	ipv4_set_static_fields(uint8_t *buf);
 static size_t	build_ipv4(uint8_t *buf, uint32_t src, uint32_t dst, short unsigned int datalen);
 
@@ -97,14 +118,28 @@ void igmp_init(void)
     proxy_send_len += build_ipv4(proxy_send_buf + proxy_send_len, 0, allhosts_group, sizeof(struct igmp));
     proxy_send_len += build_igmp(proxy_send_buf + proxy_send_len, 0, allhosts_group, IGMP_MEMBERSHIP_QUERY, 0, 0, 0);
 
-    igmp_sockid = pev_sock_add(igmp_socket, igmp_read, NULL);
+    /* On a virtual clock all input is injected, live traffic is not */
+    if (pev_is_virtual())
+	return;
+
+    igmp_sockid = pev_sock_add_events(igmp_socket, PEV_READ, igmp_read, igmp_write, NULL);
     if (igmp_sockid == -1)
 	logit(LOG_ERR, errno, "Failed registering IGMP handler");
 }
 
 void igmp_exit(void)
 {
-    pev_sock_del(igmp_sockid);
+    struct txpkt *pkt, *tmp;
+
+    TAILQ_FOREACH_SAFE(pkt, &txq, link, tmp) {
+	TAILQ_REMOVE(&txq, pkt, link);
+	free(pkt);
+    }
+    txq_len = 0;
+
+    if (igmp_sockid > 0)
+	pev_sock_del(igmp_sockid);
+    igmp_sockid = 0;
     close(igmp_raw_pkt_socket);
     close(igmp_socket);
     free(recv_buf);
@@ -151,6 +186,8 @@ static void igmp_read(int sd, void *arg)
     while ((len = recvmsg(sd, &msgh, 0)) < 0) {
 	if (errno == EINTR)
 	    continue;		/* Received signal, retry syscall. */
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    return;		/* Spurious wakeup, nothing to read. */
 
 	logit(LOG_ERR, errno, "Failed recvfrom() in igmp_read()");
 	return;
@@ -172,12 +209,41 @@ static void igmp_read(int sd, void *arg)
     accept_igmp(ifindex, len);
 }
 
+/*
+ * Counters for packets on interfaces we do not manage are discarded,
+ * saves a NULL check at every increment.
+ */
+static struct ifi_stats *igmp_stats(int ifindex)
+{
+    static struct ifi_stats dummy;
+    struct ifi *ifi;
+
+    ifi = config_find_iface(ifindex);
+    if (!ifi)
+	return &dummy;
+
+    return &ifi->ifi_stats;
+}
+
+static void igmp_tx_count(int ifindex, int type, uint32_t group, int err)
+{
+    struct ifi_stats *st = igmp_stats(ifindex);
+
+    if (err)
+	st->tx_errors++;
+    else if (type == IGMP_MEMBERSHIP_QUERY && group)
+	st->tx_group_query++;
+    else if (type == IGMP_MEMBERSHIP_QUERY)
+	st->tx_query++;
+}
+
 /*
  * Process a newly received IGMP packet that is sitting in the input
  * packet buffer.
  */
 void accept_igmp(int ifindex, size_t recvlen)
 {
+    struct ifi_stats *st = igmp_stats(ifindex);
     struct igmp *igmp;
     struct ip *ip;
     uint32_t src, dst, group;
@@ -186,6 +252,7 @@ void accept_igmp(int ifindex, size_t recvlen)
 
     if (recvlen < sizeof(struct ip)) {
 	logit(LOG_INFO, 0, "received packet too short (%zu bytes) for IP header", recvlen);
+	st->rx_errors++;
 	return;
     }
 
@@ -211,6 +278,7 @@ void accept_igmp(int ifindex, size_t recvlen)
 	logit(LOG_INFO, 0,
 	      "received packet from %s shorter (%zu bytes) than hdr+data length (%d+%d)",
 	      inet_fmt(src, s1, sizeof(s1)), recvlen, iphdrlen, ipdatalen);
+	st->rx_errors++;
 	return;
     }
 
@@ -220,12 +288,15 @@ void accept_igmp(int ifindex, size_t recvlen)
     if (igmpdatalen < 0) {
 	logit(LOG_INFO, 0,  "received IP data field too short (%u bytes) for IGMP, from %s",
 	      ipdatalen, inet_fmt(src, s1, sizeof(s1)));
+	st->rx_errors++;
 	return;
     }
 
     logit(LOG_DEBUG, 0, "RECV %s from %-15s ifi %-2d to %s",
 	  igmp_packet_kind(igmp->igmp_type, igmp->igmp_code),
 	  inet_fmt(src, s1, sizeof(s1)), ifindex, inet_fmt(dst, s2, sizeof(s2)));
+    trace(TRACE_RX, igmp->igmp_type, 0, ifindex,
+	  igmp->igmp_type == IGMP_V3_MEMBERSHIP_REPORT ? 0 : group, src, 0);
 
     switch (igmp->igmp_type) {
 	case IGMP_MEMBERSHIP_QUERY:
@@ -241,15 +312,18 @@ void accept_igmp(int ifindex, size_t recvlen)
 		logit(LOG_INFO, 0, "Received invalid IGMP query: Max Resp Code = %d, length = %d",
 		      igmp->igmp_code, ipdatalen);
 	    }
+	    st->rx_query[igmp_version - 1]++;
 	    accept_membership_query(ifindex, src, dst, group, igmp->igmp_code, igmp_version);
 	    return;
 
 	case IGMP_V1_MEMBERSHIP_REPORT:
 	case IGMP_V2_MEMBERSHIP_REPORT:
+	    st->rx_report[igmp->igmp_type == IGMP_V1_MEMBERSHIP_REPORT ? 0 : 1]++;
 	    accept_group_report(ifindex, src, dst, group, igmp->igmp_type);
 	    return;
 
 	case IGMP_V2_LEAVE_GROUP:
+	    st->rx_leave++;
 	    accept_leave_message(ifindex, src, dst, group);
 	    return;
 
@@ -257,8 +331,10 @@ void accept_igmp(int ifindex, size_t recvlen)
 	    if (igmpdatalen < IGMP_V3_GROUP_RECORD_MIN_SIZE) {
 		logit(LOG_INFO, 0, "Too short IGMP v3 Membership report: igmpdatalen(%d) < MIN(%d)",
 		      igmpdatalen, IGMP_V3_GROUP_RECORD_MIN_SIZE);
+		st->rx_errors++;
 		return;
 	    }
+	    st->rx_report[2]++;
 	    accept_membership_report(ifindex, src, dst, (struct igmpv3_report *)(recv_buf + iphdrlen), recvlen - iphdrlen);
 	    return;
 
@@ -450,17 +526,123 @@ size_t build_igmp(uint8_t *buf, uint32_t src, uint32_t dst, int type, int code,
     return igmp_len;
 }
 
+/*
+ * On a virtual clock, simulation or replay, nothing is sent on the wire.
+ * The packet is still traced and counted by the caller, as if sent.
+ */
+static int igmp_sendto(int ifindex, uint32_t dst, const uint8_t *buf, size_t len)
+{
+    struct sockaddr_in sin;
+
+    if (pev_is_virtual())
+	return len;
+
+    /* For all IGMP, change egress interface (we have only one socket) */
+    if (IN_MULTICAST(ntohl(dst)))
+	k_set_if(ifindex);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = dst;
+
+    return sendto(igmp_socket, buf, len, MSG_DONTROUTE, (struct sockaddr *)&sin, sizeof(sin));
+}
+
+/*
+ * Only a full socket buffer is worth waiting for.  ENOBUFS is the device
+ * queue of one interface, e.g., a wedged link, queueing on it would hold
+ * up queries on all other interfaces, so that packet is dropped.
+ */
+static int igmp_blocked(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+static void igmp_send_error(int err, int ifindex, uint32_t src, uint32_t dst)
+{
+    if (err == ENETDOWN || err == ENODEV)
+	iface_check_state(ifindex);
+    else
+	logit(LOG_WARNING, err, "sendto to %s on %s",
+	      inet_fmt(dst, s1, sizeof(s1)), inet_fmt(src, s2, sizeof(s2)));
+}
+
+/*
+ * Socket buffer full, hold on to a copy of the packet until the socket
+ * is writable again.  Ordering is kept, once there is a backlog all new
+ * packets are queued behind it.
+ */
+static void igmp_queue(int ifindex, uint32_t src, uint32_t dst, int type, uint32_t group, size_t len)
+{
+    struct txpkt *pkt;
+
+    if (txq_len >= TXQ_MAX || !(pkt = malloc(sizeof(*pkt) + len))) {
+	trace(TRACE_TX, type, ENOBUFS, ifindex, group, src, 0);
+	igmp_stats(ifindex)->tx_dropped++;
+	if (txq_dropped++ == 0)
+	    logit(LOG_WARNING, 0, "IGMP send queue full, dropping packets");
+	return;
+    }
+
+    pkt->ifindex = ifindex;
+    pkt->type    = type;
+    pkt->src     = src;
+    pkt->dst     = dst;
+    pkt->group   = group;
+    pkt->len     = len;
+    memcpy(pkt->buf, send_buf, len);
+
+    TAILQ_INSERT_TAIL(&txq, pkt, link);
+    if (txq_len++ == 0)
+	pev_sock_mod(igmp_sockid, PEV_READ | PEV_WRITE);
+}
+
+/*
+ * Flush queued packets when the IGMP socket is writable.
+ */
+static void igmp_write(int sd, void *arg)
+{
+    struct txpkt *pkt;
+
+    (void)sd;
+    (void)arg;
+
+    while ((pkt = TAILQ_FIRST(&txq))) {
+	int rc, err;
+
+	rc  = igmp_sendto(pkt->ifindex, pkt->dst, pkt->buf, pkt->len);
+	err = rc < 0 ? errno : 0;
+	if (rc < 0 && igmp_blocked(err))
+	    return;
+
+	trace(TRACE_TX, pkt->type, err, pkt->ifindex, pkt->group, pkt->src, 0);
+	igmp_tx_count(pkt->ifindex, pkt->type, pkt->group, err);
+	if (rc < 0)
+	    igmp_send_error(err, pkt->ifindex, pkt->src, pkt->dst);
+
+	TAILQ_REMOVE(&txq, pkt, link);
+	txq_len--;
+	free(pkt);
+    }
+
+    pev_sock_mod(igmp_sockid, PEV_READ);
+    if (txq_dropped) {
+	logit(LOG_NOTICE, 0, "IGMP send queue drained, %u packets dropped", txq_dropped);
+	txq_dropped = 0;
+    }
+}
+
 /*
  * Call build_igmp() to build an IGMP message in the output packet buffer.
  * Then send the message from the interface with IP address 'src' to
- * destination 'dst'.
+ * destination 'dst'.  If the socket cannot take it right now, the packet
+ * is queued and sent when the socket is writable.
  */
 void send_igmp(int ifindex, uint32_t src, uint32_t dst, int type, int code, uint32_t group, int datalen)
 {
-    struct sockaddr_in sin;
     struct ip *ip;
     size_t len = 0;
-    int rc;
+    int rc, err;
 
     /* Set IP header length,  router-alert is optional */
     ip        = (struct ip *)send_buf;
@@ -474,29 +656,29 @@ void send_igmp(int ifindex, uint32_t src, uint32_t dst, int type, int code, uint
        len += build_igmp(send_buf + len, src, dst, type, code, group, datalen);
     }
 
-    /* For all IGMP, change egress interface (we have only one socket) */
-    if (IN_MULTICAST(ntohl(dst)))
-	k_set_if(ifindex);
-
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_addr.s_addr = dst;
+    if (!TAILQ_EMPTY(&txq)) {
+	igmp_queue(ifindex, src, dst, type, group, len);
+	return;
+    }
 
-    rc = sendto(igmp_socket, send_buf, len, MSG_DONTROUTE, (struct sockaddr *)&sin, sizeof(sin));
-    if (rc < 0) {
-	if (errno == ENETDOWN)
-	    iface_check_state();
-	else
-	    logit(LOG_WARNING, errno, "sendto to %s on %s",
-		  inet_fmt(dst, s1, sizeof(s1)), inet_fmt(src, s2, sizeof(s2)));
+    rc  = igmp_sendto(ifindex, dst, send_buf, len);
+    err = rc < 0 ? errno : 0;
+    if (rc < 0 && igmp_blocked(err)) {
+	igmp_queue(ifindex, src, dst, type, group, len);
+	return;
     }
 
+    trace(TRACE_TX, type, err, ifindex, group, src, 0);
+    igmp_tx_count(ifindex, type, group, err);
+    if (rc < 0)
+	igmp_send_error(err, ifindex, src, dst);
+
     logit(LOG_DEBUG, 0, "SENT %s from %-15s to %s", igmp_packet_kind(type, code),
 	  src == INADDR_ANY ? "INADDR_ANY" : inet_fmt(src, s1, sizeof(s1)),
 	  inet_fmt(dst, s2, sizeof(s2)));
 }
 
-void send_igmp_proxy(const struct ifi *ifi)
+void send_igmp_proxy(struct ifi *ifi)
 {
     struct sockaddr_ll sa;
     int rc;
@@ -510,10 +692,16 @@ void send_igmp_proxy(const struct ifi *ifi)
     sa.sll_ifindex = ifi->ifi_ifindex;
     sa.sll_halen = ETH_ALEN;
 
-    rc = sendto(igmp_raw_pkt_socket, proxy_send_buf, proxy_send_len, 0, (struct sockaddr *)&sa, sizeof(sa));
+    if (pev_is_virtual())
+	rc = proxy_send_len;
+    else
+	rc = sendto(igmp_raw_pkt_socket, proxy_send_buf, proxy_send_len, 0, (struct sockaddr *)&sa, sizeof(sa));
+    trace(TRACE_TX_PROXY, IGMP_MEMBERSHIP_QUERY, rc < 0 ? errno : 0, ifi->ifi_ifindex, 0, 0, 0);
     if (rc < 0) {
         logit(LOG_WARNING, errno, "sendto for proxy query failed");
-    }
+        ifi->ifi_stats.tx_errors++;
+    } else
+        ifi->ifi_stats.tx_proxy_query++;
 
     logit(LOG_DEBUG, 0, "SENT proxy query from %s", ifi->ifi_name);
 }
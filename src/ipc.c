@@ -36,24 +36,110 @@
  * Client can also send VERSION to get daemon version
  * Client can send SHOW to get general status overview
  *
- * Daemon requires commands to be EXACT MATCH, so the client must
- * translate any short-commands to the full command before sending
- * it to the daemon.
+ * Daemon requires commands in full, so the client must translate any
+ * short-commands to the full command before sending it to the daemon.
+ * Modifiers following the command, e.g., 'detail' for more verbose
+ * output and 'json' for a JSON reply, may be abbreviated to a prefix.
+ * A command is terminated by newline, by the client shutting down its
+ * end of the connection, or by a short pause.  One command per
+ * connection, the daemon closes it after the reply, except for
+ * 'monitor', which keeps it open and streams events until the client
+ * disconnects.
  *
  * Example:
  *           echo "help" |socat - UNIX-CONNECT:/run/querierd.sock
  */
 
 #include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stddef.h>
+#include <sys/wait.h>
 #include "defs.h"
 
 #define ENABLED(v) (v ? "Enabled" : "Disabled")
 
+/*
+ * Max number of concurrent show commands rendered by a child process.
+ * Requests beyond this are served directly from the event loop.
+ */
+#define IPC_JOBS_MAX 4
+
+/*
+ * Legacy clients do not terminate the command, it is considered
+ * complete when nothing more has arrived for this long.
+ */
+#define IPC_GRACE    200000	/* usec */
+
+/*
+ * Events queued per monitor client.  A client that does not keep up
+ * loses events, it is told how many when there is room again.
+ */
+#define IPC_MONITOR_QUEUE 65536	/* bytes */
+
+/*
+ * One client connection, from accept to close.  The command is read
+ * and the reply written as the socket is ready, so no client can hold
+ * up the event loop, or any other client.
+ */
+struct ipc_client {
+	TAILQ_ENTRY(ipc_client) link;
+	int    sd;
+	int    id;			/* pev id of socket */
+	int    timerid;			/* Idle timeout */
+
+	char   cmd[768];
+	size_t cmdlen;
+
+	char  *out;			/* Rendered reply, or event queue */
+	size_t outlen;
+	size_t off;
+
+	int    monitor;			/* Subscribed to events */
+	int    eof;			/* Client shut down its sending end */
+	int    json;
+	size_t drops;			/* Events lost since last delivered */
+	size_t dropped;			/* Total, for the log */
+};
+
+struct ipc_job {
+	pid_t pid;
+	int   sd;			/* Completion pipe, read end */
+	int   id;			/* pev id of completion pipe */
+	int   err;			/* errno from child, if it failed */
+};
+
 static struct sockaddr_un sun;
 static int ipc_sockid =  0;
 static int ipc_socket = -1;
+static struct ipc_job jobs[IPC_JOBS_MAX];
+static TAILQ_HEAD(, ipc_client) clients = TAILQ_HEAD_INITIALIZER(clients);
+static int num_clients;
+static int num_monitors;
+
+static int ipc_dropped(struct ipc_client *c);
 int detail = 0;
+int json   = 0;
+int reset  = 0;
+
+/*
+ * Filter and page for show groups, group and mask in network byte
+ * order, a limit of zero means all.
+ */
+static struct ipc_filter {
+	int      active;
+	char     ifname[IFNAMSIZ];
+	int      vid;
+	uint32_t group;
+	uint32_t mask;
+	int      limit;
+	int      offset;
+} filter;
+
+int ipc_backlog     = IPC_BACKLOG_DEFAULT;
+int ipc_max_clients = IPC_CLIENTS_DEFAULT;
+int ipc_timeout     = IPC_TIMEOUT_DEFAULT;
 
 enum {
 	IPC_ERR = -1,
@@ -64,7 +150,13 @@ enum {
 	IPC_IGMP_GRP,
 	IPC_IGMP_IFACE,
 	IPC_COMPAT,
-	IPC_STATUS
+	IPC_STATUS,
+	IPC_TRACE,
+	IPC_MONITOR,
+	IPC_MDB,
+	IPC_COUNTERS,
+	IPC_METRICS,
+	IPC_PEV
 };
 
 struct ipcmd {
@@ -75,18 +167,29 @@ struct ipcmd {
 } cmds[] = {
 	{ IPC_HELP,       "help", NULL, "This help text" },
 	{ IPC_VERSION,    "version", NULL, "Show daemon version" },
-	{ IPC_IGMP_GRP,   "show groups", NULL, "Show IGMP/MLD group memberships" },
+	{ IPC_IGMP_GRP,   "show groups", "[iface IF] [vlan N] [group ADDR/LEN] [limit N] [offset N]",
+	  "Show IGMP/MLD group memberships" },
+	{ IPC_MDB,        "show mdb", NULL, "Show bridge multicast database (MDB)" },
 	{ IPC_IGMP_IFACE, "show interfaces", NULL, "Show IGMP/MLD interface status" },
 	{ IPC_STATUS,     "show status", NULL, "Show daemon status (default)" },
 	{ IPC_IGMP,       "show igmp", NULL, "Show interfaces and group memberships" },
 	{ IPC_COMPAT,     "show compat", "[detail]", "Show legacy output (test compat mode)" },
+	{ IPC_COUNTERS,   "show counters", "[iface IF] [reset]", "Show per-interface protocol counters" },
+	{ IPC_METRICS,    "show metrics", NULL, "Show metrics in OpenMetrics text format, no JSON" },
+	{ IPC_PEV,        "show pev", "[reset]", "Show event loop callback latency" },
+	{ IPC_TRACE,      "show trace", NULL, "Show protocol event flight recorder" },
+	{ IPC_MONITOR,    "monitor", NULL, "Stream group and querier events as they happen" },
 	{ IPC_IGMP,       "show", NULL, NULL }, /* hidden default */
 };
 
-extern void bridge_prop(FILE *fp, char *prop, int setval);
+extern void bridge_prop(FILE *fp, int prop, int setval);
 extern void bridge_router_ports(FILE *fp);
 extern int show_bridge_compat(FILE *fp);
 extern int show_bridge_groups(FILE *fp);
+extern void bridge_prop_json(struct json *j, const char *key, int prop, int setval);
+extern void bridge_router_ports_json(struct json *j, const char *key);
+extern int bridge_groups_json(struct json *j);
+extern int bridge_vid(struct ifi *ifi);
 
 
 static char *timetostr(time_t t, char *buf, size_t len)
@@ -115,172 +218,419 @@ static char *timetostr(time_t t, char *buf, size_t len)
 	return buf;
 }
 
-static char *chomp(char *str)
+static int match(const char *word, const char *keyword)
 {
-	char *p;
-
-	if (!str || strlen(str) < 1) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-	p = str + strlen(str) - 1;
-        while (*p == '\n')
-		*p-- = 0;
-
-	return str;
+	return !strncasecmp(word, keyword, strlen(word));
 }
 
-static void strip(char *cmd, size_t len)
+static int filter_group(char *arg)
 {
+	struct in_addr ina;
+	const char *err;
 	char *ptr;
+	int len = 32;
+
+	ptr = strchr(arg, '/');
+	if (ptr) {
+		*ptr++ = 0;
+		len = strtonum(ptr, 0, 32, &err);
+		if (err)
+			return -1;
+	}
+	if (inet_pton(AF_INET, arg, &ina) != 1)
+		return -1;
 
-	ptr = cmd + len;
-	len = strspn(ptr, " \t\n");
-	if (len > 0)
-		ptr += len;
+	filter.mask  = len ? htonl(0xffffffffU << (32 - len)) : 0;
+	filter.group = ina.s_addr & filter.mask;
 
-	memmove(cmd, ptr, strlen(ptr) + 1);
-	chomp(cmd);
+	return 0;
 }
 
-static void check_detail(char *cmd, size_t len)
+/*
+ * Modifiers and filters after the command, in any order, keywords may
+ * be abbreviated.  Unknown words are skipped, filters only apply to
+ * commands that support them.  Returns -1 on invalid filter value.
+ */
+static int check_modifiers(char *cmd, size_t len)
 {
-	const char *det = "detail";
-	char *ptr;
-
-	strip(cmd, len);
+	char *arg, *save = NULL;
+	const char *err = NULL;
 
-	len = MIN(strlen(cmd), strlen(det));
-	if (len > 0 && !strncasecmp(cmd, det, len)) {
-		len = strcspn(cmd, " \t\n");
-		strip(cmd, len);
+	detail = 0;
+	json   = 0;
+	reset  = 0;
+	memset(&filter, 0, sizeof(filter));
+	filter.vid = -1;
 
-		detail = 1;
-	} else
-		detail = 0;
-}
+	for (arg = strtok_r(cmd + len, " \t\n", &save); arg; arg = strtok_r(NULL, " \t\n", &save)) {
+		char *key = arg;
 
-static int ipc_read(int sd, char *cmd, ssize_t len)
-{
-	while ((len = read(sd, cmd, len - 1)) == -1) {
-		switch (errno) {
-		case EAGAIN:
-		case EINTR:
+		if (match(key, "detail")) {
+			detail = 1;
+			continue;
+		}
+		if (match(key, "json")) {
+			json = 1;
+			continue;
+		}
+		if (match(key, "reset")) {
+			reset = 1;
 			continue;
-		default:
-			break;
 		}
-		return IPC_ERR;
+		if (!match(key, "iface") && !match(key, "vlan") && !match(key, "group") &&
+		    !match(key, "limit") && !match(key, "offset"))
+			continue;
+
+		arg = strtok_r(NULL, " \t\n", &save);
+		if (!arg)
+			goto fail;
+
+		filter.active = 1;
+		if (match(key, "iface"))
+			strlcpy(filter.ifname, arg, sizeof(filter.ifname));
+		else if (match(key, "vlan"))
+			filter.vid = strtonum(arg, 0, 4095, &err);
+		else if (match(key, "group"))
+			err = filter_group(arg) ? "invalid" : NULL;
+		else if (match(key, "limit"))
+			filter.limit = strtonum(arg, 1, INT_MAX, &err);
+		else
+			filter.offset = strtonum(arg, 0, INT_MAX, &err);
+		if (err)
+			goto fail;
 	}
-	if (len == 0)
-		return IPC_OK;
 
-	cmd[len] = 0;
-//	logit(LOG_DEBUG, 0, "IPC cmd: '%s'", cmd);
+	return 0;
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+static int ipc_parse(char *cmd)
+{
+	char *ptr;
+
+	if (!cmd[0])
+		return IPC_OK;
 
 	for (size_t i = 0; i < NELEMS(cmds); i++) {
 		struct ipcmd *c = &cmds[i];
 		size_t len = strlen(c->cmd);
 
 		if (!strncasecmp(cmd, c->cmd, len)) {
-			check_detail(cmd, len);
+			if (check_modifiers(cmd, len))
+				return IPC_ERR;
+
+			/* OpenMetrics is text only, no JSON variant */
+			if (c->op == IPC_METRICS && json) {
+				errno = EINVAL;
+				return IPC_ERR;
+			}
+
 			return c->op;
 		}
 	}
 
+	/* Unknown command, reply in the format asked for */
+	ptr    = strrchr(cmd, ' ');
+	detail = 0;
+	reset  = 0;
+	json   = ptr && !strcasecmp(ptr + 1, "json");
+
 	errno = EBADMSG;
 	return IPC_ERR;
 }
 
-static int ipc_write(int sd, char *msg, size_t sz)
+static int ipc_close(int sd)
 {
-	ssize_t len;
+	return shutdown(sd, SHUT_RDWR) ||
+		close(sd);
+}
+
+static void ipc_free(struct ipc_client *c)
+{
+	TAILQ_REMOVE(&clients, c, link);
+	num_clients--;
+
+	if (c->monitor) {
+		if (c->dropped)
+			logit(LOG_INFO, 0, "Monitor client lost %zu events", c->dropped);
+		num_monitors--;
+	}
+
+	pev_sock_del(c->id);
+	pev_timer_del(c->timerid);
+	free(c->out);
+	free(c);
+}
+
+static void ipc_drop(struct ipc_client *c)
+{
+	ipc_close(c->sd);
+	ipc_free(c);
+}
+
+/* Client made progress, restart idle timer */
+static void ipc_touch(struct ipc_client *c)
+{
+	pev_timer_set(c->timerid, ipc_timeout * 1000000);
+}
 
-//	logit(LOG_DEBUG, 0, "IPC rpl: '%s'", msg);
+/*
+ * Write as much of the rendered reply as the client can take.  Returns
+ * 0 when all is sent, 1 if the client is not ready, and -1 on error.
+ */
+static int ipc_flush(struct ipc_client *c)
+{
+	while (c->off < c->outlen) {
+		ssize_t num;
 
-	while ((len = write(sd, msg, sz))) {
-		if (-1 == len) {
-			switch (errno) {
-			case EINTR:
-			case EAGAIN:
+		num = send(c->sd, c->out + c->off, c->outlen - c->off, MSG_NOSIGNAL);
+		if (num == -1) {
+			if (errno == EINTR)
 				continue;
-			default:
-				break;
-			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 1;
+			return -1;
 		}
-		break;
+		c->off += num;
 	}
 
-	if (len != (ssize_t)sz)
-		return IPC_ERR;
-
 	return 0;
 }
 
-static int ipc_close(int sd)
+/*
+ * Monitor clients are always read from, to detect a hangup right away
+ * instead of holding their slot and queue until the next event fails
+ * to be written.  Unless the client has shut down its sending end.
+ */
+static int ipc_monitor_events(struct ipc_client *c)
 {
-	return shutdown(sd, SHUT_RDWR) ||
-		close(sd);
+	return (c->eof ? 0 : PEV_READ) | (c->outlen > c->off ? PEV_WRITE : 0);
 }
 
-static int ipc_send(int sd, char *buf, size_t len, FILE *fp)
+/*
+ * Anything a monitor client sends is ignored.  On EOF, tell a hangup
+ * from a client that only ended its command by shutting down its end,
+ * that client still wants events.
+ */
+static void ipc_monitor_read(struct ipc_client *c)
 {
-	while (fgets(buf, len, fp)) {
-		if (!ipc_write(sd, buf, strlen(buf)))
-			continue;
+	struct pollfd pfd = { .fd = c->sd, .events = POLLIN };
+	char buf[64];
+	ssize_t len;
 
-		logit(LOG_WARNING, errno, "Failed communicating with client");
-		return IPC_ERR;
+	while ((len = read(c->sd, buf, sizeof(buf))) > 0)
+		;
+	if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+
+	if (len == 0 && poll(&pfd, 1, 0) == 1 && !(pfd.revents & (POLLHUP | POLLERR))) {
+		c->eof = 1;
+		pev_sock_mod(c->id, ipc_monitor_events(c));
+		return;
+	}
+
+	ipc_drop(c);
+}
+
+static void ipc_writable(int sd, void *arg)
+{
+	struct ipc_client *c = (struct ipc_client *)arg;
+	int rc;
+
+	(void)sd;
+
+	rc = ipc_flush(c);
+	if (rc == 1) {
+		ipc_touch(c);
+		return;
+	}
+	if (rc == 0 && c->monitor) {
+		/* Queue drained, tell about lost events or wait for more */
+		c->off = c->outlen = 0;
+		pev_sock_mod(c->id, ipc_monitor_events(c));
+		ipc_dropped(c);
+		return;
 	}
+	if (rc && !(c->monitor && errno == EPIPE))
+		logit(LOG_WARNING, errno, "Failed communicating with client");
+
+	ipc_drop(c);
+}
 
-	return ipc_close(sd);
+/*
+ * Send rendered reply to client.  What the client cannot take right
+ * away is sent when it is writable.
+ */
+static void ipc_reply(struct ipc_client *c)
+{
+	pev_sock_mod(c->id, PEV_WRITE);
+	ipc_writable(c->sd, c);
 }
 
-static void ipc_show(int sd, int (*cb)(FILE *), char *buf, size_t len)
+/*
+ * Render reply in memory, sent with as few write() calls as the client
+ * socket allows.
+ */
+static int ipc_render(struct ipc_client *c, int (*cb)(FILE *))
 {
 	FILE *fp;
+	int rc;
 
-	fp = tempfile();
+	fp = open_memstream(&c->out, &c->outlen);
 	if (!fp) {
-		logit(LOG_WARNING, errno, "Failed opening temporary file");
+		logit(LOG_WARNING, errno, "Failed allocating reply buffer");
+		return -1;
+	}
+
+	rc = cb(fp);
+	if (fclose(fp))
+		rc = -1;
+	if (rc) {
+		free(c->out);
+		c->out = NULL;
+		c->outlen = 0;
+	}
+
+	return rc;
+}
+
+static void ipc_show(struct ipc_client *c, int (*cb)(FILE *))
+{
+	if (ipc_render(c, cb)) {
+		ipc_drop(c);
 		return;
 	}
 
-	if (cb(fp))
+	ipc_reply(c);
+}
+
+/*
+ * Child is done, its end of the pipe is closed on exit.  The child may
+ * not have been reaped yet, but it is exiting, so a blocking wait here
+ * is brief.  A child that failed writes its errno to the pipe, it must
+ * not log itself.
+ */
+static void ipc_reap(int sd, void *arg)
+{
+	struct ipc_job *job = (struct ipc_job *)arg;
+	char buf[16];
+	ssize_t len;
+	int status = 0;
+
+	while ((len = read(sd, buf, sizeof(buf))) > 0) {
+		if ((size_t)len >= sizeof(job->err))
+			memcpy(&job->err, buf, sizeof(job->err));
+	}
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
 		return;
 
-	rewind(fp);
-	ipc_send(sd, buf, len, fp);
-	fclose(fp);
+	pev_sock_del(job->id);
+	close(job->sd);
+
+	while (waitpid(job->pid, &status, 0) == -1 && errno == EINTR)
+		;
+	if (WIFSIGNALED(status))
+		logit(LOG_WARNING, 0, "IPC child %d killed by signal %d", job->pid, WTERMSIG(status));
+	else if (job->err)
+		logit(LOG_WARNING, job->err, "Failed communicating with client");
+
+	memset(job, 0, sizeof(*job));
 }
 
-static int ipc_err(int sd, char *buf, size_t len)
+/*
+ * Drop everything the child inherited from the daemon that it must not
+ * act on: signal handlers of the event loop and descriptors of sibling
+ * jobs and other clients.  The log writer thread is not inherited, and
+ * the child must not log, see log_atfork().
+ */
+static void ipc_child(struct ipc_client *self)
 {
-	switch (errno) {
-	case EBADMSG:
-		snprintf(buf, len, "No such command, see 'help' for available commands.");
-		break;
+	int signo[] = { SIGHUP, SIGINT, SIGTERM, SIGUSR1, SIGUSR2 };
+	struct ipc_client *c;
 
-	case EINVAL:
-		snprintf(buf, len, "Invalid argument.");
-		break;
+	for (size_t i = 0; i < NELEMS(signo); i++)
+		signal(signo[i], SIG_DFL);
 
-	default:
-		snprintf(buf, len, "Unknown error: %s", strerror(errno));
-		break;
+	for (size_t i = 0; i < NELEMS(jobs); i++) {
+		if (jobs[i].pid)
+			close(jobs[i].sd);
 	}
-
-	return ipc_write(sd, buf, strlen(buf));
+	TAILQ_FOREACH(c, &clients, link) {
+		if (c != self)
+			close(c->sd);
+	}
+	close(ipc_socket);
 }
 
-/* wrap simple functions that don't use >768 bytes for I/O */
-static int ipc_wrap(int sd, int (*cb)(char *, size_t), char *buf, size_t len)
+/*
+ * Render a show command in a child process, writing directly to the
+ * client.  The child works on a copy-on-write snapshot of the daemon's
+ * state, so a large table, or a slow client, does not hold up protocol
+ * processing.  Returns -1 if the request should be served directly,
+ * otherwise the connection is handed over to the child.
+ */
+static int ipc_async(struct ipc_client *c, int (*cb)(FILE *))
 {
-	if (cb(buf, len))
-		return IPC_ERR;
+	struct ipc_job *job = NULL;
+	int fd[2];
+	pid_t pid;
 
-	return ipc_write(sd, buf, strlen(buf));
+	for (size_t i = 0; i < NELEMS(jobs); i++) {
+		if (!jobs[i].pid) {
+			job = &jobs[i];
+			break;
+		}
+	}
+	if (!job)
+		return -1;
+
+	if (pipe(fd))
+		return -1;
+
+	pid = fork();
+	if (pid == -1) {
+		logit(LOG_WARNING, errno, "Failed forking IPC child");
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+
+	if (!pid) {
+		struct timeval tv = { .tv_sec = ipc_timeout };
+		int err = 0;
+
+		close(fd[0]);
+		ipc_child(c);
+
+		/* Nothing else to do, block on a slow client, but not forever */
+		fcntl(c->sd, F_SETFL, fcntl(c->sd, F_GETFL) & ~O_NONBLOCK);
+		setsockopt(c->sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		if (!ipc_render(c, cb) && ipc_flush(c))
+			err = errno;
+		ipc_close(c->sd);
+
+		/* No logging in the child, see log_atfork(), ipc_reap() does */
+		if (err && write(fd[1], &err, sizeof(err)) != sizeof(err))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fd[1]);
+	job->pid = pid;
+	job->sd  = fd[0];
+	job->id  = pev_sock_add(fd[0], ipc_reap, job);
+	if (job->id == -1) {
+		logit(LOG_WARNING, errno, "Failed registering IPC child");
+		job->id = 0;
+		close(fd[0]);
+		while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+			;
+		memset(job, 0, sizeof(*job));
+	}
+
+	return 0;
 }
 
 static const char *ifstate(struct ifi *ifi)
@@ -297,8 +647,62 @@ static const char *ifstate(struct ifi *ifi)
 	return "Up";
 }
 
+static int ifversion(struct ifi *ifi)
+{
+	if (ifi->ifi_flags & IFIF_IGMPV1)
+		return 1;
+	if (ifi->ifi_flags & IFIF_IGMPV2)
+		return 2;
+
+	return 3;
+}
+
+static void json_status(struct json *j)
+{
+	json_int(j, "pid", getpid());
+	json_int(j, "query-interval", igmp_query_interval);
+	json_int(j, "query-response-interval", igmp_response_interval);
+	json_int(j, "last-member-interval", igmp_last_member_interval);
+	json_int(j, "robustness", igmp_robustness);
+	json_int(j, "router-timeout", router_timeout);
+	json_bool(j, "router-alert", router_alert);
+}
+
+static void json_ifaces(struct json *j)
+{
+	struct ifi *ifi;
+
+	json_arr(j, "interfaces");
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		json_obj(j, NULL);
+		json_str(j, "name", ifi->ifi_name);
+		json_str(j, "state", ifstate(ifi));
+		if (!ifi->ifi_querier) {
+			json_str(j, "querier", inet_fmt(ifi->ifi_curr_addr, s1, sizeof(s1)));
+			json_bool(j, "local", 1);
+			json_null(j, "timeout");
+		} else {
+			json_str(j, "querier", inet_fmt(ifi->ifi_querier->al_addr, s1, sizeof(s1)));
+			json_bool(j, "local", 0);
+			json_int(j, "timeout", querier_timeout(ifi));
+		}
+		json_int(j, "version", ifversion(ifi));
+		json_close(j);
+	}
+	json_close(j);
+}
+
 static int show_status(FILE *fp)
 {
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_status(&j);
+		return json_end(&j);
+	}
+
 	if (detail)
 		fprintf(fp, "Process ID              : %d\n", getpid());
 	fprintf(fp, "Query Interval          : %d sec\n", igmp_query_interval);
@@ -318,31 +722,29 @@ static int show_igmp_iface(FILE *fp)
 {
 	struct ifi *ifi;
 
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_ifaces(&j);
+		return json_end(&j);
+	}
+
 	fprintf(fp, "Interface         State     Querier               Timeout  Ver=\n");
 	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
 		char timeout[10];
-		int version;
 
 		if (!ifi->ifi_querier) {
 			inet_fmt(ifi->ifi_curr_addr, s1, sizeof(s1));
 			snprintf(timeout, sizeof(timeout), "None   ");
 		} else {
-			time_t t;
-
 			inet_fmt(ifi->ifi_querier->al_addr, s1, sizeof(s1));
-			t = time(NULL) - ifi->ifi_querier->al_ctime;
-			snprintf(timeout, sizeof(timeout), "%u", router_timeout - (int)t);
+			snprintf(timeout, sizeof(timeout), "%d", querier_timeout(ifi));
 		}
 
-		if (ifi->ifi_flags & IFIF_IGMPV1)
-			version = 1;
-		else if (ifi->ifi_flags & IFIF_IGMPV2)
-			version = 2;
-		else
-			version = 3;
-
 		fprintf(fp, "%-16s  %-8s  %-20s  %7s  %3d\n", ifi->ifi_name,
-			ifstate(ifi), s1, timeout, version);
+			ifstate(ifi), s1, timeout, ifversion(ifi));
 	}
 
 	return 0;
@@ -352,11 +754,26 @@ static int show_igmp(FILE *fp)
 {
 	int rc = 0;
 
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_status(&j);
+		bridge_prop_json(&j, "fast-leave-ports", MDB_PORT_FAST_LEAVE, 1);
+		bridge_router_ports_json(&j, "router-ports");
+		bridge_prop_json(&j, "flood-ports", MDB_PORT_MCAST_FLOOD, 1);
+		json_ifaces(&j);
+		rc = bridge_groups_json(&j);
+
+		return json_end(&j) || rc;
+	}
+
 	fprintf(fp, "Multicast Overview=\n");
 	show_status(fp);
-	fprintf(fp, "%-23s : ", "Fast Leave Ports"); bridge_prop(fp, "multicast_fast_leave", 1);
+	fprintf(fp, "%-23s : ", "Fast Leave Ports"); bridge_prop(fp, MDB_PORT_FAST_LEAVE, 1);
 	fprintf(fp, "%-23s : ", "Router Ports");     bridge_router_ports(fp);
-	fprintf(fp, "%-23s : ", "Flood Ports");      bridge_prop(fp, "multicast_flood", 1);
+	fprintf(fp, "%-23s : ", "Flood Ports");      bridge_prop(fp, MDB_PORT_MCAST_FLOOD, 1);
 	fprintf(fp, "\n");
 
 	rc += show_igmp_iface(fp);
@@ -366,134 +783,880 @@ static int show_igmp(FILE *fp)
 	return rc;
 }
 
+/* Page through groups matching the filter, see show_groups() */
+struct group_walk {
+	FILE        *fp;
+	struct json *j;
+	int          skip;
+	int          num;
+	int          more;
+};
+
+static int show_group(struct group_walk *w, struct ifi *ifi, struct listaddr *g)
+{
+	int expires;
+
+	if ((g->al_addr & filter.mask) != filter.group)
+		return 0;
+	if (w->skip) {
+		w->skip--;
+		return 0;
+	}
+	if (filter.limit && w->num == filter.limit) {
+		w->more = 1;
+		return 1;
+	}
+	w->num++;
+
+	expires = group_expires(g);
+
+	if (w->j) {
+		json_obj(w->j, NULL);
+		json_str(w->j, "iface", ifi->ifi_name);
+		json_str(w->j, "group", inet_fmt(g->al_addr, s1, sizeof(s1)));
+		json_str(w->j, "reporter", inet_fmt(g->al_reporter, s2, sizeof(s2)));
+		json_int(w->j, "version", g->al_pv);
+		json_int(w->j, "expires", expires);
+		json_close(w->j);
+	} else
+		fprintf(w->fp, "%-16s  %-15s  %-15s  %3d  %7d\n", ifi->ifi_name,
+			inet_fmt(g->al_addr, s1, sizeof(s1)),
+			inet_fmt(g->al_reporter, s2, sizeof(s2)), g->al_pv, expires);
+
+	return 0;
+}
+
 /*
- * Silly wrapper around `bridge mdb show` to list group memberships in a
- * slightly different manner -- closer to "show fdb" in WeOS
+ * Group memberships from daemon state.  Only the rows asked for are
+ * visited when filtering on interface or on a single group, the latter
+ * is a hash lookup per interface.
  */
-static int show_mdb(FILE *fp)
+static int show_groups(FILE *fp)
 {
-	const int devw = 6;	/* XXX: calculate width dynamically */
-	char buf[256];
-	FILE *pp;
+	struct group_walk w = { .fp = fp, .skip = filter.offset };
+	struct json j;
+	struct ifi *ifi;
 
-	pp = popen("bridge mdb show", "r");
-	if (!pp) {
-		fprintf(fp, "Failed querying bridge for MDB entries: %s\n", strerror(errno));
-		return 1;
+	if (json) {
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_arr(&j, "groups");
+		w.j = &j;
+	} else
+		fprintf(fp, "Interface         Group            Last Reporter    Ver  Expires=\n");
+
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		struct listaddr *g;
+
+		if (filter.ifname[0] && strcmp(filter.ifname, ifi->ifi_name))
+			continue;
+		if (filter.vid >= 0 && bridge_vid(ifi) != filter.vid)
+			continue;
+
+		if (filter.mask == 0xffffffff) {
+			g = group_find(ifi, filter.group);
+			if (g && show_group(&w, ifi, g))
+				break;
+			continue;
+		}
+
+		TAILQ_FOREACH(g, &ifi->ifi_groups, al_link) {
+			if (show_group(&w, ifi, g))
+				break;
+		}
+		if (w.more)
+			break;
 	}
 
-	fprintf(fp, "%-28s %4s %-*s %s=\n", "Group", "VLAN", devw, "Bridge", "Port(s)");
-	while (fgets(buf, sizeof(buf), pp)) {
-		char flags[16];
-		char port[16];
-		char dev[16];
-		char grp[64];
-		int vid;
+	if (json) {
+		json_close(&j);
+		json_int(&j, "offset", filter.offset);
+		json_int(&j, "count", w.num);
+		json_bool(&j, "more", w.more);
+		return json_end(&j);
+	}
 
-		sscanf(buf, "dev %s port %s grp %s %s vid %d", dev, port, grp, flags, &vid);
-		fprintf(fp, "%-28s %4d %-*s %s\n", grp, vid, devw, dev, port);
+	if (w.more)
+		fprintf(fp, "\nMore groups, continue with offset %d\n", filter.offset + w.num);
+
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	size_t      offset;
+} counters[] = {
+	{ "rx-query-v1",     offsetof(struct ifi_stats, rx_query[0])     },
+	{ "rx-query-v2",     offsetof(struct ifi_stats, rx_query[1])     },
+	{ "rx-query-v3",     offsetof(struct ifi_stats, rx_query[2])     },
+	{ "rx-report-v1",    offsetof(struct ifi_stats, rx_report[0])    },
+	{ "rx-report-v2",    offsetof(struct ifi_stats, rx_report[1])    },
+	{ "rx-report-v3",    offsetof(struct ifi_stats, rx_report[2])    },
+	{ "rx-leave",        offsetof(struct ifi_stats, rx_leave)        },
+	{ "rx-errors",       offsetof(struct ifi_stats, rx_errors)       },
+	{ "tx-query",        offsetof(struct ifi_stats, tx_query)        },
+	{ "tx-group-query",  offsetof(struct ifi_stats, tx_group_query)  },
+	{ "tx-proxy-query",  offsetof(struct ifi_stats, tx_proxy_query)  },
+	{ "tx-errors",       offsetof(struct ifi_stats, tx_errors)       },
+	{ "tx-dropped",      offsetof(struct ifi_stats, tx_dropped)      },
+	{ "elect-won",       offsetof(struct ifi_stats, elect_won)       },
+	{ "elect-lost",      offsetof(struct ifi_stats, elect_lost)      },
+	{ "querier-timeout", offsetof(struct ifi_stats, querier_timeout) },
+	{ "group-add",       offsetof(struct ifi_stats, group_add)       },
+	{ "group-leave",     offsetof(struct ifi_stats, group_leave)     },
+	{ "group-expire",    offsetof(struct ifi_stats, group_expire)    },
+};
+
+static uint64_t counter(struct ifi *ifi, size_t i)
+{
+	return *(uint64_t *)((char *)&ifi->ifi_stats + counters[i].offset);
+}
+
+/*
+ * Protocol counters per interface, optionally filtered on interface.
+ * With reset the counters are cleared after being shown, so no event
+ * between two polls is lost.
+ */
+static int show_counters(FILE *fp)
+{
+	struct json j;
+	struct ifi *ifi;
+	int num = 0;
+
+	if (json) {
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_arr(&j, "interfaces");
 	}
 
-	return pclose(pp);
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		if (filter.ifname[0] && strcmp(filter.ifname, ifi->ifi_name))
+			continue;
+
+		if (json) {
+			json_obj(&j, NULL);
+			json_str(&j, "iface", ifi->ifi_name);
+			for (size_t i = 0; i < NELEMS(counters); i++)
+				json_int(&j, counters[i].name, counter(ifi, i));
+			json_close(&j);
+		} else {
+			fprintf(fp, "%s%s:\n", num++ ? "\n" : "", ifi->ifi_name);
+			for (size_t i = 0; i < NELEMS(counters); i++)
+				fprintf(fp, "  %-21s : %" PRIu64 "\n", counters[i].name, counter(ifi, i));
+		}
+
+		if (reset)
+			memset(&ifi->ifi_stats, 0, sizeof(ifi->ifi_stats));
+	}
+
+	if (json)
+		return json_end(&j);
+
+	return 0;
+}
+
+static int show_mdb_entry(struct mdb_entry *e, void *arg)
+{
+	FILE *fp = (FILE *)arg;
+	const int devw = 6;	/* XXX: calculate width dynamically */
+
+	inet_fmt(e->me_group, s1, sizeof(s1));
+	fprintf(fp, "%-28s %4d %-*s ", s1, e->me_vid, devw, mdb_ifname(e->me_br));
+	mdb_ports(fp, e);
+	fprintf(fp, "\n");
+
+	return 0;
+}
+
+/*
+ * List group memberships from the bridge MDB mirror in a slightly
+ * different manner -- closer to "show fdb" in WeOS
+ */
+static int show_mdb(FILE *fp)
+{
+	const int devw = 6;
+
+	fprintf(fp, "%-28s %4s %-*s %s=\n", "Group", "VLAN", devw, "Bridge", "Port(s)");
+
+	return mdb_foreach(show_mdb_entry, fp);
 }
 
 static int show_version(FILE *fp)
 {
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_str(&j, "name", PACKAGE_NAME);
+		json_str(&j, "version", PACKAGE_VERSION);
+		return json_end(&j);
+	}
+
 	fputs(versionstring, fp);
 	return 0;
 }
 
-static void ipc_help(int sd, char *buf, size_t len)
+static int show_help(FILE *fp)
 {
-	FILE *fp;
+	if (json) {
+		struct json j;
 
-	fp = tempfile();
-	if (!fp) {
-		int sz;
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_arr(&j, "commands");
+		for (size_t i = 0; i < NELEMS(cmds); i++) {
+			struct ipcmd *c = &cmds[i];
 
-		sz = snprintf(buf, len, "Cannot create tempfile: %s", strerror(errno));
-		if (write(sd, buf, sz) != sz)
-			logit(LOG_INFO, errno, "Client closed connection");
-		return;
+			if (!c->help)
+				continue;
+
+			json_obj(&j, NULL);
+			json_str(&j, "command", c->cmd);
+			json_str(&j, "args", c->arg);
+			json_str(&j, "help", c->help);
+			json_close(&j);
+		}
+		return json_end(&j);
 	}
 
 	for (size_t i = 0; i < NELEMS(cmds); i++) {
 		struct ipcmd *c = &cmds[i];
-		char tmp[50];
+		char tmp[128];
 
 		snprintf(tmp, sizeof(tmp), "%s%s%s", c->cmd, c->arg ? " " : "", c->arg ?: "");
 		fprintf(fp, "%s\t%s\n", tmp, c->help ? c->help : "");
 	}
-	rewind(fp);
 
-	while (fgets(buf, len, fp)) {
-		if (!ipc_write(sd, buf, strlen(buf)))
+	return 0;
+}
+
+static int show_trace(FILE *fp)
+{
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		trace_json(&j);
+		return json_end(&j);
+	}
+
+	if (trace_write(fp)) {
+		logit(LOG_WARNING, errno, "Failed sending flight recorder to client");
+		return 1;
+	}
+
+	return 0;
+}
+
+static const char *hist_type(int type)
+{
+	switch (type) {
+	case PEV_HIST_LOOP:     return "loop";
+	case PEV_HIST_LATENESS: return "lateness";
+	case PEV_HIST_READ:     return "read";
+	case PEV_HIST_WRITE:    return "write";
+	case PEV_HIST_TIMER:    return "timer";
+	case PEV_HIST_SIGNAL:   return "signal";
+	default:                return "unknown";
+	}
+}
+
+static int hist_json(const struct pev_hist *h, void *arg)
+{
+	struct json *j = (struct json *)arg;
+
+	json_obj(j, NULL);
+	json_str(j, "name", h->name);
+	json_str(j, "type", hist_type(h->type));
+	json_int(j, "count", h->count);
+	json_int(j, "total", h->sum);
+	json_int(j, "max", h->max);
+	json_int(j, "p50", pev_hist_pct(h, 50));
+	json_int(j, "p90", pev_hist_pct(h, 90));
+	json_int(j, "p99", pev_hist_pct(h, 99));
+	json_arr(j, "buckets");
+	for (int i = 0; i < PEV_HIST_BUCKETS; i++) {
+		if (!h->bucket[i])
 			continue;
+		json_arr(j, NULL);
+		json_int(j, NULL, pev_hist_upper(i));
+		json_int(j, NULL, h->bucket[i]);
+		json_close(j);
+	}
+	json_close(j);
+	json_close(j);
 
-		logit(LOG_WARNING, errno, "Failed communicating with client");
+	return 0;
+}
+
+static int hist_show(const struct pev_hist *h, void *arg)
+{
+	FILE *fp = (FILE *)arg;
+
+	fprintf(fp, "%-18s  %-8s  %8llu  %8.1f  %8.1f  %8.1f  %8.1f\n", h->name, hist_type(h->type),
+		h->count, h->count ? h->sum / 1e3 / h->count : 0.0,
+		pev_hist_pct(h, 50) / 1e3, pev_hist_pct(h, 99) / 1e3, h->max / 1e3);
+
+	return 0;
+}
+
+/*
+ * Event loop statistics and, when pev-profile is enabled, latency per
+ * callback.  Times are in usec, in JSON nsec.  Percentiles are the
+ * upper bound of the histogram bucket.
+ */
+static int show_pev(FILE *fp)
+{
+	struct pev_stats st;
+	int rc = 0;
+
+	pev_stats(&st);
+
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_bool(&j, "profiling", pev_profiling());
+		json_int(&j, "loops", st.loops);
+		json_int(&j, "busy", st.busy);
+		json_int(&j, "busy-max", st.busy_max);
+		json_int(&j, "timer-runs", st.timer_runs);
+		json_int(&j, "timer-lateness", st.timer_late);
+		json_int(&j, "timer-lateness-max", st.timer_late_max);
+		json_int(&j, "timers", st.timers);
+		json_int(&j, "sockets", st.socks);
+		json_arr(&j, "callbacks");
+		if (pev_profiling())
+			pev_hist_foreach(hist_json, &j);
+		json_close(&j);
+		rc = json_end(&j);
+	} else {
+		fprintf(fp, "%-23s : %s\n", "Profiling", ENABLED(pev_profiling()));
+		fprintf(fp, "%-23s : %llu\n", "Loop iterations", st.loops);
+		fprintf(fp, "%-23s : %.1f usec, max %.1f usec\n", "Busy time, average",
+			st.loops ? st.busy / 1e3 / st.loops : 0.0, st.busy_max / 1e3);
+		fprintf(fp, "%-23s : %llu\n", "Timer callbacks", st.timer_runs);
+		fprintf(fp, "%-23s : %.1f usec, max %.1f usec\n", "Timer lateness, average",
+			st.timer_runs ? st.timer_late / 1e3 / st.timer_runs : 0.0, st.timer_late_max / 1e3);
+		fprintf(fp, "%-23s : %d\n", "Active timers", st.timers);
+		fprintf(fp, "%-23s : %d\n", "Active sockets", st.socks);
+
+		if (pev_profiling()) {
+			fprintf(fp, "\n%-18s  %-8s  %8s  %8s  %8s  %8s  %8s=\n", "Callback", "Type",
+				"Calls", "Average", "p50", "p99", "Max");
+			pev_hist_foreach(hist_show, fp);
+		}
+	}
+
+	if (reset)
+		pev_hist_reset();
+
+	return rc;
+}
+
+/*
+ * Cached replies for frequently polled commands, valid as long as the
+ * state generation and the modifiers are unchanged.  Replies that show a
+ * running timer are also only valid within the second they were made.
+ * Filtered replies are not cached.
+ */
+static struct ipc_cache {
+	int     (*cb)(FILE *);
+	int      timed;
+	int      valid;
+	uint32_t gen;
+	int      detail;
+	int      json;
+	time_t   when;
+	char    *buf;
+	size_t   len;
+} cache[] = {
+	{ show_igmp_iface,    1, 0, 0, 0, 0, 0, NULL, 0 },
+	{ show_groups,        1, 0, 0, 0, 0, 0, NULL, 0 },
+	{ show_bridge_groups, 0, 0, 0, 0, 0, 0, NULL, 0 },
+	{ show_status,        0, 0, 0, 0, 0, 0, NULL, 0 },
+};
+
+static void ipc_cache_save(struct ipc_cache *e, struct ipc_client *c, time_t now)
+{
+	free(e->buf);
+	e->buf   = malloc(c->outlen + 1);
+	e->valid = e->buf != NULL;
+	if (!e->valid)
+		return;
+
+	memcpy(e->buf, c->out, c->outlen);
+	e->len    = c->outlen;
+	e->gen    = state_gen;
+	e->detail = detail;
+	e->json   = json;
+	e->when   = now;
+}
+
+static void ipc_cached(struct ipc_client *c, int (*cb)(FILE *))
+{
+	struct ipc_cache *e = NULL;
+	time_t now = pev_now() / PEV_NSEC_PER_SEC;
+
+	for (size_t i = 0; i < NELEMS(cache); i++) {
+		if (cache[i].cb == cb)
+			e = &cache[i];
+	}
+	if (!e || filter.active) {
+		ipc_show(c, cb);
+		return;
+	}
+
+	if (!e->valid || e->gen != state_gen || e->detail != detail || e->json != json ||
+	    (e->timed && e->when != now)) {
+		if (ipc_render(c, cb)) {
+			ipc_drop(c);
+			return;
+		}
+		ipc_cache_save(e, c, now);
+	} else {
+		c->out = malloc(e->len + 1);
+		if (!c->out) {
+			logit(LOG_WARNING, errno, "Failed allocating reply buffer");
+			ipc_drop(c);
+			return;
+		}
+		memcpy(c->out, e->buf, e->len);
+		c->outlen = e->len;
+	}
+
+	ipc_reply(c);
+}
+
+static void ipc_cache_flush(void)
+{
+	for (size_t i = 0; i < NELEMS(cache); i++) {
+		free(cache[i].buf);
+		cache[i].buf   = NULL;
+		cache[i].valid = 0;
+	}
+}
+
+static void ipc_err(struct ipc_client *c, int err)
+{
+	const char *msg;
+	FILE *fp;
+
+	fp = open_memstream(&c->out, &c->outlen);
+	if (!fp) {
+		ipc_drop(c);
+		return;
+	}
+
+	switch (err) {
+	case EBADMSG:
+		msg = "No such command, see 'help' for available commands.";
+		break;
+
+	case EINVAL:
+		msg = "Invalid argument.";
+		break;
+
+	default:
+		msg = strerror(err);
+		break;
 	}
 
+	if (json) {
+		struct json j;
+
+		json_init(&j, fp);
+		json_obj(&j, NULL);
+		json_str(&j, "error", msg);
+		json_end(&j);
+	} else if (err == EBADMSG || err == EINVAL)
+		fprintf(fp, "%s\n", msg);
+	else
+		fprintf(fp, "Unknown error: %s\n", msg);
 	fclose(fp);
+
+	ipc_reply(c);
 }
 
-static void ipc_handle(int sd, void *arg)
+/*
+ * Append an event to a monitor client's queue, never blocks.  When the
+ * client has lost events, a notice with the count goes first.
+ */
+static int ipc_queue(struct ipc_client *c, const char *msg, size_t len)
 {
-	char cmd[768] = { 0 };
-	ssize_t len;
-	int client;
-	int rc = 0;
+	if (c->outlen + len > IPC_MONITOR_QUEUE && c->off) {
+		memmove(c->out, c->out + c->off, c->outlen - c->off);
+		c->outlen -= c->off;
+		c->off = 0;
+	}
+	if (c->outlen + len > IPC_MONITOR_QUEUE)
+		return -1;
+
+	memcpy(c->out + c->outlen, msg, len);
+	c->outlen += len;
+	pev_sock_mod(c->id, ipc_monitor_events(c));
+
+	return 0;
+}
+
+static size_t ipc_event_fmt(char *buf, size_t len, int json, const char *event,
+			    const char *ifname, uint32_t group, uint32_t src, size_t count)
+{
+	char tm[20], grp[INET_ADDRSTRLEN] = "", from[INET_ADDRSTRLEN] = "";
+	struct timespec ts;
+	struct json j;
+	FILE *fp;
+	int n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (group)
+		inet_fmt(group, grp, sizeof(grp));
+	if (src)
+		inet_fmt(src, from, sizeof(from));
+
+	if (!json) {
+		strftime(tm, sizeof(tm), "%H:%M:%S", localtime(&ts.tv_sec));
+		if (count)
+			n = snprintf(buf, len, "%s.%03ld %-16s %zu events\n", tm,
+				     ts.tv_nsec / 1000000, event, count);
+		else
+			n = snprintf(buf, len, "%s.%03ld %-16s %-16s %-15s %s\n", tm,
+				     ts.tv_nsec / 1000000, event, ifname, grp, from);
+
+		return n < 0 ? 0 : MIN((size_t)n, len - 1);
+	}
+
+	fp = fmemopen(buf, len, "w");
+	if (!fp)
+		return 0;
+
+	json_init(&j, fp);
+	json_obj(&j, NULL);
+	json_int(&j, "time", (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+	json_str(&j, "event", event);
+	if (count) {
+		json_int(&j, "count", count);
+	} else {
+		json_str(&j, "iface", ifname);
+		json_str(&j, "group", group ? grp : NULL);
+		json_str(&j, "source", src ? from : NULL);
+	}
+	json_end(&j);
+
+	n = ftell(fp);
+	fclose(fp);
+
+	return n < 0 ? 0 : MIN((size_t)n, len - 1);
+}
 
-	client = accept(sd, NULL, NULL);
-	if (client < 0)
+/* Queue notice of lost events, if any, returns -1 if no room */
+static int ipc_dropped(struct ipc_client *c)
+{
+	char buf[256];
+	size_t len;
+
+	if (!c->drops)
+		return 0;
+
+	len = ipc_event_fmt(buf, sizeof(buf), c->json, "dropped", NULL, 0, 0, c->drops);
+	if (ipc_queue(c, buf, len))
+		return -1;
+	c->drops = 0;
+
+	return 0;
+}
+
+/*
+ * Called on group and querier changes, queue the event to all monitor
+ * clients, sent when their socket is writable.
+ */
+void ipc_event(const char *event, struct ifi *ifi, uint32_t group, uint32_t src)
+{
+	char text[128], obj[256];
+	size_t tlen = 0, jlen = 0;
+	struct ipc_client *c;
+
+	if (!num_monitors)
+		return;
+
+	TAILQ_FOREACH(c, &clients, link) {
+		if (!c->monitor)
+			continue;
+
+		if (ipc_dropped(c)) {
+			c->drops++;
+			c->dropped++;
+			continue;
+		}
+
+		if (c->json && !jlen)
+			jlen = ipc_event_fmt(obj, sizeof(obj), 1, event, ifi->ifi_name, group, src, 0);
+		if (!c->json && !tlen)
+			tlen = ipc_event_fmt(text, sizeof(text), 0, event, ifi->ifi_name, group, src, 0);
+
+		if (c->json ? ipc_queue(c, obj, jlen) : ipc_queue(c, text, tlen)) {
+			c->drops++;
+			c->dropped++;
+		}
+	}
+}
+
+/*
+ * Client stays connected and gets events queued, see ipc_event().  It
+ * is still read from, only to detect a hangup, see ipc_monitor_read().
+ */
+static void ipc_subscribe(struct ipc_client *c)
+{
+	const char hdr[] = "Time         Event            Interface        Group           Source=\n";
+
+	free(c->out);
+	c->out = malloc(IPC_MONITOR_QUEUE);
+	if (!c->out) {
+		logit(LOG_WARNING, errno, "Failed allocating monitor queue");
+		ipc_drop(c);
+		return;
+	}
+	c->outlen  = c->off = 0;
+	c->monitor = 1;
+	c->json    = json;
+	num_monitors++;
+
+	pev_sock_mod(c->id, ipc_monitor_events(c));
+	if (!json)
+		ipc_queue(c, hdr, sizeof(hdr) - 1);
+}
+
+/* Serve from a child process if possible, otherwise directly */
+static void ipc_heavy(struct ipc_client *c, int (*cb)(FILE *))
+{
+	if (!ipc_async(c, cb)) {
+		/* Child owns the connection now, must not shut it down */
+		close(c->sd);
+		ipc_free(c);
+		return;
+	}
+
+	ipc_show(c, cb);
+}
+
+static void ipc_dispatch(struct ipc_client *c)
+{
+	char *cmd = c->cmd;
+	int op;
+
+	cmd[strcspn(cmd, "\r\n")] = 0;
+//	logit(LOG_DEBUG, 0, "IPC cmd: '%s'", cmd);
+
+	op = ipc_parse(cmd);
+	if (op == IPC_ERR && errno == EINVAL) {
+		ipc_err(c, EINVAL);
 		return;
+	}
 
-	switch (ipc_read(client, cmd, sizeof(cmd))) {
+	switch (op) {
 	case IPC_HELP:
-		ipc_help(client, cmd, sizeof(cmd));
+		ipc_show(c, show_help);
 		break;
 
 	case IPC_VERSION:
-		ipc_show(client, show_version, cmd, sizeof(cmd));
+		ipc_show(c, show_version);
 		break;
 
 	case IPC_IGMP_GRP:
-		ipc_show(client, show_bridge_groups, cmd, sizeof(cmd));
+		ipc_cached(c, show_groups);
+		break;
+
+	case IPC_MDB:
+		ipc_cached(c, show_bridge_groups);
 		break;
 
 	case IPC_IGMP_IFACE:
-		ipc_show(client, show_igmp_iface, cmd, sizeof(cmd));
+		ipc_cached(c, show_igmp_iface);
 		break;
 
 	case IPC_IGMP:
-		ipc_show(client, show_igmp, cmd, sizeof(cmd));
+		ipc_heavy(c, show_igmp);
 		break;
 
 	case IPC_COMPAT:
-		ipc_show(client, show_bridge_compat, cmd, sizeof(cmd));
+		ipc_heavy(c, show_bridge_compat);
 		break;
 
 	case IPC_STATUS:
-		ipc_show(client, show_status, cmd, sizeof(cmd));
+		ipc_cached(c, show_status);
 		break;
 
-	case IPC_OK:
-		/* client ping, ignore */
+	case IPC_COUNTERS:
+		ipc_show(c, show_counters);
 		break;
 
-	case IPC_ERR:
-		logit(LOG_WARNING, errno, "Failed reading command from client");
-		rc = IPC_ERR;
+	case IPC_METRICS:
+		ipc_show(c, metrics_write);
+		break;
+
+	case IPC_PEV:
+		ipc_show(c, show_pev);
+		break;
+
+	case IPC_TRACE:
+		ipc_show(c, show_trace);
+		break;
+
+	case IPC_MONITOR:
+		ipc_subscribe(c);
+		break;
+
+	case IPC_OK:
+		/* client ping, ignore */
+		ipc_drop(c);
 		break;
 
 	default:
 		logit(LOG_WARNING, 0, "Invalid IPC command: %s", cmd);
+		ipc_err(c, EBADMSG);
 		break;
 	}
+}
 
-	if (rc == IPC_ERR)
-		ipc_err(sd, cmd, sizeof(cmd));
+/*
+ * Render a show command straight to a stream, without a client, for
+ * the simulator.  Same commands and modifiers as over IPC, except for
+ * those that need a connection, like monitor.
+ */
+int ipc_print(FILE *fp, const char *cmd)
+{
+	int (*cb)(FILE *) = NULL;
+	char buf[sizeof(((struct ipc_client *)0)->cmd)];
+
+	strlcpy(buf, cmd, sizeof(buf));
+	switch (ipc_parse(buf)) {
+	case IPC_HELP:       cb = show_help;          break;
+	case IPC_VERSION:    cb = show_version;       break;
+	case IPC_IGMP_GRP:   cb = show_groups;        break;
+	case IPC_MDB:        cb = show_bridge_groups; break;
+	case IPC_IGMP_IFACE: cb = show_igmp_iface;    break;
+	case IPC_IGMP:       cb = show_igmp;          break;
+	case IPC_COMPAT:     cb = show_bridge_compat; break;
+	case IPC_STATUS:     cb = show_status;        break;
+	case IPC_COUNTERS:   cb = show_counters;      break;
+	case IPC_METRICS:    cb = metrics_write;      break;
+	case IPC_PEV:        cb = show_pev;           break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
 
-	ipc_close(client);
+	return cb(fp);
+}
+
+/*
+ * Read command incrementally, until newline or the client shuts down
+ * its end, see also IPC_GRACE.  Anything longer than the command
+ * buffer is truncated.
+ */
+static void ipc_readable(int sd, void *arg)
+{
+	struct ipc_client *c = (struct ipc_client *)arg;
+	size_t room = sizeof(c->cmd) - 1 - c->cmdlen;
+	ssize_t len;
+
+	if (c->monitor) {
+		ipc_monitor_read(c);
+		return;
+	}
+
+	len = read(sd, c->cmd + c->cmdlen, room);
+	if (len == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+
+		logit(LOG_WARNING, errno, "Failed reading command from client");
+		ipc_drop(c);
+		return;
+	}
+
+	c->cmdlen += len;
+	c->cmd[c->cmdlen] = 0;
+	if (len > 0 && (size_t)len < room && !memchr(c->cmd + c->cmdlen - len, '\n', len)) {
+		pev_timer_set(c->timerid, IPC_GRACE);
+		return;
+	}
+
+	ipc_dispatch(c);
+}
+
+static void ipc_idle(int timeout, void *arg)
+{
+	struct ipc_client *c = (struct ipc_client *)arg;
+
+	(void)timeout;
+
+	/* Monitor clients may be quiet for a long time */
+	if (c->monitor)
+		return;
+
+	/* Unterminated command from legacy client */
+	if (c->cmdlen && !c->out) {
+		ipc_dispatch(c);
+		return;
+	}
+
+	logit(LOG_INFO, 0, "IPC client idle for %d sec, closing connection", ipc_timeout);
+	ipc_drop(c);
+}
+
+static void ipc_accept(int sd, void *arg)
+{
+	struct ipc_client *c;
+	int client;
+
+	(void)arg;
+
+	while ((client = accept(sd, NULL, NULL)) != -1) {
+		if (num_clients >= ipc_max_clients) {
+			const char msg[] = "Too many clients, try again later.\n";
+
+			logit(LOG_WARNING, 0, "Too many IPC clients, max %d", ipc_max_clients);
+			if (write(client, msg, sizeof(msg) - 1) != sizeof(msg) - 1)
+				logit(LOG_DEBUG, errno, "Client closed connection");
+			ipc_close(client);
+			continue;
+		}
+
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			logit(LOG_WARNING, errno, "Failed allocating IPC client");
+			ipc_close(client);
+			continue;
+		}
+		c->sd = client;
+
+		c->id = pev_sock_add_events(client, PEV_READ, ipc_readable, ipc_writable, c);
+		if (c->id == -1) {
+			logit(LOG_WARNING, errno, "Failed registering IPC client");
+			ipc_close(client);
+			free(c);
+			continue;
+		}
+
+		c->timerid = pev_timer_add(ipc_timeout * 1000000, 0, ipc_idle, c);
+		if (c->timerid == -1) {
+			logit(LOG_WARNING, errno, "Failed creating IPC client timer");
+			pev_sock_del(c->id);
+			ipc_close(client);
+			free(c);
+			continue;
+		}
+
+		TAILQ_INSERT_TAIL(&clients, c, link);
+		num_clients++;
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		logit(LOG_WARNING, errno, "Failed accepting IPC client");
 }
 
 
@@ -509,7 +1672,7 @@ void ipc_init(char *sockfile)
 	}
 
 	/* Portable SOCK_NONBLOCK replacement, ignore any error. */
-	(void)fcntl(sd, F_SETFD, fcntl(sd, F_GETFD) | O_NONBLOCK);
+	(void)fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
 
 #ifdef HAVE_SOCKADDR_UN_SUN_LEN
 	sun.sun_len = 0;	/* <- correct length is set by the OS */
@@ -524,21 +1687,45 @@ void ipc_init(char *sockfile)
 	logit(LOG_DEBUG, 0, "Binding IPC socket to %s", sun.sun_path);
 
 	len = offsetof(struct sockaddr_un, sun_path) + strlen(sun.sun_path);
-	if (bind(sd, (struct sockaddr *)&sun, len) < 0 || listen(sd, 1)) {
+	if (bind(sd, (struct sockaddr *)&sun, len) < 0 || listen(sd, ipc_backlog)) {
 		logit(LOG_WARNING, errno, "Failed binding IPC socket, client disabled");
 		close(sd);
 		return;
 	}
 
-	ipc_sockid = pev_sock_add(sd, ipc_handle, NULL);
+	ipc_sockid = pev_sock_add(sd, ipc_accept, NULL);
 	if (ipc_sockid == -1)
 		logit(LOG_ERR, 0, "Failed registering IPC handler");
 
 	ipc_socket = sd;
 }
 
+/*
+ * Close all connections and the IPC socket.  Settings are reset to
+ * defaults, so removing them from the .conf file and sending SIGHUP
+ * takes effect.
+ */
 void ipc_exit(void)
 {
+	struct ipc_client *c, *tmp;
+
+	TAILQ_FOREACH_SAFE(c, &clients, link, tmp)
+		ipc_drop(c);
+	ipc_cache_flush();
+
+	for (size_t i = 0; i < NELEMS(jobs); i++) {
+		if (!jobs[i].pid)
+			continue;
+
+		/* Do not wait for a client that does not read */
+		pev_sock_del(jobs[i].id);
+		close(jobs[i].sd);
+		kill(jobs[i].pid, SIGKILL);
+		while (waitpid(jobs[i].pid, NULL, 0) == -1 && errno == EINTR)
+			;
+		memset(&jobs[i], 0, sizeof(jobs[i]));
+	}
+
 	if (ipc_sockid > 0)
 		pev_sock_del(ipc_sockid);
 	if (ipc_socket > -1)
@@ -547,6 +1734,10 @@ void ipc_exit(void)
 	unlink(sun.sun_path);
 	ipc_socket = -1;
 	ipc_sockid = 0;
+
+	ipc_backlog     = IPC_BACKLOG_DEFAULT;
+	ipc_max_clients = IPC_CLIENTS_DEFAULT;
+	ipc_timeout     = IPC_TIMEOUT_DEFAULT;
 }
 
 /**
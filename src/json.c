@@ -0,0 +1,134 @@
+/*
+ * Streaming JSON writer
+ *
+ * Writes straight to the reply stream, no document is built in memory.
+ * Output is compact, one document per reply terminated by a newline.
+ * Nesting deeper than JSON_DEPTH is a programming error and is clamped.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include "defs.h"
+
+static void quote(FILE *fp, const char *str)
+{
+	const unsigned char *p = (const unsigned char *)str;
+
+	fputc('"', fp);
+	for (; *p; p++) {
+		switch (*p) {
+		case '"':
+		case '\\':
+			fputc('\\', fp);
+			fputc(*p, fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		case '\t':
+			fputs("\\t", fp);
+			break;
+		default:
+			if (*p < 0x20)
+				fprintf(fp, "\\u%04x", *p);
+			else
+				fputc(*p, fp);
+			break;
+		}
+	}
+	fputc('"', fp);
+}
+
+/* Separator and key, if inside an object, before every value */
+static void member(struct json *j, const char *key)
+{
+	if (j->count[j->depth]++)
+		fputc(',', j->fp);
+
+	if (j->depth > 0 && j->end[j->depth] == '}') {
+		quote(j->fp, key ? key : "");
+		fputc(':', j->fp);
+	}
+}
+
+static void nest(struct json *j, const char *key, char begin, char end)
+{
+	member(j, key);
+	fputc(begin, j->fp);
+
+	if (j->depth < JSON_DEPTH - 1)
+		j->depth++;
+	j->count[j->depth] = 0;
+	j->end[j->depth]   = end;
+}
+
+void json_init(struct json *j, FILE *fp)
+{
+	memset(j, 0, sizeof(*j));
+	j->fp = fp;
+}
+
+/* Close any open containers, returns non-zero on stream error */
+int json_end(struct json *j)
+{
+	while (j->depth > 0)
+		json_close(j);
+	fputc('\n', j->fp);
+
+	return ferror(j->fp);
+}
+
+void json_obj(struct json *j, const char *key)
+{
+	nest(j, key, '{', '}');
+}
+
+void json_arr(struct json *j, const char *key)
+{
+	nest(j, key, '[', ']');
+}
+
+void json_close(struct json *j)
+{
+	if (j->depth == 0)
+		return;
+
+	fputc(j->end[j->depth--], j->fp);
+}
+
+void json_str(struct json *j, const char *key, const char *val)
+{
+	if (!val) {
+		json_null(j, key);
+		return;
+	}
+
+	member(j, key);
+	quote(j->fp, val);
+}
+
+void json_int(struct json *j, const char *key, long long val)
+{
+	member(j, key);
+	fprintf(j->fp, "%lld", val);
+}
+
+void json_bool(struct json *j, const char *key, int val)
+{
+	member(j, key);
+	fputs(val ? "true" : "false", j->fp);
+}
+
+void json_null(struct json *j, const char *key)
+{
+	member(j, key);
+	fputs("null", j->fp);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
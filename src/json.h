@@ -0,0 +1,45 @@
+/*
+ * Streaming JSON writer, for structured IPC replies.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+#ifndef QUERIERD_JSON_H_
+#define QUERIERD_JSON_H_
+
+#include <stdio.h>
+
+#define JSON_DEPTH		8
+
+/*
+ * Values are written to the stream as they are added, only the nesting
+ * is tracked, to know where to put separators and how to close.  The
+ * key is ignored, and may be NULL, for array elements and top level.
+ */
+struct json {
+	FILE *fp;
+	int   depth;
+	int   count[JSON_DEPTH];	/* Members written at each level */
+	char  end[JSON_DEPTH];		/* '}' or ']' */
+};
+
+void json_init  (struct json *j, FILE *fp);
+int  json_end   (struct json *j);
+
+void json_obj   (struct json *j, const char *key);
+void json_arr   (struct json *j, const char *key);
+void json_close (struct json *j);
+
+void json_str   (struct json *j, const char *key, const char *val);
+void json_int   (struct json *j, const char *key, long long val);
+void json_bool  (struct json *j, const char *key, int val);
+void json_null  (struct json *j, const char *key);
+
+#endif /* QUERIERD_JSON_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -104,12 +104,16 @@ void k_set_if(int ifindex)
 
 
 /*
- * Join a multicast group.
+ * Join a multicast group.  Not on a virtual clock, the kernel would send
+ * membership reports for us.
  */
 void k_join(uint32_t grp, int ifindex)
 {
     struct ip_mreqn mreq = { 0 };
 
+    if (pev_is_virtual())
+	return;
+
     mreq.imr_multiaddr.s_addr = grp;
     mreq.imr_ifindex = ifindex;
 
@@ -138,6 +142,9 @@ void k_leave(uint32_t grp, int ifindex)
 {
     struct ip_mreqn mreq = { 0 };
 
+    if (pev_is_virtual())
+	return;
+
     mreq.imr_multiaddr.s_addr = grp;
     mreq.imr_ifindex = ifindex;
 
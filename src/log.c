@@ -5,10 +5,16 @@
 
 #define SYSLOG_NAMES
 #include "defs.h"
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
 
 #define LOG_MAX_MSGS	20	/* if > 20/minute then shut up for a while */
 #define LOG_SHUT_UP	600	/* shut up for 10 minutes */
+#define LOG_SUMMARY	60	/* interval for suppressed messages summary */
+#define LOG_SITES	128	/* max number of rate limited call sites */
+#define LOG_QUEUE_LEN	256	/* log writer queue, must be power of two */
+#define LOG_MSG_LEN	240
 
 #ifndef INTERNAL_NOPRI
 #define INTERNAL_NOPRI  0x10
@@ -30,8 +36,48 @@ CODE prionm[] =
 
 int loglevel = LOG_NOTICE;
 
+/*
+ * Per call site token bucket, the call site is identified by its format
+ * string.  The bucket holds LOG_MAX_MSGS tokens, in milli-tokens, and is
+ * refilled at LOG_MAX_MSGS per minute.  Each time a site drains its
+ * bucket the refill rate is halved, backing off exponentially up to
+ * LOG_SHUT_UP.  A full bucket resets the back-off.
+ */
+struct log_site {
+    const char *fmt;
+    uint64_t	last;		/* last refill, in msec */
+    uint32_t	tokens;
+    uint32_t	backoff;
+    uint32_t	suppressed;
+};
+
+/*
+ * Formatted log message, queued for the log writer thread.
+ */
+struct log_rec {
+    struct timeval tv;
+    int		severity;
+    char	msg[LOG_MSG_LEN];
+};
+
 static char *log_name = PACKAGE_NAME;
-static int log_nmsgs = 0;
+static struct log_site log_sites[LOG_SITES];
+
+/*
+ * Bounded lock-free queue, single producer (the event loop) and single
+ * consumer (the log writer thread).  When full, messages are dropped
+ * and counted, so IGMP timing never depends on logging backpressure.
+ */
+static struct log_rec log_queue[LOG_QUEUE_LEN];
+static uint32_t log_head;
+static uint32_t log_tail;
+static uint32_t log_dropped;
+static int log_running;
+static int log_child;
+static pthread_t log_thread;
+static sem_t log_sem;
+static int log_summary_id;
+static int log_summary_pending;
 
 
 int log_str2lvl(char *level)
@@ -74,67 +120,330 @@ int log_list(char *buf, size_t len)
     return 0;
 }
 
+static void log_write(struct log_rec *rec)
+{
+    struct tm thyme;
+
+    if (use_syslog) {
+	syslog(rec->severity, "%s", rec->msg);
+	return;
+    }
+
+    localtime_r(&rec->tv.tv_sec, &thyme);
+    fprintf(stderr, "%s: %02d:%02d:%02d.%03ld %s\n", log_name, thyme.tm_hour,
+	    thyme.tm_min, thyme.tm_sec, (long)rec->tv.tv_usec / 1000, rec->msg);
+}
+
+static void log_drain(void)
+{
+    uint32_t head, tail, num;
+
+    head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+    while (tail != head) {
+	log_write(&log_queue[tail & (LOG_QUEUE_LEN - 1)]);
+	__atomic_store_n(&log_tail, ++tail, __ATOMIC_RELEASE);
+    }
+
+    num = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (num) {
+	struct log_rec rec;
+
+	gettimeofday(&rec.tv, NULL);
+	rec.severity = LOG_WARNING;
+	snprintf(rec.msg, sizeof(rec.msg), "warning - %u log messages dropped, queue full", num);
+	log_write(&rec);
+    }
+}
+
+/*
+ * Log writer thread, the only one to call syslog() or write to stderr
+ * while the event loop is running.
+ */
+static void *log_writer(void *arg)
+{
+    while (1) {
+	while (sem_wait(&log_sem) && errno == EINTR)
+	    ;
+
+	log_drain();
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+	    break;
+    }
+    log_drain();
+
+    return NULL;
+}
+
+/*
+ * Reserve next free slot in queue, or NULL if full
+ */
+static struct log_rec *log_reserve(void)
+{
+    uint32_t head, tail;
+
+    head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= LOG_QUEUE_LEN) {
+	__atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+	return NULL;
+    }
+
+    return &log_queue[head & (LOG_QUEUE_LEN - 1)];
+}
+
+static void log_commit(void)
+{
+    __atomic_fetch_add(&log_head, 1, __ATOMIC_RELEASE);
+    sem_post(&log_sem);
+}
+
 /*
- * Open connection to syslog daemon and set initial log level
+ * Only the forking thread survives in a child, so the writer is gone,
+ * and it may have been inside syslog() holding its lock.  A child must
+ * not log at all, failures are reported to the parent instead.
+ */
+static void log_atfork(void)
+{
+    log_running = 0;
+    log_child   = 1;
+}
+
+/*
+ * Open connection to syslog daemon, set initial log level, and start
+ * the log writer thread.
  */
 void log_init(char *ident)
 {
+    sigset_t all, old;
+
     log_name = ident;
+    if (use_syslog) {
+	openlog(ident, LOG_PID, LOG_DAEMON);
+	setlogmask(LOG_UPTO(loglevel));
+    }
+
+    if (sem_init(&log_sem, 0, 0))
+	return;
+
+    /* All signals are handled by the event loop */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    log_running = !pthread_create(&log_thread, NULL, log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    pthread_atfork(NULL, NULL, log_atfork);
+}
+
+/*
+ * Flush queue and stop log writer thread, any log messages after this
+ * are written synchronously.
+ */
+void log_exit(void)
+{
+    if (!log_running)
+	return;
+
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+    sem_post(&log_sem);
+    pthread_join(log_thread, NULL);
+    sem_destroy(&log_sem);
+}
+
+
+static uint64_t log_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct log_site *log_site(const char *fmt)
+{
+    size_t i, hash;
+
+    hash = ((uintptr_t)fmt >> 3) % LOG_SITES;
+    for (i = 0; i < LOG_SITES; i++) {
+	struct log_site *site = &log_sites[(hash + i) % LOG_SITES];
+
+	if (site->fmt == fmt)
+	    return site;
+
+	if (!site->fmt) {
+	    site->fmt     = fmt;
+	    site->last    = log_msec();
+	    site->tokens  = LOG_MAX_MSGS * 1000;
+	    site->backoff = 1;
+	    return site;
+	}
+    }
+
+    return NULL;		/* Table full, no rate limiting */
+}
+
+/* Format and queue, or write, a message, no filtering */
+static void log_write_va(int severity, int syserr, const char *format, va_list ap)
+{
+    struct log_rec *rec, tmp;
+    int async;
+    size_t len;
+
+    /* Fatal errors are flushed and written synchronously */
+    if (severity <= LOG_ERR)
+	log_exit();
+
+    async = __atomic_load_n(&log_running, __ATOMIC_RELAXED);
+    rec = async ? log_reserve() : &tmp;
+    if (!rec)
+	return;
+
+    /* Only OK use-case for unsafe gettimeofday(), logging. */
     if (!use_syslog)
+	gettimeofday(&rec->tv, NULL);
+    rec->severity = severity;
+
+    len = 0;
+    if (severity == LOG_WARNING)
+	len = snprintf(rec->msg, sizeof(rec->msg), "warning - ");
+
+    vsnprintf(&rec->msg[len], sizeof(rec->msg) - len, format, ap);
+
+    if (syserr != 0) {
+	len = strlen(rec->msg);
+	snprintf(&rec->msg[len], sizeof(rec->msg) - len, ": %s", strerror(syserr));
+    }
+
+    if (async)
+	log_commit();
+    else
+	log_write(rec);
+
+    if (severity <= LOG_ERR)
+	exit(1);
+}
+
+/* Not rate limited, the summary is reported per call site */
+static void log_notice(const char *format, ...)
+{
+    va_list ap;
+
+    if (LOG_NOTICE > loglevel)
+	return;
+
+    va_start(ap, format);
+    log_write_va(LOG_NOTICE, 0, format, ap);
+    va_end(ap);
+}
+
+static void log_summary(int period, void *arg)
+{
+    size_t i;
+
+    log_summary_pending = 0;
+    for (i = 0; i < LOG_SITES; i++) {
+	struct log_site *site = &log_sites[i];
+	uint32_t num = site->suppressed;
+
+	if (!num)
+	    continue;
+
+	site->suppressed = 0;
+	log_notice("%u messages suppressed: \"%.60s\"", num, site->fmt);
+    }
+}
+
+/*
+ * Schedule the summary of suppressed messages.  Only possible from the
+ * event loop, before pev_init() or after pev_exit() counts accumulate
+ * and the next suppressed message tries again.
+ */
+static void log_summary_arm(void)
+{
+    int id;
+
+    if (log_summary_id > 0 && !pev_timer_set(log_summary_id, LOG_SUMMARY * 1000000)) {
+	log_summary_pending = 1;
+	return;
+    }
+
+    log_summary_id = 0;
+    if (!pev_running())
 	return;
 
-    openlog(ident, LOG_PID, LOG_DAEMON);
-    setlogmask(LOG_UPTO(loglevel));
+    id = pev_timer_add(LOG_SUMMARY * 1000000, 0, log_summary, NULL);
+    if (id <= 0)
+	return;
+
+    log_summary_id = id;
+    log_summary_pending = 1;
 }
 
+/*
+ * Returns non-zero if message should be dropped
+ */
+static int log_ratelimit(const char *fmt)
+{
+    struct log_site *site;
+    uint64_t now, max, add;
+
+    site = log_site(fmt);
+    if (!site)
+	return 0;
+
+    now = log_msec();
+    max = LOG_MAX_MSGS * 1000;
+    add = (now - site->last) * LOG_MAX_MSGS / 60 / site->backoff;
+    if (add > 0) {
+	site->tokens = MIN(max, site->tokens + add);
+	site->last   = now;
+    }
+    if (site->tokens == max)
+	site->backoff = 1;
+
+    if (site->tokens >= 1000) {
+	site->tokens -= 1000;
+	return 0;
+    }
+
+    if (!site->suppressed++ && site->backoff < LOG_SHUT_UP / 60)
+	site->backoff = MIN(site->backoff * 2, LOG_SHUT_UP / 60);
+
+    if (!log_summary_pending)
+	log_summary_arm();
+
+    return 1;
+}
 
 /*
  * Log errors and other messages to the system log daemon and to stderr,
  * according to the severity of the message and the current debug level.
  * For errors of severity LOG_ERR or worse, terminate the program.
+ *
+ * Messages between LOG_WARNING and LOG_INFO are rate limited per call
+ * site, see log_ratelimit(), so a log storm cannot starve the daemon.
+ * Messages are formatted here and queued for the log writer thread.
  */
 void logit(int severity, int syserr, const char *format, ...)
 {
     va_list ap;
-    static char fmt[211] = "warning - ";
-    char *msg;
-    struct timeval now;
-    time_t now_sec;
-    struct tm *thyme;
+
+    if (log_child) {
+	if (severity <= LOG_ERR)
+	    _exit(1);
+	return;
+    }
+
+    if (severity > loglevel && severity > LOG_ERR)
+	return;
+
+    if (severity > LOG_ERR && severity < LOG_DEBUG && log_ratelimit(format))
+	return;
 
     va_start(ap, format);
-    vsnprintf(&fmt[10], sizeof(fmt) - 10, format, ap);
+    log_write_va(severity, syserr, format, ap);
     va_end(ap);
-    msg = (severity == LOG_WARNING) ? fmt : &fmt[10];
-
-    if (!use_syslog) {
-	if (severity > loglevel)
-	    return;
-
-	/* Only OK use-case for unsafe gettimeofday(), logging. */
-	gettimeofday(&now, NULL);
-	now_sec = now.tv_sec;
-	thyme = localtime(&now_sec);
-//	if (!debug)
-	    fprintf(stderr, "%s: ", log_name);
-	fprintf(stderr, "%02d:%02d:%02d.%03ld %s", thyme->tm_hour,
-		thyme->tm_min, thyme->tm_sec, now.tv_usec / 1000, msg);
-	if (syserr == 0)
-	    fprintf(stderr, "\n");
-	else
-	    fprintf(stderr, ": %s\n", strerror(syserr));
-
-	goto end;
-    }
-
-    if (syserr != 0)
-	syslog(severity, "%s: %s", msg, strerror(syserr));
-    else
-	syslog(severity, "%s", msg);
-
-  end:
-    if (severity <= LOG_ERR)
-	exit(1);
 }
 
 /**
@@ -18,6 +18,8 @@ time_t querierd_init_time;
 char *config_file = NULL;
 char *pid_file    = NULL;
 char *sock_file   = NULL;
+char *sim_file    = NULL;
+char *replay_file = NULL;
 
 char *ident       = PACKAGE_NAME;
 char *prognm      = NULL;
@@ -56,7 +58,7 @@ static int compose_paths(void)
 
 static int usage(int code)
 {
-    printf("Usage: %s [-himnpsv] [-f FILE] [-i NAME] [-p FILE]\n"
+    printf("Usage: %s [-himnpsv] [-f FILE] [-i NAME] [-p FILE] [-R FILE] [-S FILE]\n"
 	   "\n"
 	   "  -f, --config=FILE        Configuration file to use, default ident: /etc/%s.conf\n"
 	   "  -h, --help               Show this help text\n"
@@ -64,7 +66,9 @@ static int usage(int code)
 	   "  -l, --loglevel=LEVEL     Set log level: none, err, notice (default), info, debug\n"
 	   "  -n, --foreground         Run in foreground, do not detach from controlling terminal\n"
 	   "  -p, --pidfile=FILE       File to store process ID for signaling daemon, default ident\n"
+	   "  -R, --replay=FILE[,IF]   Replay IGMP in pcap FILE on a virtual clock, in foreground\n"
 	   "  -s, --syslog             Log to syslog, default unless running in --foreground\n"
+	   "  -S, --simulate=FILE      Run scenario FILE on a virtual clock, in foreground\n"
 	   "  -u, --ipc=FILE           Override UNIX domain socket, default from identity, -i\n"
 	   "  -v, --version            Show %s version\n", prognm, ident, PACKAGE_NAME, prognm);
 
@@ -98,17 +102,20 @@ int main(int argc, char *argv[])
 	{ "loglevel",      1, 0, 'l' },
 	{ "foreground",    0, 0, 'n' },
 	{ "pidfile",       1, 0, 'p' },
+	{ "replay",        1, 0, 'R' },
 	{ "syslog",        0, 0, 's' },
+	{ "simulate",      1, 0, 'S' },
 	{ "ipc",           1, 0, 'u' },
 	{ "version",       0, 0, 'v' },
 	{ NULL, 0, 0, 0 }
     };
     int foreground = 0;
-    int i, ch;
+    int do_syslog = 0;
+    int i, ch, rc;
     FILE *fp;
 
     prognm = ident = progname(argv[0]);
-    while ((ch = getopt_long(argc, argv, "f:hi:l:np:su:v", long_options, NULL)) != EOF) {
+    while ((ch = getopt_long(argc, argv, "f:hi:l:np:R:sS:u:v", long_options, NULL)) != EOF) {
 	const char *errstr = NULL;
 
 	switch (ch) {
@@ -138,15 +145,24 @@ int main(int argc, char *argv[])
 
 	case 'n':
 	    foreground = 1;
-	    use_syslog--;
 	    break;
 
 	case 'p':	/* --pidfile=NAME */
 	    pid_file = strdup(optarg);
 	    break;
 
+	case 'R':	/* --replay=FILE[,IFNAME] */
+	    replay_file = optarg;
+	    foreground = 1;
+	    break;
+
 	case 's':	/* --syslog */
-	    use_syslog++;
+	    do_syslog = 1;
+	    break;
+
+	case 'S':	/* --simulate=FILE */
+	    sim_file = optarg;
+	    foreground = 1;
 	    break;
 
 	case 'u':
@@ -162,6 +178,9 @@ int main(int argc, char *argv[])
 	}
     }
 
+    /* Syslog unless in foreground, regardless of option order */
+    use_syslog = do_syslog || !foreground;
+
     /* Check for unsupported command line arguments */
     argc -= optind;
     if (argc > 0)
@@ -210,6 +229,11 @@ int main(int argc, char *argv[])
     compose_paths();
 
     pev_init();
+
+    /* Before igmp_init(), which neither listens nor sends on a virtual clock */
+    if (sim_file || replay_file)
+	pev_virtual(1);
+
     igmp_init();
     netlink_init();
     iface_init();
@@ -220,14 +244,32 @@ int main(int argc, char *argv[])
     pev_sig_add(SIGUSR1, handle_signals, NULL);
     pev_sig_add(SIGUSR2, handle_signals, NULL);
 
+    /* No IPC or other exports, nor PID file, when simulating */
+    if (sim_file) {
+	rc = sim_run(sim_file);
+	goto done;
+    }
+    if (replay_file) {
+	rc = replay_run(replay_file);
+	goto done;
+    }
+
     /* Open channel to for client(s) */
     ipc_init(sock_file);
+    metrics_init();
+    shm_init();
 
     /* Signal world we are now ready to start taking calls */
     if (pidfile(pid_file))
 	logit(LOG_WARNING, errno, "Cannot create pidfile");
 
-    return pev_run();
+    rc = pev_run();
+done:
+    free(pid_file);
+    free(config_file);
+    log_exit();
+
+    return rc;
 }
 
 static void cleanup(void)
@@ -241,6 +283,8 @@ static void cleanup(void)
 	igmp_exit();
 	netlink_exit();
 	ipc_exit();
+	metrics_exit();
+	shm_exit();
     }
 }
 
@@ -253,11 +297,7 @@ static void handle_signals(int signo, void *arg)
     switch (signo) {
 	case SIGINT:
 	case SIGTERM:
-	    logit(LOG_NOTICE, 0, "%s exiting", versionstring);
-	    cleanup();
-	    free(pid_file);
-	    free(config_file);
-	    pev_exit(0);
+	    quit(0);
 	    break;
 
 	case SIGHUP:
@@ -265,12 +305,25 @@ static void handle_signals(int signo, void *arg)
 	    break;
 
 	case SIGUSR1:
+	    trace_save();
+	    break;
+
 	case SIGUSR2:
 	    /* ignored for now */
 	    break;
     }
 }
 
+/*
+ * Stop the event loop, pev_run() returns status to main()
+ */
+void quit(int status)
+{
+    logit(LOG_NOTICE, 0, "%s exiting", versionstring);
+    cleanup();
+    pev_exit(status);
+}
+
 void restart(void)
 {
     /*
@@ -280,11 +333,16 @@ void restart(void)
     igmp_exit();
     netlink_exit();
     ipc_exit();
+    metrics_exit();
+    shm_exit();
+    pev_profile(0);
 
     igmp_init();
     netlink_init();
     iface_init();
     ipc_init(sock_file);
+    metrics_init();
+    shm_init();
 
     /* Touch PID file to acknowledge SIGHUP */
     pidfile(pid_file);
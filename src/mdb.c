@@ -0,0 +1,479 @@
+/*
+ * In-memory mirror of the bridge multicast database (MDB)
+ *
+ * Populated by an RTM_GETMDB dump at startup and kept up to date with
+ * RTNLGRP_MDB notifications, see netlink.c.  Entries are hashed on VLAN
+ * and group, so show commands are answered from memory instead of
+ * forking `bridge mdb show` for each IPC request.
+ *
+ * Multicast router ports, per bridge and VLAN, are also mirrored.  They
+ * come from the MDB dump and RTM_GETVLAN global VLAN options, and are
+ * kept up to date by RTNLGRP_MDB and RTNLGRP_BRVLAN notifications.
+ *
+ * Also keeps a small ifindex to name table of all links in the system,
+ * used to present port names, with the multicast attributes of bridge
+ * ports from the AF_BRIDGE link dump and notifications.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <linux/if_bridge.h>
+#include "defs.h"
+
+#define MDB_MASK	(MDB_BUCKETS - 1)
+
+static TAILQ_HEAD(, mdb_entry)  mdb[MDB_BUCKETS];
+static TAILQ_HEAD(, mdb_iface)  names[MDB_BUCKETS];
+static TAILQ_HEAD(, mdb_rtr)    routers = TAILQ_HEAD_INITIALIZER(routers);
+static size_t mdb_num;
+static int initialized;
+
+static void init(void)
+{
+	size_t i;
+
+	if (initialized)
+		return;
+
+	for (i = 0; i < MDB_BUCKETS; i++) {
+		TAILQ_INIT(&mdb[i]);
+		TAILQ_INIT(&names[i]);
+	}
+	initialized = 1;
+}
+
+static unsigned int hash(uint16_t vid, uint32_t group)
+{
+	return ((ntohl(group) * 2654435761U) ^ vid) & MDB_MASK;
+}
+
+static struct mdb_entry *find(int br, uint16_t vid, uint32_t group)
+{
+	struct mdb_entry *e;
+
+	TAILQ_FOREACH(e, &mdb[hash(vid, group)], me_link) {
+		if (e->me_br == br && e->me_vid == vid && e->me_group == group)
+			return e;
+	}
+
+	return NULL;
+}
+
+/*
+ * Add, or update, port for group in VLAN on bridge
+ */
+int mdb_add(int br, uint16_t vid, uint32_t group, int port, int state)
+{
+	struct mdb_entry *e;
+	struct mdb_port *p;
+
+	init();
+
+	e = find(br, vid, group);
+	if (!e) {
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return -1;
+
+		TAILQ_INIT(&e->me_ports);
+		e->me_br    = br;
+		e->me_vid   = vid;
+		e->me_group = group;
+		TAILQ_INSERT_TAIL(&mdb[hash(vid, group)], e, me_link);
+		mdb_num++;
+	}
+	state_gen++;
+
+	TAILQ_FOREACH(p, &e->me_ports, mp_link) {
+		if (p->mp_ifindex == port) {
+			p->mp_state = state;
+			return 0;
+		}
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -1;
+
+	p->mp_ifindex = port;
+	p->mp_state   = state;
+	TAILQ_INSERT_TAIL(&e->me_ports, p, mp_link);
+
+	return 0;
+}
+
+static void drop(struct mdb_entry *e)
+{
+	struct mdb_port *p, *tmp;
+
+	TAILQ_FOREACH_SAFE(p, &e->me_ports, mp_link, tmp) {
+		TAILQ_REMOVE(&e->me_ports, p, mp_link);
+		free(p);
+	}
+
+	TAILQ_REMOVE(&mdb[hash(e->me_vid, e->me_group)], e, me_link);
+	free(e);
+	mdb_num--;
+}
+
+/*
+ * Remove port from group in VLAN on bridge, the entry is removed with
+ * the last port.
+ */
+void mdb_del(int br, uint16_t vid, uint32_t group, int port)
+{
+	struct mdb_entry *e;
+	struct mdb_port *p;
+
+	init();
+
+	e = find(br, vid, group);
+	if (!e)
+		return;
+	state_gen++;
+
+	TAILQ_FOREACH(p, &e->me_ports, mp_link) {
+		if (p->mp_ifindex == port) {
+			TAILQ_REMOVE(&e->me_ports, p, mp_link);
+			free(p);
+			break;
+		}
+	}
+
+	if (TAILQ_EMPTY(&e->me_ports))
+		drop(e);
+}
+
+void mdb_flush(void)
+{
+	struct mdb_entry *e, *tmp;
+	struct mdb_rtr *r, *rtmp;
+	size_t i;
+
+	init();
+
+	for (i = 0; i < MDB_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(e, &mdb[i], me_link, tmp)
+			drop(e);
+	}
+
+	TAILQ_FOREACH_SAFE(r, &routers, mr_link, rtmp) {
+		TAILQ_REMOVE(&routers, r, mr_link);
+		free(r);
+	}
+	state_gen++;
+}
+
+/*
+ * Add, or update, router port.  The timer, in seconds, is only known
+ * from dumps, notifications only tell us the port is a router port.
+ * The kernel sends a notification also when the router port expires.
+ */
+int mdb_router_add(int br, uint16_t vid, int port, int type, int timer)
+{
+	struct mdb_rtr *r;
+
+	TAILQ_FOREACH(r, &routers, mr_link) {
+		if (r->mr_br == br && r->mr_vid == vid && r->mr_port == port)
+			break;
+	}
+
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r)
+			return -1;
+
+		r->mr_br   = br;
+		r->mr_vid  = vid;
+		r->mr_port = port;
+		TAILQ_INSERT_TAIL(&routers, r, mr_link);
+	}
+
+	if (type >= 0)
+		r->mr_type = type;
+	r->mr_expires = timer > 0 ? pev_now() + (uint64_t)timer * PEV_NSEC_PER_SEC : 0;
+	state_gen++;
+
+	logit(LOG_DEBUG, 0, "Found router port %s vid %d with %d s timeout", mdb_ifname(port),
+	      vid, timer);
+
+	return 0;
+}
+
+void mdb_router_del(int br, uint16_t vid, int port)
+{
+	struct mdb_rtr *r;
+
+	TAILQ_FOREACH(r, &routers, mr_link) {
+		if (r->mr_br == br && r->mr_vid == vid && r->mr_port == port) {
+			TAILQ_REMOVE(&routers, r, mr_link);
+			free(r);
+			state_gen++;
+			return;
+		}
+	}
+}
+
+/* Drop all router ports of a bridge VLAN, before reading a new list */
+void mdb_router_flush(int br, uint16_t vid)
+{
+	struct mdb_rtr *r, *tmp;
+
+	TAILQ_FOREACH_SAFE(r, &routers, mr_link, tmp) {
+		if (r->mr_br == br && r->mr_vid == vid) {
+			TAILQ_REMOVE(&routers, r, mr_link);
+			free(r);
+			state_gen++;
+		}
+	}
+}
+
+/*
+ * Nanoseconds until the first router port timer lapses, 0 if a timer
+ * is not known, e.g., the port came from a notification.  Returns -1
+ * if there are no router ports with a timer, i.e., only static ones.
+ */
+int64_t mdb_router_due(void)
+{
+	struct mdb_rtr *r;
+	uint64_t now;
+	int64_t due = -1;
+
+	now = pev_now();
+	TAILQ_FOREACH(r, &routers, mr_link) {
+		struct mdb_iface *mi;
+		int64_t left;
+
+		mi = mdb_iface_find(r->mr_port);
+		if (r->mr_type == MDB_RTR_TYPE_PERM ||
+		    (mi && mi->mi_prop[MDB_PORT_MCAST_ROUTER] == MDB_RTR_TYPE_PERM))
+			continue;
+
+		left = r->mr_expires > now ? (int64_t)(r->mr_expires - now) : 0;
+		if (due < 0 || left < due)
+			due = left;
+	}
+
+	return due;
+}
+
+struct mdb_rtr *mdb_router_iter(int first)
+{
+	static struct mdb_rtr *next = NULL;
+	struct mdb_rtr *r;
+
+	if (first)
+		r = TAILQ_FIRST(&routers);
+	else
+		r = next;
+
+	if (r)
+		next = TAILQ_NEXT(r, mr_link);
+
+	return r;
+}
+
+static int compare(const void *a, const void *b)
+{
+	const struct mdb_entry *x = *(const struct mdb_entry **)a;
+	const struct mdb_entry *y = *(const struct mdb_entry **)b;
+
+	if (x->me_vid != y->me_vid)
+		return x->me_vid - y->me_vid;
+	if (x->me_group != y->me_group)
+		return ntohl(x->me_group) < ntohl(y->me_group) ? -1 : 1;
+
+	return x->me_br - y->me_br;
+}
+
+/*
+ * Call cb for each entry, sorted on VLAN and group.  Stops and returns
+ * the return value of cb if non-zero.
+ */
+int mdb_foreach(int (*cb)(struct mdb_entry *, void *), void *arg)
+{
+	struct mdb_entry **arr, *e;
+	size_t i, num = 0;
+	int rc = 0;
+
+	init();
+	if (!mdb_num)
+		return 0;
+
+	arr = malloc(mdb_num * sizeof(*arr));
+	if (!arr)
+		return -1;
+
+	for (i = 0; i < MDB_BUCKETS; i++) {
+		TAILQ_FOREACH(e, &mdb[i], me_link)
+			arr[num++] = e;
+	}
+	qsort(arr, num, sizeof(*arr), compare);
+
+	for (i = 0; i < num && !rc; i++)
+		rc = cb(arr[i], arg);
+	free(arr);
+
+	return rc;
+}
+
+/*
+ * Print comma separated list of port names for entry
+ */
+void mdb_ports(FILE *fp, struct mdb_entry *e)
+{
+	struct mdb_port *p;
+	int num = 0;
+
+	TAILQ_FOREACH(p, &e->me_ports, mp_link)
+		fprintf(fp, "%s%s", num++ ? ", " : "", mdb_ifname(p->mp_ifindex));
+}
+
+size_t mdb_count(void)
+{
+	return mdb_num;
+}
+
+struct mdb_iface *mdb_iface_find(int ifindex)
+{
+	struct mdb_iface *mi;
+
+	init();
+
+	TAILQ_FOREACH(mi, &names[ifindex & MDB_MASK], mi_link) {
+		if (mi->mi_ifindex == ifindex)
+			return mi;
+	}
+
+	return NULL;
+}
+
+/*
+ * Called by netlink backend for every RTM_NEWLINK/RTM_DELLINK, the name
+ * is NULL for deleted links.
+ */
+void mdb_link(int ifindex, const char *ifname)
+{
+	struct mdb_iface *mi;
+
+	mi = mdb_iface_find(ifindex);
+	if (!ifname) {
+		if (mi) {
+			TAILQ_REMOVE(&names[ifindex & MDB_MASK], mi, mi_link);
+			free(mi);
+			state_gen++;
+		}
+		return;
+	}
+
+	if (!mi) {
+		mi = calloc(1, sizeof(*mi));
+		if (!mi)
+			return;
+		mi->mi_ifindex = ifindex;
+		TAILQ_INSERT_TAIL(&names[ifindex & MDB_MASK], mi, mi_link);
+	}
+	if (strcmp(mi->mi_ifname, ifname)) {
+		strlcpy(mi->mi_ifname, ifname, sizeof(mi->mi_ifname));
+		state_gen++;
+	}
+}
+
+/*
+ * Called by netlink backend for AF_BRIDGE link messages, i.e., bridge
+ * port dump replies and notifications.  A zero master means the link
+ * is no longer a bridge port.
+ */
+void mdb_brport(int ifindex, int master, const uint8_t *prop)
+{
+	struct mdb_iface *mi;
+
+	mi = mdb_iface_find(ifindex);
+	if (!mi)
+		return;
+
+	state_gen++;
+	mi->mi_master = master;
+	if (prop)
+		memcpy(mi->mi_prop, prop, sizeof(mi->mi_prop));
+	else
+		memset(mi->mi_prop, 0, sizeof(mi->mi_prop));
+}
+
+/*
+ * Call cb for each port of bridge, in no particular order.
+ */
+int mdb_brport_foreach(int br, int (*cb)(struct mdb_iface *, void *), void *arg)
+{
+	struct mdb_iface *mi;
+	size_t i;
+	int rc;
+
+	init();
+
+	for (i = 0; i < MDB_BUCKETS; i++) {
+		TAILQ_FOREACH(mi, &names[i], mi_link) {
+			if (!mi->mi_master || mi->mi_master != br)
+				continue;
+
+			rc = cb(mi, arg);
+			if (rc)
+				return rc;
+		}
+	}
+
+	return 0;
+}
+
+int mdb_ifindex(const char *ifname)
+{
+	struct mdb_iface *mi;
+	size_t i;
+
+	init();
+
+	for (i = 0; i < MDB_BUCKETS; i++) {
+		TAILQ_FOREACH(mi, &names[i], mi_link) {
+			if (!strcmp(mi->mi_ifname, ifname))
+				return mi->mi_ifindex;
+		}
+	}
+
+	return 0;
+}
+
+const char *mdb_ifname(int ifindex)
+{
+	static char buf[16];
+	struct mdb_iface *mi;
+
+	mi = mdb_iface_find(ifindex);
+	if (mi)
+		return mi->mi_ifname;
+
+	snprintf(buf, sizeof(buf), "if%d", ifindex);
+
+	return buf;
+}
+
+void mdb_exit(void)
+{
+	struct mdb_iface *mi, *tmp;
+	size_t i;
+
+	mdb_flush();
+	for (i = 0; i < MDB_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(mi, &names[i], mi_link, tmp) {
+			TAILQ_REMOVE(&names[i], mi, mi_link);
+			free(mi);
+		}
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
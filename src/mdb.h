@@ -0,0 +1,73 @@
+/*
+ * In-memory mirror of the bridge multicast database (MDB), kept in sync
+ * with the kernel using netlink, for IPC show commands.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+#ifndef QUERIERD_MDB_H_
+#define QUERIERD_MDB_H_
+
+#include <stdint.h>
+#include <net/if.h>
+#include "queue.h"
+
+#define MDB_BUCKETS		1024		/* Must be a power of two */
+
+struct mdb_port {
+	TAILQ_ENTRY(mdb_port) mp_link;
+	int		 mp_ifindex;
+	uint8_t		 mp_state;		/* MDB_TEMPORARY, MDB_PERMANENT */
+};
+
+/*
+ * One (bridge, VLAN, group) entry, hashed on VLAN and group, with the
+ * list of ports the group is forwarded to.
+ */
+struct mdb_entry {
+	TAILQ_ENTRY(mdb_entry) me_link;
+	TAILQ_HEAD(, mdb_port) me_ports;
+	int		 me_br;			/* bridge ifindex */
+	uint16_t	 me_vid;
+	uint32_t	 me_group;		/* network byte order */
+};
+
+enum {
+	MDB_PORT_FAST_LEAVE,			/* IFLA_BRPORT_FAST_LEAVE       */
+	MDB_PORT_MCAST_ROUTER,			/* IFLA_BRPORT_MULTICAST_ROUTER */
+	MDB_PORT_MCAST_FLOOD,			/* IFLA_BRPORT_MCAST_FLOOD      */
+	MDB_PORT_MAX
+};
+
+/*
+ * Any link in the system, for ifindex to name lookups.  For bridge
+ * ports also the bridge and the multicast port attributes.
+ */
+struct mdb_iface {
+	TAILQ_ENTRY(mdb_iface) mi_link;
+	int		 mi_ifindex;
+	char		 mi_ifname[IFNAMSIZ];
+	int		 mi_master;		/* bridge ifindex, 0: not a port */
+	uint8_t		 mi_prop[MDB_PORT_MAX];
+};
+
+/*
+ * Multicast router port, per bridge and VLAN (0 when not VLAN aware)
+ */
+struct mdb_rtr {
+	TAILQ_ENTRY(mdb_rtr) mr_link;
+	int		 mr_br;			/* bridge ifindex */
+	uint16_t	 mr_vid;
+	int		 mr_port;		/* port ifindex */
+	uint8_t		 mr_type;		/* MDB_RTR_TYPE_* */
+	uint64_t	 mr_expires;		/* pev_now() nsec, from dump, or 0 */
+};
+
+#endif /* QUERIERD_MDB_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
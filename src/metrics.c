@@ -0,0 +1,441 @@
+/*
+ * OpenMetrics exporter, for Prometheus and compatible agents
+ *
+ * Rendered on request from daemon state, no sampling or history.  The
+ * text is served over HTTP on an optional loopback TCP port, for local
+ * scrape agents, and with the IPC command 'show metrics'.
+ *
+ * The HTTP side is minimal: one request per connection, only GET and
+ * HEAD, the reply is always followed by close.  Like IPC clients, the
+ * request is read and the reply written as the socket is ready.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <fcntl.h>
+#include <stddef.h>
+#include "defs.h"
+
+#define METRICS_CLIENTS	8
+#define METRICS_TIMEOUT	5	/* sec, to send request */
+#define METRICS_TYPE	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct metrics_client {
+	TAILQ_ENTRY(metrics_client) link;
+	int    sd;
+	int    id;			/* pev id of socket */
+	int    timerid;
+
+	char   req[1024];
+	size_t reqlen;
+
+	char  *out;
+	size_t outlen;
+	size_t off;
+};
+
+static TAILQ_HEAD(, metrics_client) clients = TAILQ_HEAD_INITIALIZER(clients);
+static int num_clients;
+static int metrics_sockid =  0;
+static int metrics_socket = -1;
+
+int metrics_port = 0;
+
+/*
+ * Per-interface counters, one family per name, rows with the same name
+ * must follow each other.  Extra label is optional.
+ */
+static const struct {
+	const char *name;
+	const char *help;
+	const char *label;
+	const char *value;
+	size_t      offset;
+} counters[] = {
+	{ "rx_queries", "IGMP queries received", "version", "1", offsetof(struct ifi_stats, rx_query[0]) },
+	{ "rx_queries", NULL,                    "version", "2", offsetof(struct ifi_stats, rx_query[1]) },
+	{ "rx_queries", NULL,                    "version", "3", offsetof(struct ifi_stats, rx_query[2]) },
+	{ "rx_reports", "IGMP membership reports received", "version", "1", offsetof(struct ifi_stats, rx_report[0]) },
+	{ "rx_reports", NULL,                               "version", "2", offsetof(struct ifi_stats, rx_report[1]) },
+	{ "rx_reports", NULL,                               "version", "3", offsetof(struct ifi_stats, rx_report[2]) },
+	{ "rx_leaves",  "IGMPv2 leave messages received", NULL, NULL, offsetof(struct ifi_stats, rx_leave) },
+	{ "rx_errors",  "Malformed or truncated packets received", NULL, NULL, offsetof(struct ifi_stats, rx_errors) },
+	{ "tx_queries", "IGMP queries sent", "type", "general", offsetof(struct ifi_stats, tx_query) },
+	{ "tx_queries", NULL,                "type", "group",   offsetof(struct ifi_stats, tx_group_query) },
+	{ "tx_queries", NULL,                "type", "proxy",   offsetof(struct ifi_stats, tx_proxy_query) },
+	{ "tx_errors",  "Send failures", NULL, NULL, offsetof(struct ifi_stats, tx_errors) },
+	{ "tx_dropped", "Packets dropped, send queue full", NULL, NULL, offsetof(struct ifi_stats, tx_dropped) },
+	{ "elections",  "Querier elections", "result", "won",  offsetof(struct ifi_stats, elect_won) },
+	{ "elections",  NULL,                "result", "lost", offsetof(struct ifi_stats, elect_lost) },
+	{ "querier_timeouts", "Other querier timed out", NULL, NULL, offsetof(struct ifi_stats, querier_timeout) },
+	{ "group_events", "Group membership changes", "event", "add",    offsetof(struct ifi_stats, group_add) },
+	{ "group_events", NULL,                       "event", "leave",  offsetof(struct ifi_stats, group_leave) },
+	{ "group_events", NULL,                       "event", "expire", offsetof(struct ifi_stats, group_expire) },
+};
+
+/* Label values may contain any character but these */
+static void label(FILE *fp, const char *val)
+{
+	for (; *val; val++) {
+		if (*val == '"' || *val == '\\')
+			fputc('\\', fp);
+		if (*val == '\n')
+			fputs("\\n", fp);
+		else
+			fputc(*val, fp);
+	}
+}
+
+static void family(FILE *fp, const char *name, const char *type, const char *help)
+{
+	fprintf(fp, "# TYPE querierd_%s %s\n", name, type);
+	fprintf(fp, "# HELP querierd_%s %s.\n", name, help);
+}
+
+static void sample(FILE *fp, const char *name, const char *suffix, struct ifi *ifi,
+		   const char *key, const char *val)
+{
+	fprintf(fp, "querierd_%s%s{iface=\"", name, suffix);
+	label(fp, ifi->ifi_name);
+	if (key) {
+		fprintf(fp, "\",%s=\"", key);
+		label(fp, val);
+	}
+	fputs("\"} ", fp);
+}
+
+static int ifversion(struct ifi *ifi)
+{
+	if (ifi->ifi_flags & IFIF_IGMPV1)
+		return 1;
+	if (ifi->ifi_flags & IFIF_IGMPV2)
+		return 2;
+
+	return 3;
+}
+
+static void ifaces(FILE *fp)
+{
+	struct ifi *ifi;
+
+	family(fp, "iface_up", "gauge", "Interface is up and enabled");
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		sample(fp, "iface_up", "", ifi, NULL, NULL);
+		fprintf(fp, "%d\n", !(ifi->ifi_flags & (IFIF_DOWN | IFIF_DISABLED)));
+	}
+
+	family(fp, "querier", "gauge", "This system is the elected querier");
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		sample(fp, "querier", "", ifi, NULL, NULL);
+		fprintf(fp, "%d\n", !!(ifi->ifi_flags & IFIF_QUERIER));
+	}
+
+	family(fp, "igmp_version", "gauge", "IGMP version of interface");
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		sample(fp, "igmp_version", "", ifi, NULL, NULL);
+		fprintf(fp, "%d\n", ifversion(ifi));
+	}
+
+	family(fp, "groups", "gauge", "Group memberships learned");
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		struct listaddr *g;
+		int num = 0;
+
+		TAILQ_FOREACH(g, &ifi->ifi_groups, al_link)
+			num++;
+
+		sample(fp, "groups", "", ifi, NULL, NULL);
+		fprintf(fp, "%d\n", num);
+	}
+
+	for (size_t i = 0; i < NELEMS(counters); i++) {
+		if (counters[i].help)
+			family(fp, counters[i].name, "counter", counters[i].help);
+
+		for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+			uint64_t val = *(uint64_t *)((char *)&ifi->ifi_stats + counters[i].offset);
+
+			sample(fp, counters[i].name, "_total", ifi, counters[i].label, counters[i].value);
+			fprintf(fp, "%llu\n", (unsigned long long)val);
+		}
+	}
+}
+
+static void loop(FILE *fp)
+{
+	struct pev_stats st;
+
+	pev_stats(&st);
+
+	family(fp, "timers", "gauge", "Active timers");
+	fprintf(fp, "querierd_timers %d\n", st.timers);
+	family(fp, "sockets", "gauge", "Active sockets");
+	fprintf(fp, "querierd_sockets %d\n", st.socks);
+
+	family(fp, "loop_iterations", "counter", "Event loop iterations");
+	fprintf(fp, "querierd_loop_iterations_total %llu\n", st.loops);
+	family(fp, "loop_busy_seconds", "counter", "Time spent in event callbacks");
+	fprintf(fp, "querierd_loop_busy_seconds_total %.9f\n", st.busy / 1e9);
+	family(fp, "loop_busy_max_seconds", "gauge", "Longest event loop iteration");
+	fprintf(fp, "querierd_loop_busy_max_seconds %.9f\n", st.busy_max / 1e9);
+
+	family(fp, "timer_callbacks", "counter", "Timer callbacks called");
+	fprintf(fp, "querierd_timer_callbacks_total %llu\n", st.timer_runs);
+	family(fp, "timer_lateness_seconds", "counter", "Time from timer expiry to callback");
+	fprintf(fp, "querierd_timer_lateness_seconds_total %.9f\n", st.timer_late / 1e9);
+	family(fp, "timer_lateness_max_seconds", "gauge", "Longest time from timer expiry to callback");
+	fprintf(fp, "querierd_timer_lateness_max_seconds %.9f\n", st.timer_late_max / 1e9);
+}
+
+/*
+ * All metrics in OpenMetrics text format, also used for 'show metrics'
+ */
+int metrics_write(FILE *fp)
+{
+	family(fp, "build", "info", "Daemon version");
+	fprintf(fp, "querierd_build_info{version=\"%s\"} 1\n", PACKAGE_VERSION);
+
+	ifaces(fp);
+	loop(fp);
+	fputs("# EOF\n", fp);
+
+	return ferror(fp);
+}
+
+static void metrics_free(struct metrics_client *c)
+{
+	TAILQ_REMOVE(&clients, c, link);
+	num_clients--;
+
+	pev_sock_del(c->id);
+	pev_timer_del(c->timerid);
+	shutdown(c->sd, SHUT_RDWR);
+	close(c->sd);
+	free(c->out);
+	free(c);
+}
+
+static void metrics_writable(int sd, void *arg)
+{
+	struct metrics_client *c = (struct metrics_client *)arg;
+
+	while (c->off < c->outlen) {
+		ssize_t num;
+
+		num = send(sd, c->out + c->off, c->outlen - c->off, MSG_NOSIGNAL);
+		if (num == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			logit(LOG_DEBUG, errno, "Failed sending metrics");
+			break;
+		}
+		c->off += num;
+	}
+
+	metrics_free(c);
+}
+
+/*
+ * Status line, headers, and for GET the body.  The request line is all
+ * we look at, headers are ignored.
+ */
+static int metrics_reply(struct metrics_client *c)
+{
+	const char *status = "200 OK";
+	char *body = NULL, path[64];
+	size_t bodylen = 0;
+	char method[8];
+	FILE *fp;
+	int rc;
+
+	if (sscanf(c->req, "%7s %63s", method, path) != 2)
+		status = "400 Bad Request";
+	else if (strcmp(method, "GET") && strcmp(method, "HEAD"))
+		status = "405 Method Not Allowed";
+	else if (strcmp(path, "/metrics") && strcmp(path, "/"))
+		status = "404 Not Found";
+	else {
+		fp = open_memstream(&body, &bodylen);
+		if (!fp)
+			return -1;
+		rc = metrics_write(fp);
+		if (fclose(fp) || rc) {
+			free(body);
+			return -1;
+		}
+		if (!strcmp(method, "HEAD"))
+			body[0] = 0;
+	}
+
+	fp = open_memstream(&c->out, &c->outlen);
+	if (!fp) {
+		free(body);
+		return -1;
+	}
+	fprintf(fp, "HTTP/1.0 %s\r\n", status);
+	fprintf(fp, "Content-Type: %s\r\n", body ? METRICS_TYPE : "text/plain");
+	fprintf(fp, "Content-Length: %zu\r\n", bodylen);
+	fprintf(fp, "Connection: close\r\n\r\n");
+	if (body)
+		fputs(body, fp);
+	free(body);
+
+	return fclose(fp);
+}
+
+static void metrics_readable(int sd, void *arg)
+{
+	struct metrics_client *c = (struct metrics_client *)arg;
+	size_t room = sizeof(c->req) - 1 - c->reqlen;
+	ssize_t len;
+
+	len = read(sd, c->req + c->reqlen, room);
+	if (len == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		metrics_free(c);
+		return;
+	}
+	if (len == 0) {
+		metrics_free(c);
+		return;
+	}
+
+	c->reqlen += len;
+	c->req[c->reqlen] = 0;
+	if ((size_t)len < room && !strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n"))
+		return;
+
+	if (metrics_reply(c)) {
+		logit(LOG_WARNING, errno, "Failed rendering metrics");
+		metrics_free(c);
+		return;
+	}
+
+	pev_sock_mod(c->id, PEV_WRITE);
+	metrics_writable(sd, c);
+}
+
+static void metrics_idle(int timeout, void *arg)
+{
+	(void)timeout;
+	metrics_free((struct metrics_client *)arg);
+}
+
+static void metrics_accept(int sd, void *arg)
+{
+	struct metrics_client *c;
+	int client;
+
+	(void)arg;
+
+	while ((client = accept(sd, NULL, NULL)) != -1) {
+		if (num_clients >= METRICS_CLIENTS) {
+			logit(LOG_INFO, 0, "Too many metrics clients, max %d", METRICS_CLIENTS);
+			close(client);
+			continue;
+		}
+
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			logit(LOG_WARNING, errno, "Failed allocating metrics client");
+			close(client);
+			continue;
+		}
+		c->sd = client;
+
+		c->id = pev_sock_add_events(client, PEV_READ, metrics_readable, metrics_writable, c);
+		if (c->id == -1) {
+			logit(LOG_WARNING, errno, "Failed registering metrics client");
+			close(client);
+			free(c);
+			continue;
+		}
+
+		c->timerid = pev_timer_add(METRICS_TIMEOUT * 1000000, 0, metrics_idle, c);
+		if (c->timerid == -1) {
+			logit(LOG_WARNING, errno, "Failed creating metrics client timer");
+			pev_sock_del(c->id);
+			close(client);
+			free(c);
+			continue;
+		}
+
+		TAILQ_INSERT_TAIL(&clients, c, link);
+		num_clients++;
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		logit(LOG_WARNING, errno, "Failed accepting metrics client");
+}
+
+/*
+ * Listen on loopback only, the metrics are not for the network.  Does
+ * nothing unless metrics-port is set in the .conf file.
+ */
+void metrics_init(void)
+{
+	struct sockaddr_in sin;
+	int sd, on = 1;
+
+	if (!metrics_port)
+		return;
+
+	sd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sd < 0) {
+		logit(LOG_WARNING, errno, "Failed creating metrics socket");
+		return;
+	}
+
+	(void)fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+	(void)setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_port        = htons(metrics_port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(sd, (struct sockaddr *)&sin, sizeof(sin)) || listen(sd, METRICS_CLIENTS)) {
+		logit(LOG_WARNING, errno, "Failed binding metrics to port %d, disabled", metrics_port);
+		close(sd);
+		return;
+	}
+
+	metrics_sockid = pev_sock_add(sd, metrics_accept, NULL);
+	if (metrics_sockid == -1) {
+		logit(LOG_WARNING, errno, "Failed registering metrics handler");
+		close(sd);
+		return;
+	}
+
+	logit(LOG_DEBUG, 0, "Serving metrics on 127.0.0.1:%d", metrics_port);
+	metrics_socket = sd;
+}
+
+/* Close all connections and the listening socket, reset the port */
+void metrics_exit(void)
+{
+	struct metrics_client *c, *tmp;
+
+	TAILQ_FOREACH_SAFE(c, &clients, link, tmp)
+		metrics_free(c);
+
+	if (metrics_sockid > 0)
+		pev_sock_del(metrics_sockid);
+	if (metrics_socket > -1)
+		close(metrics_socket);
+
+	metrics_socket = -1;
+	metrics_sockid = 0;
+	metrics_port   = 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
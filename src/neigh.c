@@ -0,0 +1,201 @@
+/*
+ * Neighbour (ARP) and bridge FDB caches
+ *
+ * Populated by RTM_GETNEIGH dumps at startup and kept up to date by
+ * RTNLGRP_NEIGH notifications, see netlink.c.  Used to resolve the MAC
+ * address of a querier, hashed on IP address, and the bridge port the
+ * MAC was learned on, hashed on MAC address.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <net/ethernet.h>
+#include "defs.h"
+
+#define NEIGH_BUCKETS	256		/* Must be a power of two */
+#define NEIGH_MASK	(NEIGH_BUCKETS - 1)
+
+struct neigh {
+	TAILQ_ENTRY(neigh) link;
+	uint32_t addr;
+	int      ifindex;
+	uint8_t  mac[ETH_ALEN];
+};
+
+struct fdb {
+	TAILQ_ENTRY(fdb) link;
+	uint8_t  mac[ETH_ALEN];
+	uint16_t vid;
+	int      port;
+	int      master;		/* bridge ifindex, 0 for self entries */
+};
+
+static TAILQ_HEAD(, neigh) neighs[NEIGH_BUCKETS];
+static TAILQ_HEAD(, fdb)   fdbs[NEIGH_BUCKETS];
+static int initialized;
+
+static void init(void)
+{
+	size_t i;
+
+	if (initialized)
+		return;
+
+	for (i = 0; i < NEIGH_BUCKETS; i++) {
+		TAILQ_INIT(&neighs[i]);
+		TAILQ_INIT(&fdbs[i]);
+	}
+	initialized = 1;
+}
+
+static unsigned int hash_addr(uint32_t addr)
+{
+	return (ntohl(addr) * 2654435761U) >> 24 & NEIGH_MASK;
+}
+
+static unsigned int hash_mac(const uint8_t *mac)
+{
+	return (mac[3] ^ mac[4] << 3 ^ mac[5]) & NEIGH_MASK;
+}
+
+/*
+ * Add, update, or with mac NULL remove, neighbour
+ */
+void neigh_update(uint32_t addr, int ifindex, const uint8_t *mac)
+{
+	struct neigh *n;
+
+	init();
+
+	TAILQ_FOREACH(n, &neighs[hash_addr(addr)], link) {
+		if (n->addr == addr && n->ifindex == ifindex)
+			break;
+	}
+
+	if (!mac) {
+		if (n) {
+			TAILQ_REMOVE(&neighs[hash_addr(addr)], n, link);
+			free(n);
+		}
+		return;
+	}
+
+	if (!n) {
+		n = calloc(1, sizeof(*n));
+		if (!n) {
+			logit(LOG_WARNING, errno, "Failed allocating neighbour cache entry");
+			return;
+		}
+		n->addr    = addr;
+		n->ifindex = ifindex;
+		TAILQ_INSERT_TAIL(&neighs[hash_addr(addr)], n, link);
+	}
+	memcpy(n->mac, mac, ETH_ALEN);
+}
+
+/*
+ * Add, update, or with del set remove, FDB entry
+ */
+void neigh_fdb_update(const uint8_t *mac, uint16_t vid, int port, int master, int del)
+{
+	struct fdb *f;
+
+	init();
+
+	TAILQ_FOREACH(f, &fdbs[hash_mac(mac)], link) {
+		if (!memcmp(f->mac, mac, ETH_ALEN) && f->vid == vid && f->port == port)
+			break;
+	}
+
+	if (del) {
+		if (f) {
+			TAILQ_REMOVE(&fdbs[hash_mac(mac)], f, link);
+			free(f);
+		}
+		return;
+	}
+
+	if (!f) {
+		f = calloc(1, sizeof(*f));
+		if (!f) {
+			logit(LOG_WARNING, errno, "Failed allocating FDB cache entry");
+			return;
+		}
+		memcpy(f->mac, mac, ETH_ALEN);
+		f->vid  = vid;
+		f->port = port;
+		TAILQ_INSERT_TAIL(&fdbs[hash_mac(mac)], f, link);
+	}
+	f->master = master;
+}
+
+/*
+ * Find MAC address of IP address, returns 0 if found
+ */
+int neigh_lookup(uint32_t addr, uint8_t *mac)
+{
+	struct neigh *n;
+
+	init();
+
+	TAILQ_FOREACH(n, &neighs[hash_addr(addr)], link) {
+		if (n->addr == addr) {
+			memcpy(mac, n->mac, ETH_ALEN);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Find bridge port MAC address was learned on, returns ifindex of port
+ * or 0 if not found.  Entries learned by the bridge are preferred.
+ */
+int neigh_fdb_lookup(const uint8_t *mac)
+{
+	struct fdb *f;
+	int port = 0;
+
+	init();
+
+	TAILQ_FOREACH(f, &fdbs[hash_mac(mac)], link) {
+		if (memcmp(f->mac, mac, ETH_ALEN))
+			continue;
+
+		if (f->master)
+			return f->port;
+		if (!port)
+			port = f->port;
+	}
+
+	return port;
+}
+
+void neigh_flush(void)
+{
+	struct neigh *n, *ntmp;
+	struct fdb *f, *ftmp;
+	size_t i;
+
+	init();
+
+	for (i = 0; i < NEIGH_BUCKETS; i++) {
+		TAILQ_FOREACH_SAFE(n, &neighs[i], link, ntmp) {
+			TAILQ_REMOVE(&neighs[i], n, link);
+			free(n);
+		}
+		TAILQ_FOREACH_SAFE(f, &fdbs[i], link, ftmp) {
+			TAILQ_REMOVE(&fdbs[i], f, link);
+			free(f);
+		}
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -1,94 +1,836 @@
 
 #include <string.h>
+#include <poll.h>
+#include <net/ethernet.h>
 #include <netinet/in.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <linux/if_bridge.h>
+#include <linux/if_ether.h>
+#include <linux/neighbour.h>
 #include <net/if.h>
 #include "defs.h"
 
+#define NETLINK_BUFSZ	32768	/* Max size of one netlink message batch */
+#define NETLINK_BATCH	8	/* Max number of batches per recvmmsg()  */
+#define NETLINK_BUDGET	16	/* Max recvmmsg() calls per socket event */
+#define NETLINK_TMO	1000	/* msec, max wait for next dump batch    */
+#define NETLINK_RESYNC	100000	/* usec, coalesce overruns before resync */
+
+enum {
+    NL_EVENT = 0,		/* Netlink notification, act on changes  */
+    NL_POPULATE,		/* Initial dump, only record kernel state */
+    NL_RESYNC,			/* Dump after overrun, also mark seen     */
+};
+
 static int id;
 static int sd;
+static int busy;
+static int mode;
+static int resync_id;
 
+/* Bridge FDB, neighbors, and MDB, only for show, see netlink_init() */
+static int cache_id;
+static int cache_sd = -1;
+static int cache_resync_id;
+static int rports_id;
+static uint32_t seq;
 
-static void netlink_read(int sd, void *arg)
+static char buffers[NETLINK_BATCH][NETLINK_BUFSZ];
+static struct iovec iov[NETLINK_BATCH];
+static struct mmsghdr msgs[NETLINK_BATCH];
+
+static void netlink_resync(int timeout, void *arg);
+static void netlink_cache_resync(int timeout, void *arg);
+static void netlink_rports_later(void);
+
+/*
+ * Bridge port, with IFLA_PROTINFO carrying the IFLA_BRPORT_* attributes
+ */
+static void netlink_brport(struct nlmsghdr *nlh)
 {
-    char buffer[4096];
-    ssize_t len;
-
-    while ((len = recv(sd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
-	struct nlmsghdr *nlh = (struct nlmsghdr *)buffer;
-
-        while ((NLMSG_OK(nlh, len)) && (nlh->nlmsg_type != NLMSG_DONE)) {
-            if (nlh->nlmsg_type == RTM_NEWADDR || nlh->nlmsg_type == RTM_DELADDR) {
-                struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nlh);
-                struct rtattr *rth = IFA_RTA(ifa);
-                int rtl = IFA_PAYLOAD(nlh);
-
-                while (rtl && RTA_OK(rth, rtl)) {
-                    if (rth->rta_type == IFA_LOCAL) {
-			struct in_addr *ina = (struct in_addr *)RTA_DATA(rth);
-			struct sockaddr_in sin = { 0 };
-			int flags;
-
-			flags = IFF_UP | IFF_MULTICAST;
-			sin.sin_family = ifa->ifa_family;
-			sin.sin_addr = *ina;
-
-			if (nlh->nlmsg_type == RTM_NEWADDR)
-			    config_iface_addr_add(ifa->ifa_index, (struct sockaddr *)&sin, flags);
-			else
-			    config_iface_addr_del(ifa->ifa_index, (struct sockaddr *)&sin);
-                    }
-
-                    rth = RTA_NEXT(rth, rtl);
-                }
-            }
-
-            if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
-                struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
-
-		if (nlh->nlmsg_type == RTM_NEWLINK) {
-		    if (!config_find_iface(ifi->ifi_index))
-			iface_add(ifi->ifi_index, ifi->ifi_flags);
-		    else
-			iface_check(ifi->ifi_index, ifi->ifi_flags);
-		} else
-		    iface_del(ifi->ifi_index, ifi->ifi_flags);
+    struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+    struct rtattr *rth = IFLA_RTA(ifi);
+    int rtl = IFLA_PAYLOAD(nlh);
+    uint8_t prop[MDB_PORT_MAX] = { 0 };
+    int master = 0;
+
+    if (nlh->nlmsg_type == RTM_DELLINK) {
+	mdb_brport(ifi->ifi_index, 0, NULL);
+	return;
+    }
+
+    for (; RTA_OK(rth, rtl); rth = RTA_NEXT(rth, rtl)) {
+	struct rtattr *attr;
+	int alen;
+
+	if (rth->rta_type == IFLA_MASTER) {
+	    master = *(uint32_t *)RTA_DATA(rth);
+	    continue;
+	}
+	if ((rth->rta_type & NLA_TYPE_MASK) != IFLA_PROTINFO)
+	    continue;
+
+	alen = RTA_PAYLOAD(rth);
+	for (attr = RTA_DATA(rth); RTA_OK(attr, alen); attr = RTA_NEXT(attr, alen)) {
+	    switch (attr->rta_type) {
+	    case IFLA_BRPORT_FAST_LEAVE:
+		prop[MDB_PORT_FAST_LEAVE] = *(uint8_t *)RTA_DATA(attr);
+		break;
+
+	    case IFLA_BRPORT_MULTICAST_ROUTER:
+		prop[MDB_PORT_MCAST_ROUTER] = *(uint8_t *)RTA_DATA(attr);
+		break;
+
+	    case IFLA_BRPORT_MCAST_FLOOD:
+		prop[MDB_PORT_MCAST_FLOOD] = *(uint8_t *)RTA_DATA(attr);
+		break;
 	    }
+	}
+    }
+
+    /* The bridge itself, with VLANs, has no IFLA_PROTINFO */
+    if (master && master != ifi->ifi_index)
+	mdb_brport(ifi->ifi_index, master, prop);
+}
+
+static void netlink_link(struct nlmsghdr *nlh)
+{
+    struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nlh);
+    struct rtattr *rth = IFLA_RTA(ifi);
+    int rtl = IFLA_PAYLOAD(nlh);
+    uint8_t *mac = NULL;
+    char *ifname = NULL;
+
+    /* Bridge port events, not the link itself */
+    if (ifi->ifi_family == AF_BRIDGE) {
+	netlink_brport(nlh);
+	return;
+    }
+
+    if (nlh->nlmsg_type == RTM_DELLINK) {
+	mdb_link(ifi->ifi_index, NULL);
+	iface_del(ifi->ifi_index, ifi->ifi_flags);
+	return;
+    }
+
+    while (rtl && RTA_OK(rth, rtl)) {
+	switch (rth->rta_type) {
+	case IFLA_IFNAME:
+	    ifname = (char *)RTA_DATA(rth);
+	    break;
+
+	case IFLA_ADDRESS:
+	    if (RTA_PAYLOAD(rth) == ETH_ALEN)
+		mac = (uint8_t *)RTA_DATA(rth);
+	    break;
+	}
+
+	rth = RTA_NEXT(rth, rtl);
+    }
 
-	    nlh = NLMSG_NEXT(nlh, len);
-        }
+    if (!ifname)
+	return;
+
+    mdb_link(ifi->ifi_index, ifname);
+    if (mode == NL_POPULATE) {
+	struct ifi *ifp;
+
+	ifp = config_iface_link(ifi->ifi_index, ifname, mac);
+	if (!ifp)
+	    return;
+
+	if (ifi->ifi_flags & IFF_UP)
+	    ifp->ifi_flags &= ~IFIF_DOWN;
+	else
+	    ifp->ifi_flags |= IFIF_DOWN;
+	return;
     }
+
+    if (!config_find_iface(ifi->ifi_index))
+	iface_add(ifi->ifi_index, ifname, ifi->ifi_flags, mac);
+    else
+	iface_link(ifi->ifi_index, ifi->ifi_flags);
+
+    if (mode == NL_RESYNC)
+	config_iface_seen(ifi->ifi_index, 0);
 }
 
-void netlink_init(void)
+static void netlink_addr(struct nlmsghdr *nlh)
+{
+    struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nlh);
+    struct rtattr *rth = IFA_RTA(ifa);
+    int rtl = IFA_PAYLOAD(nlh);
+
+    if (ifa->ifa_family != AF_INET)
+	return;
+
+    while (rtl && RTA_OK(rth, rtl)) {
+	if (rth->rta_type == IFA_LOCAL) {
+	    struct in_addr *ina = (struct in_addr *)RTA_DATA(rth);
+	    struct sockaddr_in sin = { 0 };
+	    int flags;
+
+	    flags = IFF_UP | IFF_MULTICAST;
+	    sin.sin_family = ifa->ifa_family;
+	    sin.sin_addr = *ina;
+
+	    if (nlh->nlmsg_type == RTM_DELADDR)
+		config_iface_addr_del(ifa->ifa_index, (struct sockaddr *)&sin);
+	    else if (mode == NL_POPULATE)
+		config_iface_addr_set(ifa->ifa_index, (struct sockaddr *)&sin, flags);
+	    else
+		config_iface_addr_add(ifa->ifa_index, (struct sockaddr *)&sin, flags);
+
+	    if (mode == NL_RESYNC && nlh->nlmsg_type == RTM_NEWADDR)
+		config_iface_seen(ifa->ifa_index, ina->s_addr);
+	}
+
+	rth = RTA_NEXT(rth, rtl);
+    }
+}
+
+/*
+ * Router ports, nested MDBA_ROUTER_PORT attributes, each a u32 ifindex
+ * followed by MDBA_ROUTER_PATTR_* attributes.  Used both in the MDB and
+ * in the global VLAN options, where 'vid' is given by the caller.
+ */
+static void netlink_rports(struct nlmsghdr *nlh, int br, uint16_t vid, struct rtattr *rta)
+{
+    struct rtattr *port;
+    int len = RTA_PAYLOAD(rta);
+
+    for (port = RTA_DATA(rta); RTA_OK(port, len); port = RTA_NEXT(port, len)) {
+	struct rtattr *attr;
+	int alen, type = -1, timer = 0;
+	uint16_t pvid = vid;
+	uint32_t ifindex;
+
+	if (port->rta_type != MDBA_ROUTER_PORT || RTA_PAYLOAD(port) < sizeof(uint32_t))
+	    continue;
+
+	memcpy(&ifindex, RTA_DATA(port), sizeof(ifindex));
+	alen = RTA_PAYLOAD(port) - RTA_ALIGN(sizeof(uint32_t));
+	attr = (struct rtattr *)((char *)RTA_DATA(port) + RTA_ALIGN(sizeof(uint32_t)));
+	for (; RTA_OK(attr, alen); attr = RTA_NEXT(attr, alen)) {
+	    switch (attr->rta_type) {
+	    case MDBA_ROUTER_PATTR_TIMER:	/* centiseconds */
+		timer = *(uint32_t *)RTA_DATA(attr) / 100;
+		break;
+
+	    case MDBA_ROUTER_PATTR_TYPE:
+		type = *(uint8_t *)RTA_DATA(attr);
+		break;
+
+	    case MDBA_ROUTER_PATTR_VID:
+		pvid = *(uint16_t *)RTA_DATA(attr);
+		break;
+	    }
+	}
+
+	if (nlh->nlmsg_type == RTM_DELMDB)
+	    mdb_router_del(br, pvid, ifindex);
+	else if (mdb_router_add(br, pvid, ifindex, type, timer))
+	    logit(LOG_WARNING, errno, "Failed allocating router port");
+    }
+
+    netlink_rports_later();
+}
+
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+/*
+ * Global VLAN options, only for VLAN aware bridges with per-VLAN
+ * multicast snooping, which have router ports per VLAN.
+ */
+static void netlink_vlan(struct nlmsghdr *nlh)
+{
+    struct br_vlan_msg *bvm = (struct br_vlan_msg *)NLMSG_DATA(nlh);
+    struct rtattr *rta = (struct rtattr *)((char *)bvm + NLMSG_ALIGN(sizeof(*bvm)));
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*bvm));
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	struct rtattr *opt;
+	uint16_t vid = 0;
+	int olen;
+
+	if (rta->rta_type != BRIDGE_VLANDB_GLOBAL_OPTIONS)
+	    continue;
+
+	/* The list of router ports is complete, none if no nest */
+	olen = RTA_PAYLOAD(rta);
+	for (opt = RTA_DATA(rta); RTA_OK(opt, olen); opt = RTA_NEXT(opt, olen)) {
+	    if (opt->rta_type == BRIDGE_VLANDB_GOPTS_ID) {
+		vid = *(uint16_t *)RTA_DATA(opt);
+		mdb_router_flush(bvm->ifindex, vid);
+	    } else if (opt->rta_type == BRIDGE_VLANDB_GOPTS_MCAST_ROUTER_PORTS)
+		netlink_rports(nlh, bvm->ifindex, vid, opt);
+	}
+    }
+}
+#endif
+
+/*
+ * ARP (AF_INET) and bridge FDB (AF_BRIDGE) entries
+ */
+static void netlink_neigh(struct nlmsghdr *nlh)
+{
+    struct ndmsg *ndm = (struct ndmsg *)NLMSG_DATA(nlh);
+    struct rtattr *rta = (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof(*ndm)));
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+    uint8_t *mac = NULL;
+    uint32_t addr = 0;
+    uint16_t vid = 0;
+    int master = 0;
+
+    if (len < 0)
+	return;
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	switch (rta->rta_type) {
+	case NDA_DST:
+	    if (RTA_PAYLOAD(rta) == sizeof(addr))
+		memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+	    break;
+
+	case NDA_LLADDR:
+	    if (RTA_PAYLOAD(rta) == ETH_ALEN)
+		mac = RTA_DATA(rta);
+	    break;
+
+	case NDA_VLAN:
+	    vid = *(uint16_t *)RTA_DATA(rta);
+	    break;
+
+	case NDA_MASTER:
+	    master = *(uint32_t *)RTA_DATA(rta);
+	    break;
+	}
+    }
+
+    if (ndm->ndm_family == AF_BRIDGE) {
+	if (mac)
+	    neigh_fdb_update(mac, vid, ndm->ndm_ifindex, master, nlh->nlmsg_type == RTM_DELNEIGH);
+	return;
+    }
+
+    if (ndm->ndm_family != AF_INET || !addr)
+	return;
+
+    if (nlh->nlmsg_type == RTM_DELNEIGH || (ndm->ndm_state & (NUD_FAILED | NUD_INCOMPLETE)))
+	mac = NULL;
+    else if (!mac)
+	return;		/* e.g., NUD_PROBE update, keep what we have */
+
+    neigh_update(addr, ndm->ndm_ifindex, mac);
+}
+
+/*
+ * Bridge MDB entries, only IPv4 (*,G) are mirrored.  A dump reply has
+ * many entries, a notification only one.
+ */
+static void netlink_mdb(struct nlmsghdr *nlh)
+{
+    struct br_port_msg *bpm = (struct br_port_msg *)NLMSG_DATA(nlh);
+    struct rtattr *rta = (struct rtattr *)((char *)bpm + NLMSG_ALIGN(sizeof(*bpm)));
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*bpm));
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	struct rtattr *ent;
+	int elen;
+
+	if (rta->rta_type == MDBA_ROUTER) {
+	    netlink_rports(nlh, bpm->ifindex, 0, rta);
+	    continue;
+	}
+	if (rta->rta_type != MDBA_MDB)
+	    continue;
+
+	elen = RTA_PAYLOAD(rta);
+	for (ent = RTA_DATA(rta); RTA_OK(ent, elen); ent = RTA_NEXT(ent, elen)) {
+	    struct rtattr *inf;
+	    int ilen;
+
+	    if (ent->rta_type != MDBA_MDB_ENTRY)
+		continue;
+
+	    ilen = RTA_PAYLOAD(ent);
+	    for (inf = RTA_DATA(ent); RTA_OK(inf, ilen); inf = RTA_NEXT(inf, ilen)) {
+		struct br_mdb_entry *e = RTA_DATA(inf);
+		struct rtattr *attr;
+		int alen, sg = 0;
+
+		if (inf->rta_type != MDBA_MDB_ENTRY_INFO || RTA_PAYLOAD(inf) < sizeof(*e))
+		    continue;
+		if (e->addr.proto != htons(ETH_P_IP))
+		    continue;
+
+		/* Skip (S,G) entries, only used for IGMPv3 */
+		alen = RTA_PAYLOAD(inf) - RTA_ALIGN(sizeof(*e));
+		attr = (struct rtattr *)((char *)e + RTA_ALIGN(sizeof(*e)));
+		for (; RTA_OK(attr, alen); attr = RTA_NEXT(attr, alen)) {
+		    if (attr->rta_type == MDBA_MDB_EATTR_SOURCE)
+			sg = 1;
+		}
+		if (sg)
+		    continue;
+
+		if (nlh->nlmsg_type == RTM_DELMDB)
+		    mdb_del(bpm->ifindex, e->vid, e->addr.u.ip4, e->ifindex);
+		else if (mdb_add(bpm->ifindex, e->vid, e->addr.u.ip4, e->ifindex, e->state))
+		    logit(LOG_WARNING, errno, "Failed allocating MDB entry");
+	    }
+	}
+    }
+}
+
+/*
+ * Parse one batch of netlink messages, returns 1 when the reply to our
+ * dump request, 'req', is done, -1 on error, and 0 otherwise.
+ */
+static int netlink_parse(char *buf, ssize_t len, uint32_t req)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+
+    for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+	int ours = req && nlh->nlmsg_seq == req;
+
+	switch (nlh->nlmsg_type) {
+	case NLMSG_DONE:
+	    if (ours) {
+		if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+		    logit(LOG_DEBUG, 0, "Netlink dump interrupted, state changed during dump");
+		return 1;
+	    }
+	    break;
+
+	case NLMSG_ERROR:
+	    if (ours) {
+		struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+
+		errno = -err->error;
+		return -1;
+	    }
+	    break;
+
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+	    netlink_link(nlh);
+	    break;
+
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+	    netlink_addr(nlh);
+	    break;
+
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+	    netlink_neigh(nlh);
+	    break;
+
+	case RTM_GETMDB:	/* dump reply */
+	case RTM_NEWMDB:
+	case RTM_DELMDB:
+	    netlink_mdb(nlh);
+	    break;
+
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+	case RTM_NEWVLAN:
+	    netlink_vlan(nlh);
+	    break;
+#endif
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Kernel dropped notifications, socket buffer overrun, or we truncated
+ * a message.  Our view of interfaces and addresses, or of the bridge
+ * caches, depending on the socket, may now be stale, so schedule a
+ * resync.  Overruns usually come in storms, so the timer is not rearmed
+ * if already pending.
+ */
+static void netlink_overrun(int sock)
+{
+    void (*cb)(int, void *) = netlink_resync;
+    int *timer = &resync_id;
+
+    if (sock == cache_sd) {
+	cb    = netlink_cache_resync;
+	timer = &cache_resync_id;
+    }
+
+    if (*timer <= 0) {
+	*timer = pev_timer_add(NETLINK_RESYNC, 0, cb, NULL);
+	if (*timer < 0)
+	    logit(LOG_WARNING, errno, "Failed scheduling netlink resync");
+	return;
+    }
+
+    if (pev_timer_get(*timer) <= 0)
+	pev_timer_set(*timer, NETLINK_RESYNC);
+}
+
+/*
+ * Read up to NETLINK_BATCH messages in one system call and parse them,
+ * returns -1 on error or when nothing more to read, or the result from
+ * netlink_parse() of any message matching our request, 'req'.
+ */
+static int netlink_recv(int sock, uint32_t req)
+{
+    int i, num, rc = 0;
+
+    for (i = 0; i < NETLINK_BATCH; i++) {
+	iov[i].iov_base = buffers[i];
+	iov[i].iov_len  = sizeof(buffers[i]);
+	memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+	msgs[i].msg_hdr.msg_iov    = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    num = recvmmsg(sock, msgs, NETLINK_BATCH, MSG_DONTWAIT, NULL);
+    if (num == -1) {
+	if (errno == ENOBUFS) {
+	    logit(LOG_NOTICE, 0, "Netlink socket overrun, lost %s events, resyncing.",
+		  sock == cache_sd ? "bridge" : "interface");
+	    netlink_overrun(sock);
+	}
+	return -1;
+    }
+
+    for (i = 0; i < num; i++) {
+	int ret;
+
+	if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+	    logit(LOG_NOTICE, 0, "Truncated netlink message, resyncing.");
+	    netlink_overrun(sock);
+	    continue;
+	}
+
+	ret = netlink_parse(buffers[i], msgs[i].msg_len, req);
+	if (ret)
+	    rc = ret;
+    }
+
+    return rc;
+}
+
+static void netlink_read(int sd, void *arg)
+{
+    int budget = NETLINK_BUDGET;
+
+    /* Any remaining messages are handled in the next loop iteration */
+    busy = 1;
+    while (budget-- > 0 && netlink_recv(sd, 0) != -1)
+	;
+    busy = 0;
+}
+
+/* Bridge caches are dumped on their own socket, see netlink_init() */
+static int socket_for(int type)
+{
+    switch (type) {
+    case RTM_GETNEIGH:
+    case RTM_GETMDB:
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+    case RTM_GETVLAN:
+#endif
+	return cache_sd;
+    }
+
+    return sd;
+}
+
+/*
+ * Request a dump of all links, addresses, or MDB entries, on our
+ * (already subscribed) socket and process the reply before return.
+ * Any interleaved notifications are processed in the same way.  The
+ * 'how' argument is one of NL_EVENT, NL_POPULATE, or NL_RESYNC.
+ */
+static int dump(int type, int family, int how)
+{
+    struct {
+	struct nlmsghdr  nlh;
+	union {				/* first member is family */
+	    struct rtgenmsg    rtg;
+	    struct ndmsg       ndm;
+	    struct br_port_msg bpm;
+	    struct br_vlan_msg bvm;
+	};
+	char             attr[RTA_SPACE(sizeof(uint32_t))];
+    } req;
+    struct rtattr *rta;
+    int sock = socket_for(type);
+    uint32_t flags;
+    int rc = 0;
+
+    /* Called while parsing, from a callback of an event */
+    if (busy) {
+	netlink_overrun(sock);
+	errno = EBUSY;
+	return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len   = NLMSG_LENGTH(sizeof(req.rtg));
+    req.nlh.nlmsg_type  = type;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq   = ++seq;
+    req.rtg.rtgen_family = family;
+
+    switch (type) {
+    case RTM_GETNEIGH:		/* FDB dump requires exactly ndmsg */
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ndm));
+	break;
+
+    case RTM_GETMDB:
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.bpm));
+	break;
+
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+    case RTM_GETVLAN:		/* attribute follows br_vlan_msg, not the union */
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.bvm));
+	rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nlh.nlmsg_len));
+	rta->rta_type     = BRIDGE_VLANDB_DUMP_FLAGS;
+	rta->rta_len      = RTA_LENGTH(sizeof(flags));
+	flags             = BRIDGE_VLANDB_DUMPF_GLOBAL;
+	memcpy(RTA_DATA(rta), &flags, sizeof(flags));
+	req.nlh.nlmsg_len = NLMSG_ALIGN(req.nlh.nlmsg_len) + rta->rta_len;
+	break;
+#endif
+    }
+
+    if (send(sock, &req, req.nlh.nlmsg_len, 0) == -1) {
+	logit(LOG_WARNING, errno, "Failed sending netlink dump request");
+	return -1;
+    }
+
+    busy = 1;
+    mode = how;
+    while (!rc) {
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+
+	int num;
+
+	rc = netlink_recv(sock, req.nlh.nlmsg_seq);
+	if (rc != -1)
+	    continue;
+
+	if (errno == EINTR) {
+	    rc = 0;
+	    continue;
+	}
+	if (errno != EAGAIN)
+	    break;
+
+	num = poll(&pfd, 1, NETLINK_TMO);
+	if (num > 0 || (num == -1 && errno == EINTR))
+	    rc = 0;
+	else if (!num)
+	    errno = ETIMEDOUT;
+    }
+    mode = NL_EVENT;
+    busy = 0;
+
+    if (rc < 0) {
+	/* Per-VLAN router ports are optional, kernels before 5.13 lack them */
+	if (type == RTM_GETVLAN && errno == EOPNOTSUPP)
+	    logit(LOG_DEBUG, 0, "No per-VLAN multicast router ports in this kernel");
+	else
+	    logit(LOG_WARNING, errno, "Failed reading netlink dump");
+	return -1;
+    }
+
+    return 0;
+}
+
+int netlink_dump(int type, int family, int init)
+{
+    return dump(type, family, init ? NL_POPULATE : NL_EVENT);
+}
+
+/*
+ * Incremental resync after overrun.  Dump links and addresses, act on
+ * any changes like for regular events, and mark everything seen.  Then
+ * drop interfaces and addresses we did not see, i.e., missed RTM_DEL*.
+ */
+static void netlink_resync(int timeout, void *arg)
+{
+    logit(LOG_DEBUG, 0, "Resyncing interface state with kernel");
+
+    config_iface_mark();
+    if (dump(RTM_GETLINK, AF_UNSPEC, NL_RESYNC) || dump(RTM_GETADDR, AF_UNSPEC, NL_RESYNC)) {
+	netlink_overrun(sd);	/* retry later, don't sweep partial result */
+	return;
+    }
+    config_iface_sweep();
+
+    /* Bridge port attributes are link events, on this socket */
+    dump(RTM_GETLINK, AF_BRIDGE, NL_RESYNC);
+}
+
+/*
+ * Overrun on the bridge cache socket.  The caches are only for show,
+ * so simply reload them.
+ */
+static void netlink_cache_resync(int timeout, void *arg)
+{
+    logit(LOG_DEBUG, 0, "Resyncing bridge caches with kernel");
+
+    neigh_flush();
+    dump(RTM_GETNEIGH, AF_INET, NL_RESYNC);
+    dump(RTM_GETNEIGH, AF_BRIDGE, NL_RESYNC);
+    mdb_flush();
+    dump(RTM_GETMDB, AF_BRIDGE, NL_RESYNC);
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+    dump(RTM_GETVLAN, AF_BRIDGE, NL_RESYNC);
+#endif
+}
+
+/*
+ * The kernel notifies when a router port is added or expires, but not
+ * when a query refreshes its timer, and notifications have no timer.
+ * Re-read router ports when the first timer in our mirror lapses, or
+ * is not known, so show commands present the remaining time.
+ */
+static void netlink_rports_refresh(int timeout, void *arg)
+{
+    dump(RTM_GETMDB, AF_BRIDGE, NL_EVENT);
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+    dump(RTM_GETVLAN, AF_BRIDGE, NL_EVENT);
+#endif
+}
+
+static void netlink_rports_later(void)
+{
+    int64_t due;
+
+    due = mdb_router_due();
+    if (due < 0)
+	return;		/* No timers, a pending refresh is harmless */
+    if (due < PEV_NSEC_PER_SEC)
+	due = PEV_NSEC_PER_SEC;
+
+    if (rports_id <= 0) {
+	rports_id = pev_timer_add_ns(due, 0, netlink_rports_refresh, NULL);
+	if (rports_id < 0)
+	    logit(LOG_WARNING, errno, "Failed scheduling router port refresh");
+	return;
+    }
+
+    pev_timer_set_ns(rports_id, due);
+}
+
+/*
+ * Our view of an interface was found to be wrong, e.g., send failed on
+ * a link we believe is up.  Resync on a timer, like after an overrun.
+ */
+void netlink_resync_later(void)
+{
+    netlink_overrun(sd);
+}
+
+/*
+ * Set netlink socket receive buffer, in KiB.  Try SO_RCVBUFFORCE first
+ * to override net.core.rmem_max, we usually have CAP_NET_ADMIN.
+ */
+static void set_rcvbuf(int sock, int kib)
+{
+    int val = kib * 1024;
+
+    if (!setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)))
+	return;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)))
+	logit(LOG_WARNING, errno, "Failed setting netlink receive buffer to %d KiB", kib);
+}
+
+void netlink_set_rcvbuf(int kib)
+{
+    set_rcvbuf(sd, kib);
+    if (cache_sd != -1)
+	set_rcvbuf(cache_sd, kib);
+}
+
+static int netlink_open(unsigned int groups, void (*cb)(int, void *), int *sid)
 {
     struct sockaddr_nl addr;
+    int sock;
 
-    sd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
-    if (sd == -1) {
+    sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock == -1) {
 	logit(LOG_ERR, errno, "Failed opening NETLINK socket");
-	return;
+	return -1;
     }
 
     memset(&addr, 0, sizeof(addr));
     addr.nl_family = AF_NETLINK;
-    addr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_LINK;
-    if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    addr.nl_groups = groups;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
 	logit(LOG_ERR, errno, "Failed binding NETLINK socket");
-	close(sd);
-        return;
+	close(sock);
+	return -1;
     }
 
-    id = pev_sock_add(sd, netlink_read, NULL);
-    if (id == -1)
+    set_rcvbuf(sock, NETLINK_RCVBUF_DEFAULT);
+
+    *sid = pev_sock_add(sock, cb, NULL);
+    if (*sid == -1)
 	logit(LOG_ERR, errno, "Failed registering NETLINK handler");
+
+    return sock;
+}
+
+/*
+ * Link and address events drive the protocol, bridge FDB, neighbor,
+ * and MDB events are only cached for show commands.  The latter churn
+ * a lot on a busy bridge, so they have their own socket, and receive
+ * buffer, to not cause overruns, and resyncs, of the former.
+ */
+void netlink_init(void)
+{
+    int grp = RTNLGRP_MDB;
+
+    sd = netlink_open(RTMGRP_IPV4_IFADDR | RTMGRP_LINK, netlink_read, &id);
+    if (sd == -1)
+	return;
+
+    cache_sd = netlink_open(RTMGRP_NEIGH, netlink_read, &cache_id);
+    if (cache_sd == -1)
+	return;
+
+    /* No legacy RTMGRP_ bit for MDB notifications */
+    if (setsockopt(cache_sd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &grp, sizeof(grp)))
+	logit(LOG_WARNING, errno, "Failed subscribing to bridge MDB events");
+#ifdef BRIDGE_VLANDB_DUMPF_GLOBAL
+    /* Nor for VLANs, global VLAN options carry the per-VLAN router ports */
+    grp = RTNLGRP_BRVLAN;
+    if (setsockopt(cache_sd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &grp, sizeof(grp)))
+	logit(LOG_WARNING, errno, "Failed subscribing to bridge VLAN events");
+#endif
 }
 
 void netlink_exit(void)
 {
+    if (resync_id > 0)
+	pev_timer_del(resync_id);
+    resync_id = 0;
+    if (cache_resync_id > 0)
+	pev_timer_del(cache_resync_id);
+    cache_resync_id = 0;
+    if (rports_id > 0)
+	pev_timer_del(rports_id);
+    rports_id = 0;
+
     pev_sock_del(id);
     close(sd);
+    pev_sock_del(cache_id);
+    close(cache_sd);
+    cache_sd = -1;
+
+    mdb_exit();
+    neigh_flush();
 }
 
 /**
@@ -10,5 +10,7 @@
 #define _PATH_QUERIERD_CONF	SYSCONFDIR   "/%s.conf"
 #define _PATH_QUERIERD_RUNDIR	RUNSTATEDIR
 #define _PATH_QUERIERD_SOCK	RUNSTATEDIR  "/%s.sock"
+#define _PATH_QUERIERD_TRACE	RUNSTATEDIR  "/%s.trace"
+#define _PATH_QUERIERD_SHM	RUNSTATEDIR  "/%s.shm"
 
 #endif /* QUERIERD_PATHNAMES_H_ */
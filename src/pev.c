@@ -1,6 +1,7 @@
 /* This is free and unencumbered software released into the public domain. */
 
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
@@ -28,17 +29,26 @@ struct pev {
 		int sd;
 		int signo;
 		struct {
-			int timeout;
-			int period;
-			struct timespec expiry;
+			int64_t  timeout;	/* nsec */
+			int64_t  period;	/* nsec */
+			uint64_t expiry;	/* CLOCK_MONOTONIC nsec */
 		};
 	};
 
+	int events;			/* PEV_READ | PEV_WRITE */
+
 	void (*cb)(int, void *);
+	void (*cb_wr)(int, void *);
 	void (*cb_del)(void *);
 	void *arg;
+
+	const char *name;		/* For profiling, NULL if internal */
+	const char *name_wr;
 };
 
+#define PEV_HIST_MAX   64		/* Profiled callbacks, power of two */
+#define PEV_HIST_MIN   10		/* log2 of lowest bucket, 1024 nsec */
+
 struct pev *pl;
 
 static int events[2];
@@ -46,10 +56,186 @@ static int max_fdnum = -1;
 static int id = 1;
 static int running;
 static int status;
+static uint64_t now;			/* Cached, see pev_now() */
+static int virtual;			/* Virtual clock, see pev_virtual() */
+static struct pev_stats stats;
 
-static struct pev *pev_new  (int type, void (*cb)(int, void *), void *arg);
+static int profiling;
+static struct pev_hist loop_hist = { "loop", PEV_HIST_LOOP, 0, 0, 0, { 0 } };
+static struct pev_hist late_hist = { "timer lateness", PEV_HIST_LATENESS, 0, 0, 0, { 0 } };
+static struct pev_hist hist[PEV_HIST_MAX];
+static void (*hist_key[PEV_HIST_MAX])(int, void *);
+
+static struct pev *pev_new  (int type, void (*cb)(int, void *), void *arg, const char *name);
 static struct pev *pev_find (int type, int signo);
 
+static unsigned long long ts2ns(struct timespec *ts)
+{
+	return (unsigned long long)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts2ns(&ts);
+}
+
+/*
+ * Read once per loop iteration, when select() returns, so everything
+ * done in the same iteration agrees on the time.
+ */
+uint64_t pev_now(void)
+{
+	return now;
+}
+
+/****************************** PROFILING *****************************/
+
+static int hist_index(unsigned long long val)
+{
+	int exp, idx;
+
+	if (val < (1ULL << PEV_HIST_MIN))
+		return 0;
+
+	exp = 63 - __builtin_clzll(val);
+	idx = 1 + (exp - PEV_HIST_MIN) * 4 + (int)((val >> (exp - 2)) & 3);
+	if (idx >= PEV_HIST_BUCKETS)
+		idx = PEV_HIST_BUCKETS - 1;
+
+	return idx;
+}
+
+static void hist_add(struct pev_hist *h, unsigned long long val)
+{
+	h->count++;
+	h->sum += val;
+	if (val > h->max)
+		h->max = val;
+	h->bucket[hist_index(val)]++;
+}
+
+/*
+ * Histogram of callback, found by function address.  Callbacks beyond
+ * what fits are not profiled.
+ */
+static struct pev_hist *hist_find(void (*cb)(int, void *), const char *name, int type)
+{
+	unsigned int i = ((unsigned long)cb >> 4) & (PEV_HIST_MAX - 1);
+
+	for (int n = 0; n < PEV_HIST_MAX; n++, i = (i + 1) & (PEV_HIST_MAX - 1)) {
+		if (hist_key[i] == cb)
+			return &hist[i];
+		if (hist_key[i])
+			continue;
+
+		hist_key[i]   = cb;
+		hist[i].name = name;
+		hist[i].type = type;
+		return &hist[i];
+	}
+
+	return NULL;
+}
+
+/* All callbacks are called here, time them when profiling */
+static void dispatch(struct pev *entry, void (*cb)(int, void *), const char *name, int type, int val)
+{
+	unsigned long long start;
+	struct pev_hist *h;
+
+	if (!profiling || !name) {
+		cb(val, entry->arg);
+		return;
+	}
+
+	start = now_ns();
+	cb(val, entry->arg);
+
+	h = hist_find(cb, name, type);
+	if (h)
+		hist_add(h, now_ns() - start);
+}
+
+int pev_profile(int enable)
+{
+	int prev = profiling;
+
+	profiling = enable;
+
+	return prev;
+}
+
+int pev_profiling(void)
+{
+	return profiling;
+}
+
+void pev_hist_reset(void)
+{
+	memset(hist, 0, sizeof(hist));
+	memset(hist_key, 0, sizeof(hist_key));
+	memset(loop_hist.bucket, 0, sizeof(loop_hist.bucket));
+	loop_hist.count = loop_hist.sum = loop_hist.max = 0;
+	memset(late_hist.bucket, 0, sizeof(late_hist.bucket));
+	late_hist.count = late_hist.sum = late_hist.max = 0;
+}
+
+/* Loop and lateness first, then callbacks that have been called */
+int pev_hist_foreach(int (*cb)(const struct pev_hist *, void *), void *arg)
+{
+	int rc;
+
+	rc = cb(&loop_hist, arg);
+	if (!rc)
+		rc = cb(&late_hist, arg);
+
+	for (int i = 0; !rc && i < PEV_HIST_MAX; i++) {
+		if (hist_key[i] && hist[i].count)
+			rc = cb(&hist[i], arg);
+	}
+
+	return rc;
+}
+
+/* Upper bound of bucket, in nsec */
+unsigned long long pev_hist_upper(int bucket)
+{
+	int exp, sub;
+
+	if (bucket <= 0)
+		return 1ULL << PEV_HIST_MIN;
+
+	exp = (bucket - 1) / 4 + PEV_HIST_MIN;
+	sub = (bucket - 1) % 4;
+
+	return (unsigned long long)(5 + sub) << (exp - 2);
+}
+
+/* Upper bound of the bucket holding the given percentile, or max */
+unsigned long long pev_hist_pct(const struct pev_hist *h, int pct)
+{
+	unsigned long long sum = 0, want;
+
+	if (!h->count)
+		return 0;
+
+	want = (h->count * pct + 99) / 100;
+	for (int i = 0; i < PEV_HIST_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= want) {
+			unsigned long long upper = pev_hist_upper(i);
+
+			return upper < h->max ? upper : h->max;
+		}
+	}
+
+	return h->max;
+}
+
 /******************************* SIGNALS ******************************/
 
 static void sig_handler(int signo)
@@ -62,7 +248,7 @@ static void sig_handler(int signo)
 	}
 }
 
-int pev_sig_add(int signo, void (*cb)(int, void *), void *arg)
+int pev_sig_add_name(int signo, void (*cb)(int, void *), void *arg, const char *name)
 {
 	struct sigaction sa = { 0 };
 	struct pev *entry;
@@ -72,7 +258,7 @@ int pev_sig_add(int signo, void (*cb)(int, void *), void *arg)
 		return -1;
 	}
 
-	entry = pev_new(PEV_SIG, cb, arg);
+	entry = pev_new(PEV_SIG, cb, arg, name);
 	if (!entry)
 		return -1;
 
@@ -120,25 +306,36 @@ static int nfds(void)
 	return max_fdnum + 1;
 }
 
-static void sock_run(fd_set *fds)
+static void sock_run(fd_set *rfds, fd_set *wfds)
 {
 	struct pev *entry;
 
-	FD_ZERO(fds);
+	FD_ZERO(rfds);
+	FD_ZERO(wfds);
 	for (entry = pl; entry; entry = entry->next) {
-		if (entry->type != PEV_SOCK)
+		if (entry->type != PEV_SOCK || !entry->active)
 			continue;
 
-		FD_SET(entry->sd, fds);
+		if (entry->events & PEV_READ)
+			FD_SET(entry->sd, rfds);
+		if (entry->events & PEV_WRITE)
+			FD_SET(entry->sd, wfds);
 	}
 }
 
-int pev_sock_add(int sd, void (*cb)(int, void *), void *arg)
+int pev_sock_add_name(int sd, void (*cb)(int, void *), void *arg, const char *name)
+{
+	return pev_sock_add_events_name(sd, PEV_READ, cb, NULL, arg, name, NULL);
+}
+
+int pev_sock_add_events_name(int sd, int events, void (*rd)(int, void *),
+			     void (*wr)(int, void *), void *arg,
+			     const char *rdname, const char *wrname)
 {
 	struct pev *entry;
 	int rc;
 
-	if (sd < 0) {
+	if (sd < 0 || (!rd && !wr)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -146,15 +343,26 @@ int pev_sock_add(int sd, void (*cb)(int, void *), void *arg)
 	rc = fcntl(sd, F_GETFD);
 	if (rc == -1)
 		return -1;
-	rc = fcntl(sd, F_SETFD, rc | O_CLOEXEC | O_NONBLOCK);
+	rc = fcntl(sd, F_SETFD, rc | FD_CLOEXEC);
 	if (rc == -1)
 		return -1;
 
-	entry = pev_new(PEV_SOCK, cb, arg);
+	rc = fcntl(sd, F_GETFL);
+	if (rc == -1)
+		return -1;
+	rc = fcntl(sd, F_SETFL, rc | O_NONBLOCK);
+	if (rc == -1)
+		return -1;
+
+	entry = pev_new(PEV_SOCK, rd ? rd : wr, arg, rdname);
 	if (!entry)
 		return -1;
 
-	entry->sd = sd;
+	entry->sd      = sd;
+	entry->cb      = rd;
+	entry->cb_wr   = wr;
+	entry->name_wr = wrname;
+	entry->events  = events;
 
 	/* Keep track for select() */
 	if (sd > max_fdnum)
@@ -163,6 +371,28 @@ int pev_sock_add(int sd, void (*cb)(int, void *), void *arg)
 	return entry->id;
 }
 
+int pev_sock_mod(int id, int events)
+{
+	struct pev *entry;
+
+	for (entry = pl; entry; entry = entry->next) {
+		if (entry->type != PEV_SOCK || entry->id != id)
+			continue;
+
+		if (((events & PEV_READ)  && !entry->cb) ||
+		    ((events & PEV_WRITE) && !entry->cb_wr)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		entry->events = events;
+		return 0;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
 int pev_sock_del(int id)
 {
 	struct pev *entry;
@@ -184,7 +414,8 @@ int pev_sock_del(int id)
 	return -1;
 }
 
-int pev_sock_open(int domain, int type, int proto, void (*cb)(int, void *), void *arg)
+int pev_sock_open_name(int domain, int type, int proto, void (*cb)(int, void *),
+		       void *arg, const char *name)
 {
 	int sd;
 
@@ -197,7 +428,7 @@ int pev_sock_open(int domain, int type, int proto, void (*cb)(int, void *), void
 	if (sd < 0)
 		return -1;
 
-	if (pev_sock_add(sd, cb, arg) < 0) {
+	if (pev_sock_add_name(sd, cb, arg, name) < 0) {
 		close(sd);
 		return -1;
 	}
@@ -254,76 +485,89 @@ static struct pev *timer_compare(struct pev *a, struct pev *b)
 	if (b->type != PEV_TIMER || b->active < 1)
 		return a;
 
-	if (a->expiry.tv_sec < b->expiry.tv_sec)
-		return a;
-
-	if (a->expiry.tv_sec == b->expiry.tv_sec &&
-	    a->expiry.tv_nsec <= b->expiry.tv_nsec)
+	if (a->expiry <= b->expiry)
 		return a;
 
 	return b;
 }
 
-static int timer_start(struct timespec *now)
+/* Active timer that expires first, or NULL */
+static struct pev *timer_next(void)
 {
-	struct itimerval it = { 0 };
 	struct pev *next, *entry;
 
 	next = timer_ffs();
 	if (!next)
-		return -1;
+		return NULL;
 
 	for (entry = pl; entry; entry = entry->next)
 		next = timer_compare(next, entry);
 
-	it.it_value.tv_sec  =  next->expiry.tv_sec  - now->tv_sec;
-	it.it_value.tv_usec = (next->expiry.tv_nsec - now->tv_nsec) / 1000;
-	if (it.it_value.tv_usec < 0) {
-		it.it_value.tv_sec -= 1;
-		it.it_value.tv_usec = 1000000 + it.it_value.tv_usec;
-	}
+	return next;
+}
+
+static int timer_start(void)
+{
+	struct itimerval it = { 0 };
+	struct pev *next;
+	uint64_t left = 0;
+
+	/* Virtual clock, the loop moves time to the next expiry instead */
+	if (virtual)
+		return 0;
+
+	next = timer_next();
+	if (!next)
+		return -1;
+
+	if (next->expiry > now)
+		left = (next->expiry - now) / 1000;
 
 	/* Sanity check resulting value, prevent disabling timer */
-	if (it.it_value.tv_sec < 0)
-		it.it_value.tv_sec = 0;
-	if (it.it_value.tv_sec == 0 && it.it_value.tv_usec < 1)
-		it.it_value.tv_usec = 1;
+	if (left < 1)
+		left = 1;
+
+	it.it_value.tv_sec  = left / 1000000;
+	it.it_value.tv_usec = left % 1000000;
 
 	return setitimer(ITIMER_REAL, &it, NULL);
 }
 
-static int timer_expired(struct pev *entry, struct timespec *now)
+static int timer_expired(struct pev *entry)
 {
 	if (entry->type != PEV_TIMER || entry->active < 1)
 		return 0;
 
-	if (entry->expiry.tv_sec < now->tv_sec)
-		return 1;
+	return entry->expiry <= now;
+}
 
-	if (entry->expiry.tv_sec == now->tv_sec &&
-	    entry->expiry.tv_nsec <= now->tv_nsec)
-		return 1;
+/* Callbacks get the timeout in usec, clamped to what fits an int */
+static int timer_usec(int64_t ns)
+{
+	if (ns / 1000 > INT_MAX)
+		return INT_MAX;
 
-	return 0;
+	return (int)(ns / 1000);
 }
 
 static void timer_run(int signo, void *arg)
 {
 	struct pev *entry, *next;
-	struct timespec now;
 
 	(void)arg;
-	clock_gettime(CLOCK_MONOTONIC, &now);
 
 	for (entry = pl; entry; entry = next) {
-		unsigned int sec, usec;
-		int timeout;
+		int64_t timeout;
 
 		next = entry->next;
 		if (entry->type != PEV_TIMER)
 			continue;
 
-		if (!timer_expired(entry, &now))
+		if (!timer_expired(entry))
+			continue;
+
+		/* Rearmed by an earlier callback, expiry set by pev_check() */
+		if (signo && entry->active > 1)
 			continue;
 
 		if (entry->timeout)
@@ -332,31 +576,39 @@ static void timer_run(int signo, void *arg)
 			timeout = entry->period;
 
 		if (signo && entry->cb) {
+			unsigned long long late;
+
+			late = now - entry->expiry;
+			stats.timer_runs++;
+			stats.timer_late += late;
+			if (late > stats.timer_late_max)
+				stats.timer_late_max = late;
+			if (profiling)
+				hist_add(&late_hist, late);
+
 			entry->timeout = 0;
 
-			entry->cb(timeout, entry->arg);
+			dispatch(entry, entry->cb, entry->name, PEV_HIST_TIMER, timer_usec(timeout));
 			if (!entry->period && !entry->timeout) {
 				entry->active = -1;
 				continue;
 			}
-		}
 
-		sec  = timeout / 1000000;
-		usec = timeout % 1000000;
-		entry->expiry.tv_sec  = now.tv_sec + sec;
-		entry->expiry.tv_nsec = now.tv_nsec + (usec * 1000);
-		if (entry->expiry.tv_nsec > 1000000000) {
-			entry->expiry.tv_sec++;
-			entry->expiry.tv_nsec -= 1000000000;
+			/* Rearmed by callback, pev_timer_set() */
+			if (entry->timeout)
+				timeout = entry->timeout;
 		}
+
+		entry->expiry = now + timeout;
 	}
 
-	timer_start(&now);
+	timer_start();
 }
 
 static int timer_init(void)
 {
-	return pev_sig_add(SIGALRM, timer_run, NULL);
+	/* Internal, each timer callback is profiled instead */
+	return pev_sig_add_name(SIGALRM, timer_run, NULL, NULL);
 }
 
 static int timer_exit(void)
@@ -366,16 +618,17 @@ static int timer_exit(void)
 	return setitimer(ITIMER_REAL, &it, NULL);
 }
 
-int pev_timer_add(int timeout, int period, void (*cb)(int, void *), void *arg)
+int pev_timer_add_ns_name(int64_t timeout, int64_t period, void (*cb)(int, void *),
+			  void *arg, const char *name)
 {
 	struct pev *entry;
 
-	if (timeout <= 0 && period <= 0) {
+	if (timeout < 0 || period < 0 || (!timeout && !period)) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	entry = pev_new(PEV_TIMER, cb, arg);
+	entry = pev_new(PEV_TIMER, cb, arg, name);
 	if (!entry)
 		return -1;
 
@@ -386,12 +639,29 @@ int pev_timer_add(int timeout, int period, void (*cb)(int, void *), void *arg)
 	return entry->id;
 }
 
+int pev_timer_add_name(int timeout, int period, void (*cb)(int, void *), void *arg,
+		       const char *name)
+{
+	if (timeout <= 0 && period <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (timeout < 0)
+		timeout = 0;
+	if (period < 0)
+		period = 0;
+
+	return pev_timer_add_ns_name((int64_t)timeout * 1000, (int64_t)period * 1000,
+				     cb, arg, name);
+}
+
 int pev_timer_del(int id)
 {
 	return pev_sock_del(id);
 }
 
-int pev_timer_set(int id, int timeout)
+int pev_timer_set_ns(int id, int64_t timeout)
 {
 	struct pev *entry;
 
@@ -402,8 +672,8 @@ int pev_timer_set(int id, int timeout)
 			continue;
 
 		entry->timeout = timeout;
-		memset(&entry->expiry, 0, sizeof(entry->expiry));
-		entry->active = 2;
+		entry->expiry  = 0;
+		entry->active  = 2;
 		return 0;
 	}
 
@@ -411,7 +681,12 @@ int pev_timer_set(int id, int timeout)
 	return -1;
 }
 
-int pev_timer_get(int id)
+int pev_timer_set(int id, int timeout)
+{
+	return pev_timer_set_ns(id, (int64_t)timeout * 1000);
+}
+
+int64_t pev_timer_get_ns(int id)
 {
 	struct pev *entry;
 
@@ -431,6 +706,17 @@ int pev_timer_get(int id)
 	return -1;
 }
 
+int pev_timer_get(int id)
+{
+	int64_t timeout;
+
+	timeout = pev_timer_get_ns(id);
+	if (timeout < 0)
+		return -1;
+
+	return timer_usec(timeout);
+}
+
 int pev_timer_set_cb_del(int id, void (*cb)(void *))
 {
 	return pev_sock_set_cb_del(id, cb);
@@ -438,7 +724,7 @@ int pev_timer_set_cb_del(int id, void (*cb)(void *))
 
 /******************************* GENERIC ******************************/
 
-static struct pev *pev_new(int type, void (*cb)(int, void *), void *arg)
+static struct pev *pev_new(int type, void (*cb)(int, void *), void *arg, const char *name)
 {
 	struct pev *entry;
 
@@ -455,8 +741,9 @@ static struct pev *pev_new(int type, void (*cb)(int, void *), void *arg)
 	entry->type = type;
 	entry->active = 1;
 
-	entry->cb  = cb;
-	entry->arg = arg;
+	entry->cb   = cb;
+	entry->arg  = arg;
+	entry->name = name;
 
 	entry->next = pl;
 	entry->prev = NULL;
@@ -525,17 +812,19 @@ static void pev_event(int sd, void *arg)
 	if (!entry->cb)
 		return;
 
-	entry->cb(entry->signo, entry->arg);
+	dispatch(entry, entry->cb, entry->name, PEV_HIST_SIGNAL, entry->signo);
 }
 
 int pev_init(void)
 {
 	if (pipe(events))
 		return -1;
-	if (pev_sock_add(events[0], pev_event, NULL) < 0)
+	/* Internal, each signal callback is profiled instead */
+	if (pev_sock_add_name(events[0], pev_event, NULL, NULL) < 0)
 		return -1;
 
 	running = 1;
+	now = now_ns();
 
 	return timer_init();
 }
@@ -556,12 +845,12 @@ int pev_exit(int rc)
 	return timer_exit();
 }
 
-static void pev_check(fd_set *fds)
+static void pev_check(fd_set *rfds, fd_set *wfds)
 {
 	struct pev *entry;
 	int trestart = 0;
 
-	sock_run(fds);
+	sock_run(rfds, wfds);
 	pev_cleanup();
 
 	for (entry = pl; entry; entry = entry->next) {
@@ -575,17 +864,99 @@ static void pev_check(fd_set *fds)
 		timer_run(0, NULL);
 }
 
+int pev_stats(struct pev_stats *st)
+{
+	struct pev *entry;
+
+	*st = stats;
+	st->timers = st->socks = 0;
+	for (entry = pl; entry; entry = entry->next) {
+		if (entry->type == PEV_TIMER && entry->active > 0)
+			st->timers++;
+		if (entry->type == PEV_SOCK && entry->active)
+			st->socks++;
+	}
+
+	return 0;
+}
+
+/*
+ * Nothing to read or write, move the virtual clock to the first timer
+ * to expire, and run all timers expiring at that time.
+ */
+static void timer_advance(void)
+{
+	struct pev *next;
+
+	next = timer_next();
+	if (!next)
+		return;
+
+	if (next->expiry > now)
+		now = next->expiry;
+	timer_run(SIGALRM, NULL);
+}
+
+int pev_virtual(int enable)
+{
+	int prev = virtual;
+
+	virtual = enable;
+	if (virtual)
+		timer_exit();
+
+	return prev;
+}
+
+int pev_is_virtual(void)
+{
+	return virtual;
+}
+
+int pev_running(void)
+{
+	return running;
+}
+
+static void pev_busy(unsigned long long start)
+{
+	unsigned long long busy = now_ns() - start;
+
+	if (profiling)
+		hist_add(&loop_hist, busy);
+	stats.loops++;
+	stats.busy += busy;
+	if (busy > stats.busy_max)
+		stats.busy_max = busy;
+}
+
 int pev_run(void)
 {
+	unsigned long long start = 0;
 	struct pev *entry, *next;
-	fd_set fds;
+	fd_set rfds, wfds;
 	int num;
 
+	/* Setup may have taken a while, new timers count from here */
+	if (!virtual)
+		now = now_ns();
+
 	while (running) {
-		pev_check(&fds);
+		struct timeval poll = { 0 };
+
+		pev_check(&rfds, &wfds);
+		if (start)
+			pev_busy(start);
 
 		errno = 0;
-		num = select(nfds(), &fds, NULL, NULL, NULL);
+		num = select(nfds(), &rfds, &wfds, NULL, virtual && timer_next() ? &poll : NULL);
+		start = now_ns();
+		if (!virtual)
+			now = start;
+		if (num == 0 && virtual) {
+			timer_advance();
+			continue;
+		}
 		if (num <= 0)
 			continue;
 
@@ -595,11 +966,14 @@ int pev_run(void)
 			if (entry->type != PEV_SOCK)
 				continue;
 
-			if (!FD_ISSET(entry->sd, &fds))
-				continue;
+			/* A previous callback may have removed or changed us */
+			if (entry->active && (entry->events & PEV_READ) &&
+			    FD_ISSET(entry->sd, &rfds) && entry->cb)
+				dispatch(entry, entry->cb, entry->name, PEV_HIST_READ, entry->sd);
 
-			if (entry->cb)
-				entry->cb(entry->sd, entry->arg);
+			if (entry->active && (entry->events & PEV_WRITE) &&
+			    FD_ISSET(entry->sd, &wfds) && entry->cb_wr)
+				dispatch(entry, entry->cb_wr, entry->name_wr, PEV_HIST_WRITE, entry->sd);
 		}
 	}
 	pev_cleanup();
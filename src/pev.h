@@ -4,6 +4,7 @@
 #define PEV_H_
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
 
@@ -25,14 +26,40 @@ int pev_exit       (int status);
  */
 int pev_run        (void);
 
+/* Non-zero between pev_init() and pev_exit() */
+int pev_running    (void);
+
+/*
+ * Monotonic time in nanoseconds, CLOCK_MONOTONIC read once per loop
+ * iteration.  Use instead of time() or clock_gettime() in callbacks,
+ * everything in the same iteration sees the same time, and it is what
+ * timers are scheduled against.
+ */
+#define PEV_NSEC_PER_SEC  1000000000LL
+
+uint64_t pev_now   (void);
+
+/*
+ * Virtual clock, for simulation.  Instead of waiting for SIGALRM, the
+ * loop polls all descriptors and, when none are ready, moves pev_now()
+ * straight to the next timer expiry and runs that timer.  Hours of
+ * protocol timers take milliseconds, as long as the only input is from
+ * descriptors that are ready, or from timer callbacks.  Enable after
+ * pev_init(), before pev_run().
+ */
+int      pev_virtual    (int enable);
+int      pev_is_virtual (void);
+
 /*
  * Signal callbacks are identified by signal number, only one callback
  * per signal.  Signals are serialized like timers, which use SIGALRM,
  * using a pipe.  Delete by giving id returned from pev_sig_add()
  */
-int pev_sig_add    (int signo, void (*cb)(int, void *), void *arg);
+int pev_sig_add_name (int signo, void (*cb)(int, void *), void *arg, const char *name);
 int pev_sig_del    (int id);
 
+#define pev_sig_add(signo, cb, arg) pev_sig_add_name(signo, cb, arg, #cb)
+
 /*
  * Destructor callback, called when deleting a signal event (pev_sig_del).
  * Useful for deallocating heap allocated arg data.
@@ -44,16 +71,40 @@ int pev_sig_set_cb_del  (int id, void (*cb)(void *));
  * descriptor.  API changes to CLOEXEC and NONBLOCK.  Delete by id
  * returned from pev_sock_add()
  */
-int pev_sock_add   (int sd, void (*cb)(int, void *), void *arg);
+int pev_sock_add_name (int sd, void (*cb)(int, void *), void *arg, const char *name);
 int pev_sock_del   (int id);
 
+#define pev_sock_add(sd, cb, arg) pev_sock_add_name(sd, cb, arg, #cb)
+
+/*
+ * Same as pev_sock_add() but with separate callbacks for read and write
+ * readiness.  Either callback may be NULL, but only events that have a
+ * callback can be enabled.  Use pev_sock_mod() to change the events of
+ * interest, e.g., enable PEV_WRITE only while there is data queued, or
+ * the loop will spin on an always writable descriptor.
+ */
+#define PEV_READ   0x01
+#define PEV_WRITE  0x02
+
+int pev_sock_add_events_name (int sd, int events, void (*rd)(int, void *),
+			      void (*wr)(int, void *), void *arg,
+			      const char *rdname, const char *wrname);
+int pev_sock_mod   (int id, int events);
+
+#define pev_sock_add_events(sd, events, rd, wr, arg) \
+	pev_sock_add_events_name(sd, events, rd, wr, arg, #rd, #wr)
+
 /*
  * Same as pev_sock_add() but creates/closes socket as well.
  * Delete by id returned from pev_sock_open()
  */
-int pev_sock_open  (int domain, int type, int proto, void (*cb)(int, void *), void *arg);
+int pev_sock_open_name (int domain, int type, int proto, void (*cb)(int, void *),
+			void *arg, const char *name);
 int pev_sock_close (int id);
 
+#define pev_sock_open(domain, type, proto, cb, arg) \
+	pev_sock_open_name(domain, type, proto, cb, arg, #cb)
+
 /*
  * Destructor callback, called when deleting a socket event (pev_sock_del or
  * pev_sock_close). Useful for deallocating heap allocated arg data.
@@ -76,10 +127,23 @@ int pev_sock_set_cb_del  (int id, void (*cb)(void *));
  *
  * Please note, scheduling granularity is subject to limits in your
  * operating system timer resolution.
+ *
+ * The microsecond API overflows at ~35 minutes, the _ns variants take
+ * 64-bit nanoseconds.  Timeouts are relative to pev_now(), and timers
+ * are kept in nanoseconds internally.  The callback gets the timeout
+ * in microseconds, clamped to INT_MAX.
  */
-int pev_timer_add  (int timeout, int period, void (*cb)(int, void *), void *arg);
+int pev_timer_add_name (int timeout, int period, void (*cb)(int, void *), void *arg,
+			const char *name);
+int pev_timer_add_ns_name (int64_t timeout, int64_t period, void (*cb)(int, void *),
+			   void *arg, const char *name);
 int pev_timer_del  (int id);
 
+#define pev_timer_add(timeout, period, cb, arg) \
+	pev_timer_add_name(timeout, period, cb, arg, #cb)
+#define pev_timer_add_ns(timeout, period, cb, arg) \
+	pev_timer_add_ns_name(timeout, period, cb, arg, #cb)
+
 /*
  * Reset timeout of one-shot timer.  When a one-shot timer has fired
  * it goes inert.  Calling pev_timer_set() rearms the timer.
@@ -92,10 +156,70 @@ int pev_timer_del  (int id);
 int pev_timer_set  (int id, int timeout);
 int pev_timer_get  (int id);
 
+int     pev_timer_set_ns (int id, int64_t timeout);
+int64_t pev_timer_get_ns (int id);
+
 /*
  * Destructor callback, called when deleting a timer (pev_timer_del).
  * Useful for deallocating heap allocated arg data.
  */
 int pev_timer_set_cb_del  (int id, void (*cb)(void *));
 
+/*
+ * Event loop statistics, for monitoring.  Time is in nanoseconds.  Busy
+ * is the time from select() returning until the loop is back waiting,
+ * i.e., time spent in callbacks.  Timer lateness is how long after its
+ * expiry a timer callback is called.  Sums and maximums since start.
+ */
+struct pev_stats {
+	unsigned long long loops;	/* Event loop iterations     */
+	unsigned long long busy;	/* Total time in callbacks   */
+	unsigned long long busy_max;	/* Longest single iteration  */
+	unsigned long long timer_runs;	/* Timer callbacks called    */
+	unsigned long long timer_late;	/* Total timer lateness      */
+	unsigned long long timer_late_max;
+	int                timers;	/* Active timers             */
+	int                socks;	/* Active sockets            */
+};
+
+int pev_stats      (struct pev_stats *st);
+
+/*
+ * Callback profiling, off by default.  When enabled, every callback is
+ * timed into a log-linear histogram, one per callback function, named
+ * by the add macros above.  Also kept are histograms of loop iteration
+ * busy time and of timer lateness.  When disabled the cost is one test
+ * per callback.
+ *
+ * Buckets: 0 is below 1 usec, then four per power of two up to ~68 sec,
+ * the last bucket also counts anything above that.
+ */
+#define PEV_HIST_BUCKETS	105
+
+enum {
+	PEV_HIST_LOOP,			/* Loop iteration busy time         */
+	PEV_HIST_LATENESS,		/* Timer expiry to callback         */
+	PEV_HIST_READ,			/* Socket readable callback         */
+	PEV_HIST_WRITE,			/* Socket writable callback         */
+	PEV_HIST_TIMER,
+	PEV_HIST_SIGNAL,
+};
+
+struct pev_hist {
+	const char        *name;
+	int                type;
+	unsigned long long count;
+	unsigned long long sum;		/* nsec */
+	unsigned long long max;		/* nsec */
+	unsigned int       bucket[PEV_HIST_BUCKETS];
+};
+
+int  pev_profile         (int enable);
+int  pev_profiling       (void);
+void pev_hist_reset      (void);
+int  pev_hist_foreach    (int (*cb)(const struct pev_hist *, void *), void *arg);
+
+unsigned long long pev_hist_upper (int bucket);
+unsigned long long pev_hist_pct   (const struct pev_hist *h, int pct);
+
 #endif /* PEV_H_ */
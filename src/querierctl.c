@@ -51,8 +51,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <arpa/inet.h>
+#include <net/if.h>
 
 #include "queue.h"
+#include "shm.h"
+#include "trace.h"
 #define MAXARGS	32
 
 /*
@@ -92,6 +96,7 @@ struct cmd {
 static int plain = 0;
 static int debug = 0;
 static int heading = 1;
+static int json = 0;
 
 static int cmdind;
 static TAILQ_HEAD(head, cmd) cmds = TAILQ_HEAD_INITIALIZER(cmds);
@@ -417,11 +422,9 @@ static void print(char *line, int indent)
 	}
 }
 
-static int get(char *cmd, FILE *fp)
+/* Connect and send command, returns socket or -1 */
+static int send_cmd(char *cmd)
 {
-	struct pollfd pfd;
-	FILE *lfp = NULL;
-	int indent = 0;
 	char buf[768];
 	ssize_t len;
 	int sd;
@@ -437,17 +440,33 @@ static int get(char *cmd, FILE *fp)
 			errx(1, "not enough permissions.");
 		err(1, "failed connecting to querierd");
 
-		return 1; /* we never get here, make gcc happy */
+		return -1; /* we never get here, make gcc happy */
 	}
 
-	len = snprintf(buf, sizeof(buf), "%s", chomp(cmd));
+	len = snprintf(buf, sizeof(buf), "%s\n", chomp(cmd));
 	while (write(sd, buf, len) == -1) {
 		if (errno == EAGAIN)
 			continue;
 		close(sd);
-		return 2;
+		return -1;
 	}
 
+	return sd;
+}
+
+static int get(char *cmd, FILE *fp)
+{
+	struct pollfd pfd;
+	FILE *lfp = NULL;
+	int indent = 0;
+	char buf[768];
+	ssize_t len;
+	int sd;
+
+	sd = send_cmd(cmd);
+	if (sd == -1)
+		return 2;
+
 	if (!fp) {
 		lfp = tempfile();
 		if (!lfp) {
@@ -486,8 +505,14 @@ static int get(char *cmd, FILE *fp)
 	if (!lfp)
 		return 0;
 
-	while (fgets(buf, sizeof(buf), fp))
-		print(buf, indent);
+	if (json) {
+		/* Pass through as-is, no heading or line wrapping */
+		while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+			fwrite(buf, len, 1, stdout);
+	} else {
+		while (fgets(buf, sizeof(buf), fp))
+			print(buf, indent);
+	}
 
 	fclose(lfp);
 
@@ -541,6 +566,284 @@ static int ipc_fetch(void)
 	return 0;
 }
 
+static const char *igmp_kind(int type)
+{
+	switch (type) {
+	case 0x11: return "query";
+	case 0x12: return "v1 report";
+	case 0x16: return "v2 report";
+	case 0x17: return "leave";
+	case 0x22: return "v3 report";
+	default:   return "unknown";
+	}
+}
+
+static void trace_print(struct trace_hdr *hdr, struct trace_rec *rec)
+{
+	char tm[20], ev[20], ifname[IF_NAMESIZE], grp[16], src[16], tid[12], info[64];
+	struct in_addr ina;
+	uint64_t real;
+	time_t sec;
+
+	real = hdr->th_real - (hdr->th_mono - rec->tr_time);
+	sec  = real / 1000000000ULL;
+	strftime(tm, sizeof(tm), "%H:%M:%S", localtime(&sec));
+	snprintf(&tm[8], sizeof(tm) - 8, ".%03u", (unsigned)(real % 1000000000ULL / 1000000));
+
+	info[0] = 0;
+	switch (rec->tr_type) {
+	case TRACE_RX:
+		snprintf(ev, sizeof(ev), "RX %s", igmp_kind(rec->tr_arg));
+		break;
+	case TRACE_TX:
+		snprintf(ev, sizeof(ev), "TX %s", igmp_kind(rec->tr_arg));
+		break;
+	case TRACE_TX_PROXY:
+		snprintf(ev, sizeof(ev), "TX proxy query");
+		break;
+	case TRACE_ELECT:
+		snprintf(ev, sizeof(ev), "Election %s", rec->tr_arg ? "won" : "lost");
+		break;
+	case TRACE_QUERIER_TIMEOUT:
+		snprintf(ev, sizeof(ev), "Querier timeout");
+		break;
+	case TRACE_GROUP_ADD:
+		snprintf(ev, sizeof(ev), "Group add");
+		snprintf(info, sizeof(info), "IGMPv%d", rec->tr_arg);
+		break;
+	case TRACE_GROUP_LEAVE:
+		snprintf(ev, sizeof(ev), "Group leave");
+		break;
+	case TRACE_GROUP_EXPIRE:
+		snprintf(ev, sizeof(ev), "Group expire");
+		break;
+	case TRACE_IFACE_UP:
+		snprintf(ev, sizeof(ev), "Interface up");
+		break;
+	case TRACE_IFACE_DOWN:
+		snprintf(ev, sizeof(ev), "Interface down");
+		break;
+	default:
+		snprintf(ev, sizeof(ev), "Unknown %d", rec->tr_type);
+		break;
+	}
+	if (rec->tr_err)
+		snprintf(info, sizeof(info), "%s", strerror(rec->tr_err));
+
+	if (!if_indextoname(rec->tr_ifindex, ifname))
+		snprintf(ifname, sizeof(ifname), "%d", rec->tr_ifindex);
+
+	ina.s_addr = rec->tr_group;
+	inet_ntop(AF_INET, &ina, grp, sizeof(grp));
+	ina.s_addr = rec->tr_source;
+	inet_ntop(AF_INET, &ina, src, sizeof(src));
+
+	snprintf(tid, sizeof(tid), "%d", rec->tr_timerid);
+
+	printf("%-12s %-15s %-8s %-15s %-15s %5s %s\n", tm, ev, ifname,
+	       rec->tr_group ? grp : "", rec->tr_source ? src : "",
+	       rec->tr_timerid ? tid : "", info);
+}
+
+/*
+ * Decode a flight recorder dump, either from the daemon or a file
+ * saved by the daemon on SIGUSR1.
+ */
+static int trace_decode(FILE *fp)
+{
+	struct trace_hdr hdr;
+	struct trace_rec rec;
+	char head[100];
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.th_magic != TRACE_MAGIC) {
+		warnx("not a flight recorder dump.");
+		return 1;
+	}
+	if (hdr.th_version != TRACE_VERSION || hdr.th_recsz != sizeof(rec)) {
+		warnx("unsupported flight recorder version %d.", hdr.th_version);
+		return 1;
+	}
+
+	snprintf(head, sizeof(head), "%-12s %-15s %-8s %-15s %-15s %5s Info=",
+		 "Time", "Event", "Iface", "Group", "Source", "Timer");
+	print(head, 0);
+
+	for (uint32_t i = 0; i < hdr.th_count; i++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+			warnx("truncated flight recorder dump.");
+			return 1;
+		}
+		trace_print(&hdr, &rec);
+	}
+
+	if (heading && hdr.th_total > hdr.th_count)
+		printf("\n%u older events overwritten.\n", hdr.th_total - hdr.th_count);
+
+	return 0;
+}
+
+/*
+ * Print events as they arrive, until querierd closes the connection
+ * or the user stops us.
+ */
+static int stream(char *cmd)
+{
+	struct pollfd pfd;
+	char buf[768];
+	FILE *fp;
+	int sd;
+
+	sd = send_cmd(cmd);
+	if (sd == -1)
+		return 2;
+
+	fp = fdopen(sd, "r");
+	if (!fp) {
+		warn("Failed reading from querierd");
+		close(sd);
+		return 3;
+	}
+
+	pfd.fd = sd;
+	pfd.events = POLLIN;
+	while (1) {
+		if (!fgets(buf, sizeof(buf), fp)) {
+			if (ferror(fp) && (errno == EAGAIN || errno == EINTR)) {
+				clearerr(fp);
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			break;
+		}
+
+		if (json)
+			fputs(buf, stdout);
+		else
+			print(buf, 0);
+		fflush(stdout);
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+static int trace_file(char *file)
+{
+	FILE *fp;
+	int rc;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		err(1, "failed opening %s", file);
+
+	rc = trace_decode(fp);
+	fclose(fp);
+
+	return rc;
+}
+
+static int trace_show(char *cmd)
+{
+	FILE *fp;
+	int rc;
+
+	fp = tempfile();
+	if (!fp)
+		err(4, "Failed opening tempfile");
+
+	rc = get(cmd, fp);
+	if (!rc)
+		rc = trace_decode(fp);
+	fclose(fp);
+
+	return rc;
+}
+
+static char *addr(uint32_t ip, char *buf, size_t len)
+{
+	struct in_addr ina = { .s_addr = ip };
+
+	return (char *)inet_ntop(AF_INET, &ina, buf, len);
+}
+
+/*
+ * Interfaces and groups from the shared memory export, without asking
+ * querierd.  Same tables as 'show interfaces' and 'show groups'.
+ */
+static int shm_show(char *file)
+{
+	char path[256], head[100], a1[16], a2[16];
+	const struct shm_snap *snap;
+	struct shm_reader *r;
+	time_t now;
+
+	if (!file) {
+		snprintf(path, sizeof(path), RUNSTATEDIR "/%s.shm", ident ? ident : PACKAGE_NAME);
+		file = path;
+	}
+
+	r = shm_reader_open(file);
+	if (!r)
+		err(1, "failed opening %s", file);
+
+	snap = shm_reader_read(r);
+	if (!snap) {
+		warn("failed reading %s", file);
+		shm_reader_close(r);
+		return 1;
+	}
+	now = time(NULL);
+
+	snprintf(head, sizeof(head), "%-16s  %-8s  %-20s  %7s  %3s=",
+		 "Interface", "State", "Querier", "Timeout", "Ver");
+	print(head, 0);
+	for (uint32_t i = 0; i < snap->hdr.sh_num_ifaces; i++) {
+		const struct shm_iface *si = &snap->ifaces[i];
+		char timeout[24] = "None";
+		const char *state;
+
+		if (!(si->sif_flags & SHM_IF_UP))
+			state = "Down";
+		else if (si->sif_flags & SHM_IF_DISABLED)
+			state = "Disabled";
+		else if (si->sif_flags & SHM_IF_PROXY)
+			state = "Proxy";
+		else
+			state = "Up";
+		if (si->sif_querier)
+			snprintf(timeout, sizeof(timeout), "%lld",
+				 (long long)(si->sif_querier_expires > now ? si->sif_querier_expires - now : 0));
+
+		printf("%-16s  %-8s  %-20s  %7s  %3d\n", si->sif_name, state,
+		       addr(si->sif_querier ? si->sif_querier : si->sif_addr, a1, sizeof(a1)),
+		       timeout, si->sif_version);
+	}
+
+	if (heading)
+		puts("");
+	snprintf(head, sizeof(head), "%-16s  %-15s  %-15s  %3s  %7s=",
+		 "Interface", "Group", "Last Reporter", "Ver", "Expires");
+	print(head, 0);
+	for (uint32_t i = 0; i < snap->hdr.sh_num_groups; i++) {
+		const struct shm_group *sg = &snap->groups[i];
+		const char *ifname = "?";
+
+		if (sg->sgr_iface < snap->hdr.sh_num_ifaces)
+			ifname = snap->ifaces[sg->sgr_iface].sif_name;
+
+		printf("%-16s  %-15s  %-15s  %3d  %7lld\n", ifname,
+		       addr(sg->sgr_group, a1, sizeof(a1)), addr(sg->sgr_reporter, a2, sizeof(a2)),
+		       sg->sgr_version, (long long)(sg->sgr_expires > now ? sg->sgr_expires - now : 0));
+	}
+
+	if (heading && snap->hdr.sh_truncated)
+		printf("\n%u entries did not fit, see shm-groups in querierd.conf\n", snap->hdr.sh_truncated);
+
+	shm_reader_close(r);
+
+	return 0;
+}
+
 static int string_match(const char *a, const char *b)
 {
    size_t min = MIN(strlen(a), strlen(b));
@@ -589,8 +892,11 @@ static int usage(int rc)
 	       "\n"
 	       "Options:\n"
 	       "  -i, --ident=NAME           Connect to named querierd instance\n"
+	       "  -j, --json                 JSON output, from querierd, for scripting\n"
 	       "  -m, --monitor              Run 'COMMAND' every two seconds, like watch(1)\n"
 	       "  -p, --plain                Use plain table headings, no ctrl chars\n"
+	       "  -r, --read=FILE            Decode flight recorder dump, saved on SIGUSR1\n"
+	       "  -s, --shm[=FILE]           Show interfaces and groups from shared memory export\n"
 	       "  -t, --no-heading           Skip table headings\n"
 	       "  -h, --help                 This help text\n"
 	       "  -u, --ipc=FILE             Override UNIX domain socket file, default based on -i\n"
@@ -654,9 +960,21 @@ static int cmd(int argc, char *argv[])
 		return 1;
 	}
 
+	if (json)
+		strlcat(buf, " json", sizeof(buf));
+
+	if (!strncmp(cmd, "monitor", 7))
+		return stream(cmd);
+
+	if (json)
+		return get(cmd, NULL);
+
 	if (!strcmp(cmd, "help"))
 		return usage(0);
 
+	if (!strcmp(cmd, "show trace"))
+		return trace_show(cmd);
+
 	return get(cmd, NULL);
 }
 
@@ -666,17 +984,21 @@ int main(int argc, char *argv[])
 		{ "debug",      0, NULL, 'd' },
 		{ "help",       0, NULL, 'h' },
 		{ "ident",      1, NULL, 'i' },
+		{ "json",       0, NULL, 'j' },
 		{ "monitor",    0, NULL, 'm' },
 		{ "no-heading", 0, NULL, 't' },
 		{ "plain",      0, NULL, 'p' },
+		{ "read",       1, NULL, 'r' },
+		{ "shm",        2, NULL, 's' },
 		{ "ipc",        1, NULL, 'u' },
 		{ "version",    0, NULL, 'v' },
 		{ NULL, 0, NULL, 0 }
 	};
-	int monitor = 0;
+	char *trace = NULL, *shm = NULL;
+	int monitor = 0, use_shm = 0;
 	int c, rc;
 
-	while ((c = getopt_long(argc, argv, "dh?i:mptu:v", long_options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "dh?i:jmpr:s::tu:v", long_options, NULL)) != EOF) {
 		switch(c) {
 		case 'd':
 			debug = 1;
@@ -690,6 +1012,10 @@ int main(int argc, char *argv[])
 			ident = optarg;
 			break;
 
+		case 'j':
+			json = 1;
+			break;
+
 		case 'm':
 			monitor = 1;
 			break;
@@ -698,6 +1024,15 @@ int main(int argc, char *argv[])
 			plain = 1;
 			break;
 
+		case 'r':
+			trace = optarg;
+			break;
+
+		case 's':
+			shm = optarg;
+			use_shm = 1;
+			break;
+
 		case 't':
 			heading = 0;
 			break;
@@ -711,6 +1046,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (trace)
+		return trace_file(trace);
+
 	do {
 		if (monitor) {
 			time_t now;
@@ -720,8 +1058,10 @@ int main(int argc, char *argv[])
 			fputs(ctime(&now), stderr);
 		}
 
-		if (optind >= argc)
-			rc = get("show", NULL);
+		if (use_shm)
+			rc = shm_show(shm);
+		else if (optind >= argc)
+			rc = get(json ? "show json" : "show", NULL);
 		else
 			rc = cmd(argc - optind, &argv[optind]);
 
@@ -0,0 +1,568 @@
+/*
+ * Offline replay of captured IGMP traffic
+ *
+ * Reads a capture file, pcap or pcapng, e.g., from tshark, and feeds
+ * each IGMP packet to accept_igmp() at its capture time, on a virtual
+ * clock, see pev_virtual().  Timers run in between as they would have,
+ * so the resulting group table is what querierd would have had at the
+ * end of the capture.  Processing throughput is reported, for profiling
+ * report storms without a network, enable pev-profile in the .conf file
+ * for callback latency.
+ *
+ * Packets are mapped to local interfaces by the interface name in the
+ * pcapng file, as recorded by tshark -i IFNAME.  Classic pcap files do
+ * not have names, for them, or to override, give an interface name:
+ *
+ *     querierd -f querierd.conf -R storm.pcapng
+ *     querierd -f querierd.conf -R storm.pcap,eth0
+ *
+ * Interfaces must exist, and be enabled in the .conf file.  Replay never
+ * transmits, our own queries are only traced and counted, and live IGMP
+ * on the interfaces is not read, see igmp_sendto().
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <inttypes.h>
+#include <net/ethernet.h>
+#include "defs.h"
+
+#define PCAP_MAGIC		0xa1b2c3d4	/* usec time stamps */
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAPNG_SHB		0x0a0d0d0a	/* Section header block */
+#define PCAPNG_IDB		1		/* Interface description */
+#define PCAPNG_SPB		3		/* Simple packet block */
+#define PCAPNG_EPB		6		/* Enhanced packet block */
+#define PCAPNG_BOM		0x1a2b3c4d	/* Byte order magic */
+#define PCAPNG_OPT_IFNAME	2
+#define PCAPNG_OPT_TSRESOL	9
+
+#define LINKTYPE_NULL		0
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_LINUX_SLL2	276
+
+#ifndef MIN
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+#endif
+
+#define REPLAY_BLOCK_MAX	(1 << 24)	/* Sanity check, 16 MiB */
+
+/* Interface in capture, one for classic pcap */
+struct replay_if {
+	int      linktype;
+	int      ifindex;		/* Local interface, 0 if unknown */
+	uint64_t tsunit;		/* Time stamp unit, 10^-n or 2^-n */
+	int      tspow2;
+};
+
+static struct {
+	FILE     *fp;
+	int       pcapng;
+	int       swap;			/* Other byte order than ours */
+
+	struct replay_if *ifs;
+	size_t    num_ifs;
+	int       ifindex;		/* Fallback, from command line */
+
+	uint8_t  *buf;			/* Current block */
+	size_t    buflen;
+
+	/* Next packet, not yet injected */
+	uint64_t  when;			/* nsec, capture time */
+	uint8_t  *pkt;
+	size_t    len;
+	struct replay_if *pif;
+
+	uint64_t  first;		/* Capture time of first packet */
+	uint64_t  start;		/* pev_now() at first packet */
+	int       timerid;
+
+	struct timespec begin;
+
+	/* Statistics */
+	uint64_t  frames;
+	uint64_t  igmp;
+	uint64_t  unmapped;		/* No local interface */
+	uint64_t  skipped;		/* Not IPv4 or IGMP, or truncated */
+} rp;
+
+static uint16_t get16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return rp.swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return rp.swap ? __builtin_bswap32(v) : v;
+}
+
+/* Network byte order, frame headers */
+static uint16_t be16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static int readn(void *buf, size_t len)
+{
+	return fread(buf, len, 1, rp.fp) == 1 ? 0 : -1;
+}
+
+/* Read len bytes into the block buffer, growing it as needed */
+static uint8_t *readbuf(size_t len)
+{
+	if (len > REPLAY_BLOCK_MAX) {
+		errno = EFBIG;
+		return NULL;
+	}
+
+	if (len > rp.buflen) {
+		uint8_t *buf;
+
+		buf = realloc(rp.buf, len);
+		if (!buf)
+			return NULL;
+		rp.buf    = buf;
+		rp.buflen = len;
+	}
+
+	if (readn(rp.buf, len))
+		return NULL;
+
+	return rp.buf;
+}
+
+/* Capture time stamp to nanoseconds */
+static uint64_t ts2ns(struct replay_if *rif, uint64_t ts)
+{
+	uint64_t sec, frac;
+
+	if (rif->tspow2) {
+		sec  = ts >> rif->tsunit;
+		frac = ts & ((1ULL << rif->tsunit) - 1);
+		return sec * PEV_NSEC_PER_SEC + ((frac * PEV_NSEC_PER_SEC) >> rif->tsunit);
+	}
+
+	sec  = ts / rif->tsunit;
+	frac = ts % rif->tsunit;
+
+	return sec * PEV_NSEC_PER_SEC + frac * PEV_NSEC_PER_SEC / rif->tsunit;
+}
+
+static struct replay_if *replay_ifadd(int linktype)
+{
+	struct replay_if *rif;
+
+	rif = realloc(rp.ifs, (rp.num_ifs + 1) * sizeof(*rif));
+	if (!rif)
+		return NULL;
+	rp.ifs = rif;
+
+	rif = &rp.ifs[rp.num_ifs++];
+	rif->linktype = linktype;
+	rif->ifindex  = rp.ifindex;
+	rif->tsunit   = 1000000;
+	rif->tspow2   = 0;
+
+	return rif;
+}
+
+/* Interface name and time stamp resolution from IDB options */
+static void replay_idb(struct replay_if *rif, const uint8_t *opt, size_t len)
+{
+	while (len >= 4) {
+		uint16_t code = get16(opt), olen = get16(opt + 2);
+		size_t padded = 4 + ((olen + 3U) & ~3U);
+
+		if (!code || padded > len)
+			break;
+
+		if (code == PCAPNG_OPT_IFNAME && !rp.ifindex) {
+			char ifname[IF_NAMESIZE] = { 0 };
+
+			memcpy(ifname, opt + 4, MIN(olen, sizeof(ifname) - 1));
+			rif->ifindex = if_nametoindex(ifname);
+			if (!rif->ifindex)
+				logit(LOG_WARNING, 0, "Capture interface %s not found, skipping its packets", ifname);
+		} else if (code == PCAPNG_OPT_TSRESOL && olen >= 1) {
+			uint8_t res = opt[4];
+
+			rif->tspow2 = !!(res & 0x80);
+			res &= 0x7f;
+			if (rif->tspow2)
+				rif->tsunit = MIN(res, 63);
+			else
+				for (rif->tsunit = 1; res-- > 0 && rif->tsunit < 10000000000000000000ULL;)
+					rif->tsunit *= 10;
+		}
+
+		opt += padded;
+		len -= padded;
+	}
+}
+
+/* Next packet from a classic pcap file, returns 0 on EOF */
+static int pcap_next(void)
+{
+	uint8_t hdr[16];
+	uint32_t caplen, frac;
+	uint8_t *pkt;
+
+	if (readn(hdr, sizeof(hdr)))
+		return 0;
+
+	caplen = get32(hdr + 8);
+	pkt = readbuf(caplen);
+	if (!pkt)
+		return -1;
+
+	frac = get32(hdr + 4);
+	rp.pif  = &rp.ifs[0];
+	rp.when = (uint64_t)get32(hdr) * PEV_NSEC_PER_SEC +
+		(rp.pif->tsunit == 1000000 ? (uint64_t)frac * 1000 : frac);
+	rp.pkt  = pkt;
+	rp.len  = caplen;
+
+	return 1;
+}
+
+/* Next packet from a pcapng file, other blocks are handled on the way */
+static int pcapng_next(void)
+{
+	while (1) {
+		uint32_t type, len, body;
+		uint8_t hdr[8], *blk;
+
+		if (readn(hdr, sizeof(hdr)))
+			return 0;
+
+		memcpy(&type, hdr, sizeof(type));
+		if (type == PCAPNG_SHB) {
+			uint32_t bom;
+
+			/* New section, may change byte order, interfaces start over */
+			if (readn(&bom, sizeof(bom)))
+				return -1;
+			rp.swap = bom != PCAPNG_BOM;
+			rp.num_ifs = 0;
+
+			len = get32(hdr + 4);
+			if (len < 12 + 4 || !readbuf(len - 12))
+				return -1;
+			continue;
+		}
+
+		type = get32(hdr);
+		len  = get32(hdr + 4);
+		if (len < 12 || len % 4) {
+			errno = EPROTO;
+			return -1;
+		}
+		body = len - 12;
+
+		/* Body and trailing length */
+		blk = readbuf(body + 4);
+		if (!blk)
+			return -1;
+
+		switch (type) {
+		case PCAPNG_IDB: {
+			struct replay_if *rif;
+
+			if (body < 8)
+				break;
+			rif = replay_ifadd(get16(blk));
+			if (!rif)
+				return -1;
+			replay_idb(rif, blk + 8, body - 8);
+			break;
+		}
+
+		case PCAPNG_EPB: {
+			uint32_t id, caplen;
+
+			if (body < 20)
+				break;
+			id     = get32(blk);
+			caplen = get32(blk + 12);
+			if (id >= rp.num_ifs || caplen > body - 20)
+				break;
+
+			rp.pif  = &rp.ifs[id];
+			rp.when = ts2ns(rp.pif, (uint64_t)get32(blk + 4) << 32 | get32(blk + 8));
+			rp.pkt  = blk + 20;
+			rp.len  = caplen;
+			return 1;
+		}
+
+		case PCAPNG_SPB:
+			/* No time stamp, same time as previous packet */
+			if (body < 4 || !rp.num_ifs)
+				break;
+			rp.pif = &rp.ifs[0];
+			rp.pkt = blk + 4;
+			rp.len = MIN(get32(blk), body - 4);
+			return 1;
+
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * IPv4 packet in frame, NULL if not IPv4.  Handles the link types that
+ * tcpdump and tshark use for Ethernet and 'any' captures.
+ */
+static uint8_t *replay_ip(int linktype, uint8_t *pkt, size_t *len)
+{
+	size_t off, proto;
+
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+		off = 12;
+		while (off + 2 <= *len && (be16(pkt + off) == 0x8100 || be16(pkt + off) == 0x88a8))
+			off += 4;
+		proto = off;
+		off  += 2;
+		break;
+
+	case LINKTYPE_LINUX_SLL:
+		proto = 14;
+		off   = 16;
+		break;
+
+	case LINKTYPE_LINUX_SLL2:
+		proto = 0;
+		off   = 20;
+		break;
+
+	case LINKTYPE_NULL:
+		/* BSD loopback, address family in host order of capturing host */
+		if (*len < 4 || (pkt[0] != AF_INET && pkt[3] != AF_INET))
+			return NULL;
+		*len -= 4;
+		return pkt + 4;
+
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+		return *len && (pkt[0] >> 4) == 4 ? pkt : NULL;
+
+	default:
+		return NULL;
+	}
+
+	if (off > *len || be16(pkt + proto) != ETHERTYPE_IP)
+		return NULL;
+
+	*len -= off;
+	return pkt + off;
+}
+
+/* Copy IGMP packet to the input buffer and process it */
+static void replay_inject(void)
+{
+	struct ip *ip;
+	uint8_t *pkt;
+	size_t len = rp.len, iplen;
+
+	rp.frames++;
+
+	pkt = replay_ip(rp.pif->linktype, rp.pkt, &len);
+	if (!pkt || len < sizeof(*ip)) {
+		rp.skipped++;
+		return;
+	}
+
+	ip = (struct ip *)pkt;
+	iplen = ntohs(ip->ip_len);
+	if (ip->ip_p != IPPROTO_IGMP || iplen > len || iplen > RECV_BUF_SIZE ||
+	    (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK))) {
+		rp.skipped++;
+		return;
+	}
+
+	if (!rp.pif->ifindex) {
+		rp.unmapped++;
+		return;
+	}
+
+	rp.igmp++;
+	memcpy(recv_buf, pkt, iplen);
+	accept_igmp(rp.pif->ifindex, iplen);
+}
+
+static int replay_next(void)
+{
+	int rc;
+
+	rc = rp.pcapng ? pcapng_next() : pcap_next();
+	if (rc < 0) {
+		/* Common when the capturing tool was killed, replay what we have */
+		if (feof(rp.fp))
+			logit(LOG_WARNING, 0, "Truncated capture, stopping replay");
+		else
+			logit(LOG_WARNING, errno, "Failed reading capture, stopping replay");
+	}
+
+	return rc;
+}
+
+static void replay_done(void)
+{
+	struct timespec end;
+	double wall, capture;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wall    = (end.tv_sec - rp.begin.tv_sec) + (end.tv_nsec - rp.begin.tv_nsec) / 1e9;
+	capture = (double)(pev_now() - rp.start) / PEV_NSEC_PER_SEC;
+
+	printf("Frames                  : %" PRIu64 "\n", rp.frames);
+	printf("IGMP packets            : %" PRIu64 "\n", rp.igmp);
+	printf("Skipped, not IGMP       : %" PRIu64 "\n", rp.skipped);
+	printf("Skipped, no interface   : %" PRIu64 "\n", rp.unmapped);
+	printf("Capture time            : %.3f sec\n", capture);
+	printf("Processing time         : %.3f sec\n", wall);
+	if (wall > 0)
+		printf("Throughput              : %.0f packets/sec, %.1fx real time\n",
+		       rp.igmp / wall, capture / wall);
+	printf("\n");
+
+	sim_print("show groups");
+	if (pev_profiling()) {
+		printf("\n");
+		sim_print("show pev");
+	}
+	fflush(stdout);
+
+	quit(0);
+}
+
+/* Inject all packets that are due, then sleep until the next one */
+static void replay_step(int timeout, void *arg)
+{
+	uint64_t elapsed = pev_now() - rp.start;
+
+	(void)timeout;
+	(void)arg;
+
+	while (1) {
+		/* Time stamps may go backwards, e.g., between interfaces */
+		if (rp.when > rp.first && rp.when - rp.first > elapsed) {
+			pev_timer_set_ns(rp.timerid, rp.when - rp.first - elapsed);
+			return;
+		}
+
+		replay_inject();
+		if (replay_next() <= 0)
+			break;
+	}
+
+	replay_done();
+}
+
+/* Check file header, create interface for classic pcap */
+static int replay_open(const char *file)
+{
+	uint32_t magic;
+
+	rp.fp = fopen(file, "r");
+	if (!rp.fp) {
+		logit(LOG_WARNING, errno, "Failed opening capture %s", file);
+		return -1;
+	}
+
+	if (readn(&magic, sizeof(magic)))
+		goto fail;
+
+	if (magic == PCAPNG_SHB) {
+		rewind(rp.fp);
+		rp.pcapng = 1;
+		return 0;
+	}
+
+	if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC)
+		rp.swap = 0;
+	else if (__builtin_bswap32(magic) == PCAP_MAGIC || __builtin_bswap32(magic) == PCAP_MAGIC_NSEC)
+		rp.swap = 1;
+	else
+		goto fail;
+
+	/* Version, zone, sigfigs, snaplen, link type */
+	if (!readbuf(20) || !replay_ifadd(get32(rp.buf + 16)))
+		goto fail;
+	if ((rp.swap ? __builtin_bswap32(magic) : magic) == PCAP_MAGIC_NSEC)
+		rp.ifs[0].tsunit = PEV_NSEC_PER_SEC;
+	if (!rp.ifindex)
+		logit(LOG_WARNING, 0, "No interface names in pcap file, use -R %s,IFNAME", file);
+
+	return 0;
+fail:
+	logit(LOG_WARNING, 0, "%s is not a pcap or pcapng capture file", file);
+	fclose(rp.fp);
+	rp.fp = NULL;
+	return -1;
+}
+
+/*
+ * Replay capture, arg is FILE[,IFNAME], on a virtual clock until the
+ * last packet.  Called instead of pev_run() after initialization.
+ */
+int replay_run(char *arg)
+{
+	char *ifname;
+	int rc;
+
+	ifname = strrchr(arg, ',');
+	if (ifname) {
+		*ifname++ = 0;
+		rp.ifindex = if_nametoindex(ifname);
+		if (!rp.ifindex) {
+			logit(LOG_WARNING, 0, "No such interface %s", ifname);
+			return 1;
+		}
+	}
+
+	if (replay_open(arg))
+		return 1;
+
+	rc = replay_next();
+	if (rc <= 0) {
+		logit(LOG_WARNING, 0, "No packets in %s", arg);
+		rc = 1;
+		goto done;
+	}
+
+	rp.first   = rp.when;
+	rp.start   = pev_now();
+	rp.timerid = pev_timer_add_ns(1, 0, replay_step, NULL);
+	if (rp.timerid == -1) {
+		logit(LOG_WARNING, errno, "Failed creating replay timer");
+		rc = 1;
+		goto done;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &rp.begin);
+	rc = pev_run();
+done:
+	fclose(rp.fp);
+	free(rp.buf);
+	free(rp.ifs);
+
+	return rc;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
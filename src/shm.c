@@ -0,0 +1,213 @@
+/*
+ * Shared memory export of interface, querier and group state
+ *
+ * For local consumers that poll often, e.g., an HMI, even an IPC round
+ * trip per poll is too much.  When enabled, the state is published in
+ * a file in the run state directory, see shm.h for the layout, which
+ * readers map and copy without involving the daemon.
+ *
+ * The file is rewritten in place periodically, only memory writes, no
+ * system calls.  Every update rewrites all entries, also group expiry
+ * which changes on every refresh without bumping the state generation.
+ * Expiry is kept in monotonic time, it is translated to wall clock time
+ * when exported.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "defs.h"
+
+#define SHM_INTERVAL	1000000		/* usec, between updates */
+
+static char     *file;
+static uint8_t  *map;
+static size_t    len;
+static int       timerid;
+
+int shm_groups = 0;
+
+static void shm_write(struct shm_hdr *hdr)
+{
+	struct shm_iface *ifaces = (struct shm_iface *)(map + sizeof(*hdr));
+	struct shm_group *groups = (struct shm_group *)(ifaces + SHM_IFACES);
+	uint32_t num_ifaces = 0, num_groups = 0, truncated = 0;
+	time_t now = time(NULL);
+	struct ifi *ifi;
+
+	for (ifi = config_iface_iter(1); ifi; ifi = config_iface_iter(0)) {
+		struct shm_iface *si;
+		struct listaddr *g;
+
+		if (num_ifaces == SHM_IFACES) {
+			truncated++;
+			continue;
+		}
+
+		si = &ifaces[num_ifaces];
+		memset(si, 0, sizeof(*si));
+		strlcpy(si->sif_name, ifi->ifi_name, sizeof(si->sif_name));
+		si->sif_ifindex = ifi->ifi_ifindex;
+		si->sif_addr    = ifi->ifi_curr_addr;
+		if (!(ifi->ifi_flags & IFIF_DOWN))
+			si->sif_flags |= SHM_IF_UP;
+		if (ifi->ifi_flags & IFIF_DISABLED)
+			si->sif_flags |= SHM_IF_DISABLED;
+		if (ifi->ifi_flags & IFIF_QUERIER)
+			si->sif_flags |= SHM_IF_QUERIER;
+		if (ifi->ifi_flags & IFIF_PROXY_QUERIES)
+			si->sif_flags |= SHM_IF_PROXY;
+		if (ifi->ifi_querier) {
+			si->sif_querier         = ifi->ifi_querier->al_addr;
+			si->sif_querier_expires = now + querier_timeout(ifi);
+		}
+		if (ifi->ifi_flags & IFIF_IGMPV1)
+			si->sif_version = 1;
+		else if (ifi->ifi_flags & IFIF_IGMPV2)
+			si->sif_version = 2;
+		else
+			si->sif_version = 3;
+
+		TAILQ_FOREACH(g, &ifi->ifi_groups, al_link) {
+			struct shm_group *sg;
+
+			si->sif_groups++;
+			if (num_groups == (uint32_t)shm_groups) {
+				truncated++;
+				continue;
+			}
+
+			sg = &groups[num_groups++];
+			memset(sg, 0, sizeof(*sg));
+			sg->sgr_group    = g->al_addr;
+			sg->sgr_reporter = g->al_reporter;
+			sg->sgr_iface    = num_ifaces;
+			sg->sgr_version  = g->al_pv;
+			sg->sgr_expires  = now + group_expires(g);
+		}
+
+		num_ifaces++;
+	}
+
+	hdr->sh_gen        = state_gen;
+	hdr->sh_num_ifaces = num_ifaces;
+	hdr->sh_num_groups = num_groups;
+	hdr->sh_truncated  = truncated;
+	hdr->sh_updated    = now;
+}
+
+/*
+ * Writer side of the seqlock, odd sequence while the tables are being
+ * updated.  There is only one writer, the event loop.
+ */
+static void shm_update(int period, void *arg)
+{
+	struct shm_hdr *hdr = (struct shm_hdr *)map;
+	uint32_t seq;
+
+	(void)period;
+	(void)arg;
+
+	seq = hdr->sh_seq;
+	__atomic_store_n(&hdr->sh_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	shm_write(hdr);
+
+	__atomic_store_n(&hdr->sh_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Create the file with room for SHM_IFACES interfaces and shm-groups
+ * groups.  Does nothing unless shm-groups is set in the .conf file.
+ */
+void shm_init(void)
+{
+	struct shm_hdr *hdr;
+	int fd;
+
+	if (!shm_groups)
+		return;
+
+	if (asprintf(&file, _PATH_QUERIERD_SHM, ident) == -1) {
+		logit(LOG_WARNING, errno, "Failed allocating shared memory path");
+		file = NULL;
+		return;
+	}
+
+	len = sizeof(*hdr) + SHM_IFACES * sizeof(struct shm_iface) +
+		(size_t)shm_groups * sizeof(struct shm_group);
+
+	/* New file every time, readers of the old one see it go stale */
+	unlink(file);
+	fd = open(file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1 || ftruncate(fd, len)) {
+		logit(LOG_WARNING, errno, "Failed creating %s, shared memory export disabled", file);
+		goto fail;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		logit(LOG_WARNING, errno, "Failed mapping %s, shared memory export disabled", file);
+		map = NULL;
+		goto fail;
+	}
+	close(fd);
+
+	hdr = (struct shm_hdr *)map;
+	hdr->sh_version    = SHM_VERSION;
+	hdr->sh_hdrsz      = sizeof(*hdr);
+	hdr->sh_ifsz       = sizeof(struct shm_iface);
+	hdr->sh_grpsz      = sizeof(struct shm_group);
+	hdr->sh_max_ifaces = SHM_IFACES;
+	hdr->sh_max_groups = shm_groups;
+	hdr->sh_pid        = getpid();
+	shm_update(0, NULL);
+	__atomic_store_n(&hdr->sh_magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+	timerid = pev_timer_add(0, SHM_INTERVAL, shm_update, NULL);
+	if (timerid == -1)
+		logit(LOG_WARNING, errno, "Failed creating shared memory update timer");
+
+	logit(LOG_DEBUG, 0, "Exporting state in %s, %zu bytes", file, len);
+	return;
+fail:
+	if (fd != -1)
+		close(fd);
+	unlink(file);
+	free(file);
+	file = NULL;
+}
+
+/* Magic is cleared, readers of the old mapping open the file again */
+void shm_exit(void)
+{
+	if (timerid > 0)
+		pev_timer_del(timerid);
+	timerid = 0;
+
+	if (map) {
+		struct shm_hdr *hdr = (struct shm_hdr *)map;
+
+		__atomic_store_n(&hdr->sh_magic, 0, __ATOMIC_RELEASE);
+		munmap(map, len);
+		map = NULL;
+	}
+
+	if (file) {
+		unlink(file);
+		free(file);
+		file = NULL;
+	}
+
+	shm_groups = 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
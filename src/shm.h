@@ -0,0 +1,106 @@
+/*
+ * Shared memory export of interface, querier and group state.  Shared
+ * between the daemon, which writes, and readers like querierctl.
+ *
+ * The file is created by querierd, its size is fixed for the lifetime
+ * of the daemon: header, interface table, group table.  Readers map it
+ * read-only and copy a consistent snapshot, guarded by the sequence
+ * counter in the header, without any system call or help from the
+ * daemon.  See shmread.c for the reader side.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+#ifndef QUERIERD_SHM_H_
+#define QUERIERD_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_MAGIC		0x51534d48	/* "QSMH" */
+#define SHM_VERSION		1
+#define SHM_IFACES		1024		/* Interface table size */
+
+/*
+ * Header, at offset 0.  The interface table follows at sh_hdrsz, the
+ * group table after sh_max_ifaces interface entries.  Sequence is odd
+ * while the daemon updates, a reader retries if it was odd or changed
+ * during the copy.  Magic is cleared when querierd exits or reloads,
+ * readers must then map the file again.
+ */
+struct shm_hdr {
+	uint32_t sh_magic;
+	uint16_t sh_version;
+	uint16_t sh_hdrsz;
+	uint32_t sh_seq;		/* Seqlock                          */
+	uint32_t sh_gen;		/* Bumped on state changes          */
+	uint16_t sh_ifsz;		/* sizeof(struct shm_iface)         */
+	uint16_t sh_grpsz;		/* sizeof(struct shm_group)         */
+	uint32_t sh_max_ifaces;
+	uint32_t sh_max_groups;
+	uint32_t sh_num_ifaces;
+	uint32_t sh_num_groups;
+	uint32_t sh_truncated;		/* Entries that did not fit         */
+	uint32_t sh_pid;
+	uint32_t sh_pad;
+	int64_t  sh_updated;		/* Wall clock time of last update   */
+};
+
+#define SHM_IF_UP		0x01
+#define SHM_IF_DISABLED		0x02
+#define SHM_IF_QUERIER		0x04	/* We are the elected querier */
+#define SHM_IF_PROXY		0x08	/* Proxy queries enabled      */
+
+/*
+ * Addresses in network byte order, times are wall clock seconds, 0 if
+ * not applicable.
+ */
+struct shm_iface {
+	char     sif_name[16];
+	int32_t  sif_ifindex;
+	uint32_t sif_flags;
+	uint32_t sif_addr;		/* Our address                      */
+	uint32_t sif_querier;		/* Other querier, 0 if none         */
+	int64_t  sif_querier_expires;
+	uint16_t sif_version;		/* IGMP version                     */
+	uint16_t sif_pad;
+	uint32_t sif_groups;		/* Number of groups                 */
+};
+
+struct shm_group {
+	uint32_t sgr_group;
+	uint32_t sgr_reporter;
+	uint16_t sgr_iface;		/* Index in interface table         */
+	uint8_t  sgr_version;		/* IGMP version of last report      */
+	uint8_t  sgr_pad;
+	uint32_t sgr_pad2;
+	int64_t  sgr_expires;
+};
+
+/*
+ * Reader API.  A snapshot points into the reader's private copy, it is
+ * valid until the next read or close.  On error NULL is returned and
+ * errno set: EAGAIN if the daemon was busy updating for too long, try
+ * again later, ESTALE if querierd has exited or reloaded, close and
+ * open again, and EPROTO on unknown format.
+ */
+struct shm_snap {
+	struct shm_hdr    hdr;
+	struct shm_iface *ifaces;
+	struct shm_group *groups;
+};
+
+struct shm_reader;
+
+struct shm_reader     *shm_reader_open  (const char *file);
+const struct shm_snap *shm_reader_read  (struct shm_reader *r);
+void                   shm_reader_close (struct shm_reader *r);
+
+#endif /* QUERIERD_SHM_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
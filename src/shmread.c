@@ -0,0 +1,145 @@
+/*
+ * Shared memory export, reader side
+ *
+ * Self-contained, only depends on shm.h, for use also in applications
+ * other than querierctl.  Reading a snapshot is a few memcpy() into a
+ * private buffer, allocated when opening, no system calls.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm.h"
+
+#define SHM_RETRIES 10000		/* Spins before giving up, EAGAIN */
+
+struct shm_reader {
+	const uint8_t  *map;
+	size_t          len;
+	struct shm_snap snap;
+};
+
+struct shm_reader *shm_reader_open(const char *file)
+{
+	struct shm_reader *r;
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct shm_hdr)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		close(fd);
+		return NULL;
+	}
+
+	r->len = st.st_size;
+	r->map = mmap(NULL, r->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r->map == MAP_FAILED) {
+		free(r);
+		return NULL;
+	}
+
+	/* Tables are copied to one buffer, same layout as the file */
+	r->snap.ifaces = malloc(r->len);
+	if (!r->snap.ifaces) {
+		munmap((void *)r->map, r->len);
+		free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/* Header fields we depend on, checked on every copy */
+static int valid(struct shm_reader *r, const struct shm_hdr *hdr)
+{
+	size_t tables;
+
+	if (hdr->sh_magic != SHM_MAGIC)
+		return ESTALE;
+	if (hdr->sh_version != SHM_VERSION || hdr->sh_hdrsz != sizeof(*hdr) ||
+	    hdr->sh_ifsz != sizeof(struct shm_iface) || hdr->sh_grpsz != sizeof(struct shm_group))
+		return EPROTO;
+
+	tables = (size_t)hdr->sh_max_ifaces * hdr->sh_ifsz + (size_t)hdr->sh_max_groups * hdr->sh_grpsz;
+	if (hdr->sh_hdrsz + tables > r->len ||
+	    hdr->sh_num_ifaces > hdr->sh_max_ifaces || hdr->sh_num_groups > hdr->sh_max_groups)
+		return EPROTO;
+
+	return 0;
+}
+
+const struct shm_snap *shm_reader_read(struct shm_reader *r)
+{
+	const struct shm_hdr *hdr = (const struct shm_hdr *)r->map;
+	struct shm_snap *snap = &r->snap;
+
+	for (int i = 0; i < SHM_RETRIES; i++) {
+		const uint8_t *ifaces, *groups;
+		uint32_t seq;
+		int err;
+
+		seq = __atomic_load_n(&hdr->sh_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		memcpy(&snap->hdr, hdr, sizeof(*hdr));
+		err = valid(r, &snap->hdr);
+		if (err) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&hdr->sh_seq, __ATOMIC_RELAXED) != seq)
+				continue;
+			errno = err;
+			return NULL;
+		}
+
+		ifaces = r->map + snap->hdr.sh_hdrsz;
+		groups = ifaces + (size_t)snap->hdr.sh_max_ifaces * snap->hdr.sh_ifsz;
+		snap->groups = (struct shm_group *)(snap->ifaces + snap->hdr.sh_max_ifaces);
+
+		memcpy(snap->ifaces, ifaces, (size_t)snap->hdr.sh_num_ifaces * snap->hdr.sh_ifsz);
+		memcpy(snap->groups, groups, (size_t)snap->hdr.sh_num_groups * snap->hdr.sh_grpsz);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hdr->sh_seq, __ATOMIC_RELAXED) == seq)
+			return snap;
+	}
+
+	errno = EAGAIN;
+	return NULL;
+}
+
+void shm_reader_close(struct shm_reader *r)
+{
+	if (!r)
+		return;
+
+	munmap((void *)r->map, r->len);
+	free(r->snap.ifaces);
+	free(r);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,424 @@
+/*
+ * Simulation mode, runs a scenario on a virtual clock
+ *
+ * The scenario is a text file, one event per line, each starting with a
+ * time stamp in seconds, fractions allowed, from the start of the run.
+ * A leading '+' makes the time relative to the previous event.  IGMP
+ * messages are built and injected into accept_igmp() as if received on
+ * the given interface, show commands print daemon state to stdout:
+ *
+ *     # time  event
+ *     0       query  eth0 192.168.0.2 v2
+ *     1       report eth0 192.168.0.10 v2 225.1.2.3
+ *     +260    show interfaces
+ *     +300    show groups
+ *     3600    end
+ *
+ * Events:
+ *     query  IFNAME SRC [v1|v2|v3] [GROUP]   default v3 general query
+ *     report IFNAME SRC v1|v2|v3 GROUP       v3 is a TO_EX {} record
+ *     leave  IFNAME SRC [v2|v3] GROUP        v3 is a TO_IN {} record
+ *     show   ...                             any IPC show command
+ *     end                                    stop, default after last
+ *
+ * The event loop runs on a virtual clock, see pev_virtual(), so hours
+ * of protocol time, e.g., version fallback and querier timeouts, take
+ * milliseconds.  Interfaces are still real, from the kernel, but IGMP
+ * is neither sent nor received on them, see igmp_sendto().
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <ctype.h>
+#include "defs.h"
+
+#define SIM_EVENT_MAX	256		/* Length of scenario line */
+
+enum {
+	SIM_QUERY,
+	SIM_REPORT,
+	SIM_LEAVE,
+	SIM_SHOW,
+	SIM_END
+};
+
+struct sim_event {
+	uint64_t when;			/* nsec from start */
+	int      type;
+	int      ifindex;
+	int      version;
+	uint32_t src;
+	uint32_t group;
+	char    *cmd;			/* show command */
+	int      line;
+};
+
+static struct sim_event *events;
+static size_t num_events;
+static size_t next_event;
+static uint64_t start;
+static int timerid;
+
+static int sim_version(const char *arg)
+{
+	if (!strcasecmp(arg, "v1"))
+		return 1;
+	if (!strcasecmp(arg, "v2"))
+		return 2;
+	if (!strcasecmp(arg, "v3"))
+		return 3;
+
+	return 0;
+}
+
+static int sim_addr(const char *arg, uint32_t *addr)
+{
+	struct in_addr ina;
+
+	if (!arg || inet_pton(AF_INET, arg, &ina) != 1)
+		return -1;
+	*addr = ina.s_addr;
+
+	return 0;
+}
+
+/*
+ * Parse one scenario line into ev, the time stamp is already consumed.
+ * Returns -1 on error.
+ */
+static int sim_parse(struct sim_event *ev, char *line)
+{
+	char *argv[6], *save = NULL;
+	int argc = 0, pos;
+
+	line += strspn(line, " \t");
+	if (!strncmp(line, "show", 4)) {
+		char *cmd;
+
+		/* One space between words, like querierctl sends */
+		cmd = calloc(1, strlen(line) + 1);
+		if (!cmd)
+			return -1;
+		for (char *arg = strtok_r(line, " \t", &save); arg; arg = strtok_r(NULL, " \t", &save)) {
+			if (*cmd)
+				strcat(cmd, " ");
+			strcat(cmd, arg);
+		}
+
+		ev->type = SIM_SHOW;
+		ev->cmd  = cmd;
+		return 0;
+	}
+
+	for (char *arg = strtok_r(line, " \t", &save); arg && argc < 6; arg = strtok_r(NULL, " \t", &save))
+		argv[argc++] = arg;
+	if (!argc)
+		return -1;
+
+	if (!strcmp(argv[0], "end")) {
+		ev->type = SIM_END;
+		return 0;
+	}
+
+	if (!strcmp(argv[0], "query"))
+		ev->type = SIM_QUERY;
+	else if (!strcmp(argv[0], "report"))
+		ev->type = SIM_REPORT;
+	else if (!strcmp(argv[0], "leave"))
+		ev->type = SIM_LEAVE;
+	else
+		return -1;
+
+	if (argc < 3)
+		return -1;
+	ev->ifindex = if_nametoindex(argv[1]);
+	if (!ev->ifindex || sim_addr(argv[2], &ev->src))
+		return -1;
+
+	/* Optional version, defaults depend on event */
+	pos = 3;
+	ev->version = pos < argc ? sim_version(argv[pos]) : 0;
+	if (ev->version)
+		pos++;
+	else
+		ev->version = ev->type == SIM_LEAVE ? 2 : 3;
+
+	if (pos < argc && sim_addr(argv[pos++], &ev->group))
+		return -1;
+	if (ev->type != SIM_QUERY && !ev->group)
+		return -1;
+	if (ev->type == SIM_LEAVE && ev->version == 1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Read the whole scenario up front, so errors are reported before the
+ * run starts.  Time stamps must not go backwards.
+ */
+static int sim_load(const char *file)
+{
+	char line[SIM_EVENT_MAX];
+	uint64_t prev = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		logit(LOG_WARNING, errno, "Failed opening scenario %s", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct sim_event *ev;
+		char *ptr, *end;
+		double when;
+		int rel = 0;
+
+		lineno++;
+		line[strcspn(line, "\r\n#")] = 0;
+		ptr = line + strspn(line, " \t");
+		if (!*ptr)
+			continue;
+
+		if (*ptr == '+') {
+			rel = 1;
+			ptr++;
+		}
+		when = strtod(ptr, &end);
+		if (end == ptr || when < 0 || !isspace((unsigned char)*end))
+			goto fail;
+
+		ev = realloc(events, (num_events + 1) * sizeof(*ev));
+		if (!ev) {
+			logit(LOG_WARNING, errno, "Failed allocating scenario");
+			fclose(fp);
+			return -1;
+		}
+		events = ev;
+		ev = &events[num_events];
+		memset(ev, 0, sizeof(*ev));
+		ev->line = lineno;
+		ev->when = (uint64_t)(when * PEV_NSEC_PER_SEC);
+		if (rel)
+			ev->when += prev;
+		if (ev->when < prev || sim_parse(ev, end))
+			goto fail;
+
+		prev = ev->when;
+		num_events++;
+	}
+	fclose(fp);
+
+	return 0;
+fail:
+	logit(LOG_WARNING, 0, "%s:%d: invalid scenario event", file, lineno);
+	fclose(fp);
+	return -1;
+}
+
+/* IP header with router alert, IGMP follows, in the input buffer */
+static uint8_t *sim_ip(uint32_t src, uint32_t dst, size_t igmplen, size_t *len)
+{
+	struct ip *ip = (struct ip *)recv_buf;
+	uint8_t *opt = recv_buf + sizeof(*ip);
+
+	*len = sizeof(*ip) + 4 + igmplen;
+	memset(recv_buf, 0, *len);
+
+	ip->ip_v   = IPVERSION;
+	ip->ip_hl  = (sizeof(*ip) + 4) >> 2;
+	ip->ip_len = htons(*len);
+	ip->ip_ttl = 1;
+	ip->ip_p   = IPPROTO_IGMP;
+	ip->ip_src.s_addr = src;
+	ip->ip_dst.s_addr = dst;
+
+	opt[0] = IPOPT_RA;
+	opt[1] = 4;
+
+	return opt + 4;
+}
+
+static void sim_inject(struct sim_event *ev)
+{
+	struct igmpv3_report *report;
+	struct igmpv3_query *query;
+	struct igmpv3_grec *rec;
+	struct igmp *igmp;
+	uint8_t *buf;
+	size_t len;
+
+	switch (ev->type) {
+	case SIM_QUERY:
+		if (ev->version == 3) {
+			buf = sim_ip(ev->src, ev->group ? ev->group : allhosts_group, sizeof(*query), &len);
+			query = (struct igmpv3_query *)buf;
+			query->type  = IGMP_MEMBERSHIP_QUERY;
+			query->code  = igmp_response_interval * IGMP_TIMER_SCALE;
+			query->group = ev->group;
+			query->qrv   = igmp_robustness;
+			query->qqic  = MIN(igmp_query_interval, 127); /* no floating point */
+			query->csum  = inet_cksum((uint16_t *)query, sizeof(*query));
+			break;
+		}
+
+		buf = sim_ip(ev->src, ev->group ? ev->group : allhosts_group, IGMP_MINLEN, &len);
+		igmp = (struct igmp *)buf;
+		igmp->igmp_type = IGMP_MEMBERSHIP_QUERY;
+		igmp->igmp_code = ev->version == 1 ? 0 : igmp_response_interval * IGMP_TIMER_SCALE;
+		igmp->igmp_group.s_addr = ev->group;
+		igmp->igmp_cksum = inet_cksum((uint16_t *)igmp, IGMP_MINLEN);
+		break;
+
+	case SIM_REPORT:
+	case SIM_LEAVE:
+		if (ev->version == 3) {
+			buf = sim_ip(ev->src, allreports_group, sizeof(*report) + sizeof(*rec), &len);
+			report = (struct igmpv3_report *)buf;
+			report->type   = IGMP_V3_MEMBERSHIP_REPORT;
+			report->ngrec  = htons(1);
+			rec = (struct igmpv3_grec *)report->grec;
+			rec->grec_type = ev->type == SIM_LEAVE ? IGMP_CHANGE_TO_INCLUDE_MODE
+				: IGMP_CHANGE_TO_EXCLUDE_MODE;
+			rec->grec_mca  = ev->group;
+			report->csum   = inet_cksum((uint16_t *)report, sizeof(*report) + sizeof(*rec));
+			break;
+		}
+
+		buf = sim_ip(ev->src, ev->type == SIM_LEAVE ? allrtrs_group : ev->group, IGMP_MINLEN, &len);
+		igmp = (struct igmp *)buf;
+		if (ev->type == SIM_LEAVE)
+			igmp->igmp_type = IGMP_V2_LEAVE_GROUP;
+		else if (ev->version == 1)
+			igmp->igmp_type = IGMP_V1_MEMBERSHIP_REPORT;
+		else
+			igmp->igmp_type = IGMP_V2_MEMBERSHIP_REPORT;
+		igmp->igmp_group.s_addr = ev->group;
+		igmp->igmp_cksum = inet_cksum((uint16_t *)igmp, IGMP_MINLEN);
+		break;
+
+	default:
+		return;
+	}
+
+	accept_igmp(ev->ifindex, len);
+}
+
+/* Show command output on stdout, with table headings like querierctl -p */
+void sim_print(const char *cmd)
+{
+	char *buf = NULL, *ptr, *line;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp)
+		return;
+	if (ipc_print(fp, cmd))
+		fprintf(fp, "Invalid command\n");
+	fclose(fp);
+
+	for (ptr = buf; (line = strsep(&ptr, "\n")) && (*line || ptr);) {
+		size_t n = strlen(line);
+
+		if (n > 0 && line[n - 1] == '=') {
+			line[n - 1] = 0;
+			printf("%s\n%.*s\n", line, 79,
+			       "-------------------------------------------------------------------------------");
+			continue;
+		}
+		puts(line);
+	}
+	fflush(stdout);
+	free(buf);
+}
+
+static void sim_show(struct sim_event *ev)
+{
+	printf(">> %.3f %s\n", (double)ev->when / PEV_NSEC_PER_SEC, ev->cmd);
+	sim_print(ev->cmd);
+}
+
+/* Run all events that are due, then sleep until the next one */
+static void sim_step(int timeout, void *arg)
+{
+	uint64_t elapsed = pev_now() - start;
+
+	(void)timeout;
+	(void)arg;
+
+	while (next_event < num_events && events[next_event].when <= elapsed) {
+		struct sim_event *ev = &events[next_event++];
+
+		switch (ev->type) {
+		case SIM_SHOW:
+			sim_show(ev);
+			break;
+
+		case SIM_END:
+			next_event = num_events;
+			quit(0);
+			return;
+
+		default:
+			sim_inject(ev);
+			break;
+		}
+	}
+
+	if (next_event == num_events) {
+		quit(0);
+		return;
+	}
+
+	pev_timer_set_ns(timerid, events[next_event].when - elapsed);
+}
+
+/*
+ * Load scenario and run the event loop until the scenario ends.  Called
+ * instead of pev_run(), main() enables the virtual clock before igmp_init().
+ */
+int sim_run(const char *file)
+{
+	struct timespec begin, end;
+	int rc;
+
+	if (sim_load(file)) {
+		rc = 1;
+		goto done;
+	}
+
+	start = pev_now();
+
+	/* Events at time zero run when the loop starts */
+	timerid = pev_timer_add_ns(num_events && events[0].when ? events[0].when : 1, 0, sim_step, NULL);
+	if (timerid == -1) {
+		logit(LOG_WARNING, errno, "Failed creating simulation timer");
+		rc = 1;
+		goto done;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	rc = pev_run();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	logit(LOG_NOTICE, 0, "Simulated %.3f sec in %.3f sec, %zu events", (double)(pev_now() - start) / PEV_NSEC_PER_SEC,
+	      (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9, num_events);
+
+done:
+	for (size_t i = 0; i < num_events; i++)
+		free(events[i].cmd);
+	free(events);
+
+	return rc;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
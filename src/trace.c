@@ -0,0 +1,222 @@
+/*
+ * In-memory flight recorder for protocol events
+ *
+ * Always on, fixed size ring of compact binary records.  Recording an
+ * event is a 32 byte store, time stamped with the event loop's cached
+ * monotonic time, so events from the same loop iteration have the same
+ * time and are ordered by sequence number.  The oldest records are
+ * overwritten when the ring wraps.  The ring is dumped in binary form,
+ * on IPC request or SIGUSR1, and decoded by querierctl.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+
+#include <fcntl.h>
+#include "defs.h"
+
+#define TRACE_MASK (TRACE_RECORDS - 1)
+
+static struct trace_rec ring[TRACE_RECORDS];
+static uint32_t head;
+
+static uint64_t clock_ns(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void trace(int type, int arg, int err, int ifindex, uint32_t group, uint32_t src, int timerid)
+{
+	struct trace_rec *rec;
+	uint32_t seq;
+
+	seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+	rec = &ring[seq & TRACE_MASK];
+
+	rec->tr_time    = pev_now();
+	rec->tr_seq     = seq;
+	rec->tr_type    = type;
+	rec->tr_arg     = arg;
+	rec->tr_err     = err;
+	rec->tr_ifindex = ifindex;
+	rec->tr_group   = group;
+	rec->tr_source  = src;
+	rec->tr_timerid = timerid;
+}
+
+static int writen(int fd, struct iovec *iov, int cnt)
+{
+	while (cnt > 0) {
+		ssize_t len;
+
+		len = writev(fd, iov, cnt);
+		if (len == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+
+		while (cnt > 0 && (size_t)len >= iov->iov_len) {
+			len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Header and all records, oldest first, as three iovecs.  The header
+ * is filled in by the caller.
+ */
+static void trace_iov(struct trace_hdr *hdr, struct iovec iov[3])
+{
+	uint32_t pos, total;
+
+	total = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	pos   = total & TRACE_MASK;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->th_magic   = TRACE_MAGIC;
+	hdr->th_version = TRACE_VERSION;
+	hdr->th_recsz   = sizeof(struct trace_rec);
+	hdr->th_count   = MIN(total, TRACE_RECORDS);
+	hdr->th_total   = total;
+	hdr->th_mono    = pev_now();
+	hdr->th_real    = clock_ns(CLOCK_REALTIME);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len  = sizeof(*hdr);
+	if (total < TRACE_RECORDS) {
+		iov[1].iov_base = ring;
+		iov[1].iov_len  = pos * sizeof(struct trace_rec);
+		iov[2].iov_base = NULL;
+		iov[2].iov_len  = 0;
+	} else {
+		iov[1].iov_base = &ring[pos];
+		iov[1].iov_len  = (TRACE_RECORDS - pos) * sizeof(struct trace_rec);
+		iov[2].iov_base = ring;
+		iov[2].iov_len  = pos * sizeof(struct trace_rec);
+	}
+}
+
+/*
+ * Write flight recorder to fd
+ */
+int trace_dump(int fd)
+{
+	struct trace_hdr hdr;
+	struct iovec iov[3];
+
+	trace_iov(&hdr, iov);
+
+	return writen(fd, iov, NELEMS(iov));
+}
+
+/*
+ * Write flight recorder to stream, e.g., an IPC reply
+ */
+int trace_write(FILE *fp)
+{
+	struct trace_hdr hdr;
+	struct iovec iov[3];
+
+	trace_iov(&hdr, iov);
+	for (size_t i = 0; i < NELEMS(iov); i++) {
+		if (iov[i].iov_len && fwrite(iov[i].iov_base, iov[i].iov_len, 1, fp) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static const char *trace_event(int type)
+{
+	switch (type) {
+	case TRACE_RX:              return "rx";
+	case TRACE_TX:              return "tx";
+	case TRACE_TX_PROXY:        return "tx-proxy";
+	case TRACE_ELECT:           return "election";
+	case TRACE_QUERIER_TIMEOUT: return "querier-timeout";
+	case TRACE_GROUP_ADD:       return "group-add";
+	case TRACE_GROUP_LEAVE:     return "group-leave";
+	case TRACE_GROUP_EXPIRE:    return "group-expire";
+	case TRACE_IFACE_UP:        return "iface-up";
+	case TRACE_IFACE_DOWN:      return "iface-down";
+	default:                    return "unknown";
+	}
+}
+
+/*
+ * Flight recorder as JSON members "total" and "events", oldest first.
+ * Record time stamps are translated to wall clock time, in ns.
+ */
+void trace_json(struct json *j)
+{
+	struct trace_hdr hdr;
+	struct iovec iov[3];
+
+	trace_iov(&hdr, iov);
+	json_int(j, "total", hdr.th_total);
+	json_arr(j, "events");
+	for (size_t i = 1; i < NELEMS(iov); i++) {
+		struct trace_rec *rec = iov[i].iov_base;
+		size_t num = iov[i].iov_len / sizeof(*rec);
+
+		for (size_t k = 0; k < num; k++, rec++) {
+			char ifname[IF_NAMESIZE];
+
+			json_obj(j, NULL);
+			json_int(j, "seq", rec->tr_seq);
+			json_int(j, "time", hdr.th_real - (hdr.th_mono - rec->tr_time));
+			json_str(j, "event", trace_event(rec->tr_type));
+			json_int(j, "arg", rec->tr_arg);
+			json_int(j, "error", rec->tr_err);
+			json_str(j, "iface", if_indextoname(rec->tr_ifindex, ifname));
+			json_str(j, "group", rec->tr_group ? inet_fmt(rec->tr_group, s1, sizeof(s1)) : NULL);
+			json_str(j, "source", rec->tr_source ? inet_fmt(rec->tr_source, s2, sizeof(s2)) : NULL);
+			json_int(j, "timer", rec->tr_timerid);
+			json_close(j);
+		}
+	}
+	json_close(j);
+}
+
+/*
+ * Save flight recorder to file, on SIGUSR1
+ */
+void trace_save(void)
+{
+	char file[256];
+	int fd;
+
+	snprintf(file, sizeof(file), _PATH_QUERIERD_TRACE, ident);
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		logit(LOG_WARNING, errno, "Failed creating %s", file);
+		return;
+	}
+
+	if (trace_dump(fd))
+		logit(LOG_WARNING, errno, "Failed saving flight recorder to %s", file);
+	else
+		logit(LOG_NOTICE, 0, "Flight recorder saved to %s", file);
+
+	close(fd);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
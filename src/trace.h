@@ -0,0 +1,75 @@
+/*
+ * In-memory flight recorder for protocol events.  Shared between the
+ * daemon, which records, and querierctl, which decodes the dump.
+ *
+ * This file is covered by the license in the accompanying file named
+ * "LICENSE".
+ */
+#ifndef QUERIERD_TRACE_H_
+#define QUERIERD_TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_MAGIC		0x51545243	/* "QTRC" */
+#define TRACE_VERSION		1
+
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS		4096		/* Must be a power of two */
+#endif
+
+enum {
+	TRACE_NONE = 0,
+	TRACE_RX,			/* arg: IGMP type                    */
+	TRACE_TX,			/* arg: IGMP type, err: errno        */
+	TRACE_TX_PROXY,			/* err: errno                        */
+	TRACE_ELECT,			/* arg: 1 won, 0 lost, src: querier  */
+	TRACE_QUERIER_TIMEOUT,		/* src: old querier                  */
+	TRACE_GROUP_ADD,		/* arg: version, src: reporter       */
+	TRACE_GROUP_LEAVE,		/* src: host leaving                 */
+	TRACE_GROUP_EXPIRE,
+	TRACE_IFACE_UP,
+	TRACE_IFACE_DOWN,
+	TRACE_MAX
+};
+
+/*
+ * One event, 32 bytes.  Addresses in network byte order, time is
+ * pev_now() in nanoseconds, i.e., CLOCK_MONOTONIC, or the virtual
+ * clock when simulating or replaying.
+ */
+struct trace_rec {
+	uint64_t tr_time;
+	uint32_t tr_seq;
+	uint8_t  tr_type;
+	uint8_t  tr_arg;
+	uint16_t tr_err;
+	int32_t  tr_ifindex;
+	uint32_t tr_group;
+	uint32_t tr_source;
+	int32_t  tr_timerid;
+};
+
+/*
+ * Dump header, followed by th_count records, oldest first.  The two
+ * clock samples are taken at the time of the dump so the decoder can
+ * translate record time stamps to wall clock time.  th_mono is from
+ * the same clock as the records, see pev_now().
+ */
+struct trace_hdr {
+	uint32_t th_magic;
+	uint16_t th_version;
+	uint16_t th_recsz;
+	uint32_t th_count;
+	uint32_t th_total;		/* Events recorded since start */
+	uint64_t th_mono;
+	uint64_t th_real;
+};
+
+#endif /* QUERIERD_TRACE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Verifies offline replay of a capture file: packets are fed to querierd
+# at their capture time, and the group table at the end is reported.
+# The capture is a classic pcap, raw IPv4, with no interface names.
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+# Hex bytes to binary, POSIX printf only does octal escapes
+bytes()
+{
+    for b in "$@"; do
+	# shellcheck disable=SC2059
+	printf "\\$(printf %03o "0x$b")"
+    done
+}
+
+# Record header, little endian: sec, usec, captured and original length
+rec()
+{
+    bytes "$(printf %02x "$1")" 00 00 00  00 00 00 00  20 00 00 00  20 00 00 00
+}
+
+print "Creating world ..."
+for i in 0 1; do
+    ip link add eth$i type veth peer peer$i
+    ip link set eth$i up
+    ip link set peer$i up
+done
+ip addr add 192.168.0.1/24 dev eth0
+ip addr add 192.168.1.1/24 dev eth1
+
+ip -br l
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/config"
+iface eth0 enable igmpv3
+iface eth1 enable igmpv2
+EOF
+cat "/tmp/$NM/config"
+
+print "Creating capture ..."
+{
+    # Magic, version 2.4, zone, sigfigs, snaplen, LINKTYPE_RAW
+    bytes d4 c3 b2 a1  02 00 04 00  00 00 00 00  00 00 00 00  ff ff 00 00  65 00 00 00
+
+    # IGMPv2 report 225.1.2.3 from 192.168.0.10
+    rec 0
+    bytes 46 c0 00 20 00 00 00 00 01 02 80 61 c0 a8 00 0a e1 01 02 03 94 04 00 00 16 00 06 fb e1 01 02 03
+    # IGMPv2 report 225.1.2.4 from 192.168.0.11, then leave
+    rec 1
+    bytes 46 c0 00 20 00 00 00 00 01 02 80 5f c0 a8 00 0b e1 01 02 04 94 04 00 00 16 00 06 fa e1 01 02 04
+    rec 2
+    bytes 46 c0 00 20 00 00 00 00 01 02 83 62 c0 a8 00 0b e0 00 00 02 94 04 00 00 17 00 05 fa e1 01 02 04
+    # IGMPv1 report 225.1.2.5 from 192.168.0.12
+    rec 10
+    bytes 46 c0 00 20 00 00 00 00 01 02 80 5d c0 a8 00 0c e1 01 02 05 94 04 00 00 12 00 0a f9 e1 01 02 05
+} > "/tmp/$NM/capture.pcap"
+
+print "Replaying capture ..."
+../src/querierd -f "/tmp/$NM/config" -R "/tmp/$NM/capture.pcap,eth0" > "/tmp/$NM/result" || FAIL
+cat "/tmp/$NM/result"
+
+print "Analyzing ..."
+grep -q "IGMP packets *: 4"       "/tmp/$NM/result" || FAIL "Not all packets replayed"
+grep -q "Capture time *: 10.000"  "/tmp/$NM/result" || FAIL "Wrong capture time"
+grep -q "eth0 .* 225.1.2.3 .* 2 " "/tmp/$NM/result" || FAIL "Missing IGMPv2 group"
+grep -q "eth0 .* 225.1.2.5 .* 1 " "/tmp/$NM/result" || FAIL "Missing IGMPv1 group"
+grep -q "225.1.2.4"               "/tmp/$NM/result" && FAIL "Group not left"
+
+OK
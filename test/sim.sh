@@ -0,0 +1,71 @@
+#!/bin/sh
+# Verifies protocol timers in simulation mode, on a virtual clock:
+# querier election and timeout, version fallback, and group expiry.
+# Two hours of protocol time, runs in well under a second.
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+for i in 0 1; do
+    ip link add eth$i type veth peer peer$i
+    ip link set eth$i up
+    ip link set peer$i up
+done
+ip addr add 192.168.0.1/24 dev eth0
+ip addr add 192.168.1.1/24 dev eth1
+
+ip -br l
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/config"
+iface eth0 enable igmpv3
+iface eth1 enable igmpv2
+EOF
+cat "/tmp/$NM/config"
+
+print "Creating scenario ..."
+cat <<EOF > "/tmp/$NM/scenario"
+# Other querier, lower address, on eth1 goes silent after one query.
+# IGMPv1 host on IGMPv3 interface, then only IGMPv3 reports.
+0      query  eth1 192.168.1.0 v2
+0      report eth0 192.168.0.10 v1 225.1.2.3
+10     show   interfaces
+100    report eth0 192.168.0.11 v3 225.1.2.3
+150    show   groups
+200    report eth0 192.168.0.11 v3 225.1.2.3
+300    report eth0 192.168.0.11 v3 225.1.2.3
+300    show   interfaces
+301    show   groups
+400    report eth0 192.168.0.11 v3 225.1.2.3
+500    report eth0 192.168.0.11 v3 225.1.2.3
+600    report eth0 192.168.0.11 v3 225.1.2.3
+601    show   groups
+# Leave, and expiry of group with no more reports
+700    report eth1 192.168.1.7 v2 225.9.9.9
+701    leave  eth1 192.168.1.7 225.9.9.9
+710    show   groups
+7200   show   groups
+EOF
+cat "/tmp/$NM/scenario"
+
+print "Running simulation ..."
+../src/querierd -f "/tmp/$NM/config" -S "/tmp/$NM/scenario" > "/tmp/$NM/result" || FAIL
+cat "/tmp/$NM/result"
+
+print "Analyzing ..."
+at()
+{
+    sed -n "/^>> $1/,/^>>/p" "/tmp/$NM/result"
+}
+
+at "10.000 show interfaces"  | grep eth1 | grep -q "192.168.1.0" || FAIL "Not lost election"
+at "300.000 show interfaces" | grep eth1 | grep -q "192.168.1.1" || FAIL "Not querier after timeout"
+at "150.000 show groups"     | grep -q "225.1.2.3 .* 1 "         || FAIL "Not in IGMPv1 mode"
+at "301.000 show groups"     | grep -q "225.1.2.3 .* 2 "         || FAIL "Not in IGMPv2 mode"
+at "601.000 show groups"     | grep -q "225.1.2.3 .* 3 "         || FAIL "Not back in IGMPv3 mode"
+at "710.000 show groups"     | grep -q "225.9.9.9"               && FAIL "Group not left"
+at "7200.000 show groups"    | grep -q "225.1.2.3"               && FAIL "Group not expired"
+
+OK